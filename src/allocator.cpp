@@ -0,0 +1,332 @@
+/**
+ * \file
+ * \brief Allocator module source
+ * 
+ * Free blocks are kept in per-thread lists, one per power-of-two size class,
+ * linked through their first bytes. Blocks freed by another thread join that thread's lists.
+ * Large stacks bypass the pool and reserve address space directly (see map_reserve()).
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.hpp"
+#include "pointer.hpp"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+
+/// Number of size classes
+const int POOL_CLASSES = POOL_MAX_CLASS - POOL_MIN_CLASS + 1;
+
+
+/// Free block in the pool
+typedef struct PoolBlock {
+    struct PoolBlock *next = nullptr;
+} PoolBlock;
+
+
+/// Free lists of one thread
+struct PoolCache {
+    PoolBlock *free_lists[POOL_CLASSES] = {}; ///< Free blocks of each size class
+    int counts[POOL_CLASSES] = {};            ///< Length of each free list
+    PoolStats stats = {};                     ///< Statistics of this thread
+
+    ~PoolCache(); ///< Frees cached blocks when thread exits
+};
+
+
+static void *pool_allocate(size_t size, void *context);
+static void *pool_reallocate(void *ptr, size_t old_size, size_t new_size, void *context);
+static void pool_deallocate(void *ptr, size_t size, void *context);
+
+static void *heap_allocate(size_t size, void *context);
+static void *heap_reallocate(void *ptr, size_t old_size, size_t new_size, void *context);
+static void heap_deallocate(void *ptr, size_t size, void *context);
+
+
+/**
+ * \brief Finds size class of the block
+ * \param size Block size
+ * \return Class index or -1 if block is too large for the pool
+*/
+static int size_class(size_t size);
+
+
+const StackAllocator POOL_ALLOCATOR = {&pool_allocate, &pool_reallocate, &pool_deallocate, nullptr};
+
+const StackAllocator HEAP_ALLOCATOR = {&heap_allocate, &heap_reallocate, &heap_deallocate, nullptr};
+
+
+/// Allocator used for stack buffers
+static const StackAllocator *current_allocator = &POOL_ALLOCATOR;
+
+
+/// Pool of the current thread
+static thread_local PoolCache pool_cache;
+
+
+/// Is false after pool of the current thread was destroyed (blocks freed later go to heap)
+static thread_local bool pool_alive = true;
+
+
+/// Stack memory accounting of the current thread
+static thread_local AllocationStats allocation_counters;
+
+
+/**
+ * \brief Adds bytes to live bytes of the current thread and updates its peak
+ * \param bytes Allocated bytes (negative for freed ones)
+*/
+static void allocation_add(long long bytes);
+
+
+
+
+void set_stack_allocator(const StackAllocator *allocator) {
+    current_allocator = allocator ? allocator : &POOL_ALLOCATOR;
+}
+
+
+const StackAllocator *get_stack_allocator(void) {
+    return current_allocator;
+}
+
+
+void *stack_allocate(size_t size) {
+    void *ptr = current_allocator -> allocate(size, current_allocator -> context);
+
+    if (ptr) allocation_add((long long) size);
+
+    return ptr;
+}
+
+
+void *stack_reallocate(void *ptr, size_t old_size, size_t new_size) {
+    void *resized = current_allocator -> reallocate(ptr, old_size, new_size, current_allocator -> context);
+
+    if (resized) {
+        allocation_add((long long) new_size - (long long) old_size);
+
+        // Large block is moved or shrunk with its own mapping, so part of it can be unmapped
+        if (old_size >= HEAP_UNMAP_SIZE && (resized != ptr || new_size < old_size))
+            pointer_cache_invalidate();
+    }
+
+    return resized;
+}
+
+
+void stack_deallocate(void *ptr, size_t size) {
+    if (!ptr) return;
+
+    current_allocator -> deallocate(ptr, size, current_allocator -> context);
+
+    allocation_add(-(long long) size);
+
+    if (size >= HEAP_UNMAP_SIZE) pointer_cache_invalidate();
+}
+
+
+void pool_stats(PoolStats *stats) {
+    if (stats) *stats = pool_cache.stats;
+}
+
+
+void allocation_stats(AllocationStats *stats) {
+    if (stats) *stats = allocation_counters;
+}
+
+
+void allocation_peak_reset(void) {
+    allocation_counters.peak_bytes = allocation_counters.live_bytes;
+}
+
+
+void pool_trim(void) {
+    for(int i = 0; i < POOL_CLASSES; i++) {
+        while (pool_cache.free_lists[i]) {
+            PoolBlock *block = pool_cache.free_lists[i];
+            pool_cache.free_lists[i] = block -> next;
+            free(block);
+        }
+
+        pool_cache.counts[i] = 0;
+    }
+
+    pool_cache.stats.cached_bytes = 0;
+}
+
+
+void *map_reserve(size_t size, bool huge_pages) {
+    #ifdef _WIN32
+        return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+    #else
+        // Linux commits pages on the first touch, so reservation doesn't need separate commit
+        void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (ptr == MAP_FAILED) return NULL;
+
+        #ifdef MADV_HUGEPAGE
+            if (huge_pages) madvise(ptr, size, MADV_HUGEPAGE);
+        #endif
+
+        return ptr;
+    #endif
+}
+
+
+bool map_commit(void *ptr, size_t size) {
+    #ifdef _WIN32
+        return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+    #else
+        return true;
+    #endif
+}
+
+
+void map_discard(void *ptr, size_t size) {
+    #ifdef _WIN32
+        const size_t page = 4096;
+    #else
+        const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    #endif
+
+    size_t begin = ((size_t) ptr + page - 1) / page * page;
+    size_t end = ((size_t) ptr + size) / page * page;
+
+    if (begin >= end) return;
+
+    #ifdef _WIN32
+        VirtualFree((void *) begin, end - begin, MEM_DECOMMIT);
+    #else
+        madvise((void *) begin, end - begin, MADV_DONTNEED);
+    #endif
+}
+
+
+void map_release(void *ptr, size_t size) {
+    #ifdef _WIN32
+        VirtualFree(ptr, 0, MEM_RELEASE);
+    #else
+        munmap(ptr, size);
+    #endif
+
+    pointer_cache_invalidate();
+}
+
+
+PoolCache::~PoolCache() {
+    pool_trim();
+    pool_alive = false;
+}
+
+
+static void allocation_add(long long bytes) {
+    allocation_counters.live_bytes += bytes;
+
+    if (allocation_counters.live_bytes > allocation_counters.peak_bytes)
+        allocation_counters.peak_bytes = allocation_counters.live_bytes;
+}
+
+
+static int size_class(size_t size) {
+    int index = 0;
+
+    while (index < POOL_CLASSES && ((size_t) 1 << (index + POOL_MIN_CLASS)) < size)
+        index++;
+
+    return (index < POOL_CLASSES) ? index : -1;
+}
+
+
+static void *pool_allocate(size_t size, void *context) {
+    int index = size_class(size);
+
+    if (index < 0) return malloc(size);
+
+    size_t block_size = (size_t) 1 << (index + POOL_MIN_CLASS);
+
+    // Block is resized in place within its class, so it takes the whole class even without pool
+    if (!pool_alive) return malloc(block_size);
+
+    PoolBlock *block = pool_cache.free_lists[index];
+
+    if (block) {
+        pool_cache.free_lists[index] = block -> next;
+        pool_cache.counts[index]--;
+
+        pool_cache.stats.hits++;
+        pool_cache.stats.cached_bytes -= block_size;
+
+        return block;
+    }
+
+    pool_cache.stats.misses++;
+
+    return malloc(block_size);
+}
+
+
+static void *pool_reallocate(void *ptr, size_t old_size, size_t new_size, void *context) {
+    int old_index = size_class(old_size), new_index = size_class(new_size);
+
+    if (old_index < 0 && new_index < 0) return realloc(ptr, new_size);
+
+    if (old_index == new_index) {
+        if (pool_alive) pool_cache.stats.in_place++;
+        return ptr;
+    }
+
+    void *block = pool_allocate(new_size, context);
+    if (!block) return NULL;
+
+    memcpy(block, ptr, (old_size < new_size) ? old_size : new_size);
+
+    pool_deallocate(ptr, old_size, context);
+
+    return block;
+}
+
+
+static void pool_deallocate(void *ptr, size_t size, void *context) {
+    int index = size_class(size);
+
+    if (index < 0 || !pool_alive) {
+        free(ptr);
+        return;
+    }
+
+    if (pool_cache.counts[index] >= POOL_MAX_BLOCKS) {
+        pool_cache.stats.spills++;
+        free(ptr);
+        return;
+    }
+
+    PoolBlock *block = (PoolBlock *) ptr;
+
+    block -> next = pool_cache.free_lists[index];
+    pool_cache.free_lists[index] = block;
+    pool_cache.counts[index]++;
+
+    pool_cache.stats.releases++;
+    pool_cache.stats.cached_bytes += (size_t) 1 << (index + POOL_MIN_CLASS);
+}
+
+
+static void *heap_allocate(size_t size, void *context) {
+    return malloc(size);
+}
+
+
+static void *heap_reallocate(void *ptr, size_t old_size, size_t new_size, void *context) {
+    return realloc(ptr, new_size);
+}
+
+
+static void heap_deallocate(void *ptr, size_t size, void *context) {
+    free(ptr);
+}
@@ -0,0 +1,158 @@
+/**
+ * \file
+ * \brief Allocator module header
+ *
+ * Contains pluggable allocator for stack buffers and default thread-local size-class pool
+*/
+
+#ifndef ALLOCATOR_HPP
+#define ALLOCATOR_HPP
+
+#include <stddef.h>
+
+
+#define POOL_MIN_CLASS 6 ///< Smallest pooled block is 2^6 bytes
+#define POOL_MAX_CLASS 20 ///< Largest pooled block is 2^20 bytes, larger buffers go straight to heap
+#define POOL_MAX_BLOCKS 64 ///< Maximum number of free blocks cached per size class and thread
+#define HEAP_UNMAP_SIZE (128 * 1024) ///< Heap gives blocks of this size own mappings, so freeing them can unmap memory
+
+
+/// Allocator interface, memory returned by it isn't required to be zeroed
+typedef struct {
+    void *(*allocate)(size_t size, void *context);                                 ///< Returns memory block or NULL
+    void *(*reallocate)(void *ptr, size_t old_size, size_t new_size, void *context); ///< Resizes block, returns NULL and keeps old one on fail
+    void (*deallocate)(void *ptr, size_t size, void *context);                     ///< Frees block
+    void *context;                                                                 ///< Passed to every function
+} StackAllocator;
+
+
+/// Pool statistics of the calling thread
+typedef struct {
+    unsigned long long hits = 0;         ///< Allocations served from cached blocks
+    unsigned long long misses = 0;       ///< Allocations that went to heap
+    unsigned long long in_place = 0;     ///< Reallocations that fit the same block
+    unsigned long long releases = 0;     ///< Blocks returned to the cache
+    unsigned long long spills = 0;       ///< Blocks freed to heap because cache was full
+    unsigned long long cached_bytes = 0; ///< Bytes currently held in the cache
+} PoolStats;
+
+
+/// Stack memory given out by stack_allocate() and stack_reallocate() in the calling thread
+typedef struct {
+    long long live_bytes = 0; ///< Bytes allocated and not freed yet (negative if thread frees memory of other threads)
+    long long peak_bytes = 0; ///< Maximum of live bytes since allocation_peak_reset()
+} AllocationStats;
+
+
+/// Thread-local power-of-two size-class pool (default allocator)
+extern const StackAllocator POOL_ALLOCATOR;
+
+
+/// Plain malloc, realloc and free
+extern const StackAllocator HEAP_ALLOCATOR;
+
+
+/**
+ * \brief Sets allocator used for all stack buffers
+ * \param allocator New allocator or NULL for #POOL_ALLOCATOR
+ * \note Call it before any stack is constructed, buffers must be freed by the allocator they came from
+*/
+void set_stack_allocator(const StackAllocator *allocator);
+
+
+/**
+ * \brief Returns allocator used for stack buffers
+ * \return Current allocator
+*/
+const StackAllocator *get_stack_allocator(void);
+
+
+/**
+ * \brief Allocates memory with current allocator
+ * \param size Number of bytes
+ * \return Memory block or NULL
+*/
+void *stack_allocate(size_t size);
+
+
+/**
+ * \brief Resizes memory block with current allocator
+ * \param ptr Block to resize
+ * \param old_size Current block size
+ * \param new_size New block size
+ * \return Resized block or NULL (old block stays valid then)
+*/
+void *stack_reallocate(void *ptr, size_t old_size, size_t new_size);
+
+
+/**
+ * \brief Frees memory block with current allocator
+ * \param ptr Block to free
+ * \param size Block size
+ * \note Freeing block of #HEAP_UNMAP_SIZE or more drops pointer cache of every thread
+*/
+void stack_deallocate(void *ptr, size_t size);
+
+
+/**
+ * \brief Reserves address space, pages are committed when touched (see map_commit())
+ * \param size Number of bytes to reserve
+ * \param huge_pages Ask kernel to back region with transparent huge pages
+ * \return Page-aligned region or NULL
+*/
+void *map_reserve(size_t size, bool huge_pages);
+
+
+/**
+ * \brief Makes the beginning of reserved region usable
+ * \param ptr Region returned by map_reserve()
+ * \param size Number of bytes from the region beginning that must be usable
+ * \return True on success
+*/
+bool map_commit(void *ptr, size_t size);
+
+
+/**
+ * \brief Returns physical pages of the region part to the system, address space stays reserved
+ * \param ptr Beginning of the part
+ * \param size Part size (only whole pages inside it are returned)
+*/
+void map_discard(void *ptr, size_t size);
+
+
+/**
+ * \brief Releases region returned by map_reserve()
+ * \param ptr Region to release
+ * \param size Reserved size
+ * \note Drops pointer cache of every thread (see pointer_cache_invalidate())
+*/
+void map_release(void *ptr, size_t size);
+
+
+/**
+ * \brief Returns pool statistics of the calling thread
+ * \param stats Statistics will be written here
+*/
+void pool_stats(PoolStats *stats);
+
+
+/**
+ * \brief Frees every block cached by the calling thread
+*/
+void pool_trim(void);
+
+
+/**
+ * \brief Returns stack memory accounting of the calling thread
+ * \param stats Accounting will be written here
+ * \note Memory is counted by any allocator, but not guarded and mapped buffers that bypass it
+*/
+void allocation_stats(AllocationStats *stats);
+
+
+/**
+ * \brief Makes peak of the calling thread equal to its live bytes
+*/
+void allocation_peak_reset(void);
+
+#endif
@@ -0,0 +1,388 @@
+/**
+ * \file
+ * \brief Benchmark source
+ *
+ * Measures push, pop and mixed workloads for every protection level and writes results to JSON file.
+ * Restart cases compare rebuilding deep stack object by object with loading its snapshot.
+ * Built with optimizations by "make bench", stack buffers go through counting allocator.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "stack.hpp"
+#include "logs.hpp"
+
+
+/// Number of operations measured for each case
+const long long OPS_TARGET = 500000;
+
+/// Stack depths to sweep
+const StackSize DEPTHS[] = {16, 1024, 65536, 1048576};
+
+/// Pause between background verifier sweeps
+const unsigned VERIFIER_PERIOD_MS = 10;
+
+
+/// Benchmark workloads
+enum WORKLOADS {
+    WORKLOAD_PUSH,  ///< Pushes to empty stack until depth is reached
+    WORKLOAD_POP,   ///< Pops full stack until it is empty
+    WORKLOAD_MIXED, ///< Randomly pushes and pops around half of the depth
+};
+
+
+/// Workload names in JSON
+const char *WORKLOAD_NAMES[] = {"push", "pop", "mixed"};
+
+
+/// Restart workloads
+enum RESTART_WORKLOADS {
+    RESTART_REBUILD, ///< Pushes every object to new stack
+    RESTART_SAVE,    ///< Saves full stack to snapshot file
+    RESTART_LOAD,    ///< Loads snapshot and reads every object
+};
+
+
+/// Restart workload names in JSON
+const char *RESTART_NAMES[] = {"rebuild", "save", "load"};
+
+
+/// Snapshot file of restart cases
+const char SNAPSHOT_FILENAME[] = "bench_snapshot.bin";
+
+/// Restart of shallower stacks is measured in file syncs, not in objects
+const StackSize RESTART_MIN_DEPTH = 65536;
+
+
+/// Allocator calls made during one case
+typedef struct {
+    unsigned long long allocations = 0;   ///< Allocate calls
+    unsigned long long reallocations = 0; ///< Reallocate calls
+    unsigned long long bytes_copied = 0;  ///< Bytes moved by reallocations that changed the address
+} AllocatorCounters;
+
+
+/// Result of one case
+typedef struct {
+    long long ops = 0;              ///< Measured operations
+    double ns_per_op = 0;           ///< Average operation time
+    AllocatorCounters counters = {}; ///< Allocator calls
+    ErrorBits errors = 0;           ///< Errors returned by stack functions
+} BenchResult;
+
+
+/// Counters of the current case
+static AllocatorCounters counters = {};
+
+
+static void *count_allocate(size_t size, void *context);
+static void *count_reallocate(void *ptr, size_t old_size, size_t new_size, void *context);
+static void count_deallocate(void *ptr, size_t size, void *context);
+
+
+/// Heap allocator that counts calls
+const StackAllocator COUNTING_ALLOCATOR = {&count_allocate, &count_reallocate, &count_deallocate, nullptr};
+
+
+/**
+ * \brief Runs one workload on stack with given policy
+ * \param workload Workload (see #WORKLOADS)
+ * \param depth Maximum number of objects in stack
+ * \param options Stack flags and runtime protection (maximum capacity is set to depth)
+ * \return Time, allocations and errors
+*/
+template <typename Policy>
+static BenchResult run_case(int workload, StackSize depth, const StackOptions *options);
+
+
+/**
+ * \brief Runs one restart workload on stack with given policy
+ * \param workload Workload (see #RESTART_WORKLOADS)
+ * \param depth Number of objects in stack
+ * \return Time per object and errors
+*/
+template <typename Policy>
+static BenchResult run_restart(int workload, StackSize depth);
+
+
+/**
+ * \brief Prints result and appends it to JSON file
+ * \param json Results are appended to this file
+ * \param level Protection level name
+ * \param name Workload name
+ * \param depth Stack depth
+ * \param result Result of the case
+ * \param first Is true until the first result is written
+*/
+static void write_result(FILE *json, const char *level, const char *name, StackSize depth, const BenchResult *result, bool *first);
+
+
+/**
+ * \brief Runs every workload and depth for given policy
+ * \param json Results are appended to this file
+ * \param level Protection level name
+ * \param first Is true until the first result is written
+ * \param options Stack flags and runtime protection
+*/
+template <typename Policy>
+static void run_level(FILE *json, const char *level, bool *first, const StackOptions *options);
+
+
+
+
+int main(int argc, char *argv[]) {
+    const char *filename = (argc > 1) ? argv[1] : "bench.json";
+
+    FILE *json = fopen(filename, "w");
+
+    if (!json) {
+        printf("Couldn't open result file %s!\n", filename);
+        return 1;
+    }
+
+    open_log("bench_log.txt");
+
+    set_stack_allocator(&COUNTING_ALLOCATOR);
+
+    printf("%-12s %-7s %8s %10s %12s %14s %8s\n", "level", "case", "depth", "ns/op", "allocations", "bytes copied", "errors");
+
+    fprintf(json, "{\n    \"ops_target\": %lld,\n    \"results\": [", OPS_TARGET);
+
+    bool first = true;
+
+    StackOptions options = {};
+
+    run_level<NoProtectPolicy>(json, "none", &first, &options);
+    run_level<StackPolicy<NoCanaryProtect, NoHashProtect, PoisonProtect>>(json, "0", &first, &options);
+    run_level<StackPolicy<CanaryProtect, NoHashProtect, PoisonProtect>>(json, "1", &first, &options);
+    run_level<StackPolicy<NoCanaryProtect, HashProtect, PoisonProtect>>(json, "2", &first, &options);
+    run_level<StackPolicy<CanaryProtect, HashProtect, PoisonProtect>>(json, "3", &first, &options);
+
+    // Protection selected by each stack should cost the same as compiled one
+    options.protection = 0;
+    run_level<RuntimePolicy>(json, "runtime-0", &first, &options);
+
+    options.protection = CANARY_PROTECT | HASH_PROTECT;
+    run_level<RuntimePolicy>(json, "runtime-3", &first, &options);
+
+    // Full protection with structure hash and buffer checks left to background verifier
+    options.flags = STACK_FLAGS::STACK_VERIFIED;
+
+    verifier_start(VERIFIER_PERIOD_MS);
+    run_level<StackPolicy<CanaryProtect, HashProtect, PoisonProtect>>(json, "3-verified", &first, &options);
+    verifier_stop();
+
+    // Snapshot restart should cost page faults, rebuild costs a push per object
+    for(size_t d = 0; d < sizeof(DEPTHS) / sizeof(StackSize); d++) {
+        if (DEPTHS[d] < RESTART_MIN_DEPTH) continue;
+
+        for(int workload = 0; workload < 3; workload++) {
+            BenchResult result = run_restart<StackPolicy<CanaryProtect, HashProtect, PoisonProtect>>(workload, DEPTHS[d]);
+
+            write_result(json, "3", RESTART_NAMES[workload], DEPTHS[d], &result, &first);
+        }
+    }
+
+    remove(SNAPSHOT_FILENAME);
+
+    fprintf(json, "\n    ]\n}\n");
+
+    fclose(json);
+
+    close_log();
+
+    printf("Results are written to %s\n", filename);
+
+    return 0;
+}
+
+
+template <typename Policy>
+static void run_level(FILE *json, const char *level, bool *first, const StackOptions *options) {
+    for(size_t d = 0; d < sizeof(DEPTHS) / sizeof(StackSize); d++) {
+        for(int workload = 0; workload < 3; workload++) {
+            BenchResult result = run_case<Policy>(workload, DEPTHS[d], options);
+
+            write_result(json, level, WORKLOAD_NAMES[workload], DEPTHS[d], &result, first);
+        }
+    }
+}
+
+
+static void write_result(FILE *json, const char *level, const char *name, StackSize depth, const BenchResult *result, bool *first) {
+    printf("%-12s %-7s %8lld %10.2f %12llu %14llu %8llu\n", level, name, depth,
+           result -> ns_per_op, result -> counters.allocations + result -> counters.reallocations, result -> counters.bytes_copied, result -> errors);
+
+    fprintf(json, "%s\n        {\"level\": \"%s\", \"workload\": \"%s\", \"depth\": %lld, \"ops\": %lld, \"ns_per_op\": %.3f, "
+                  "\"allocations\": %llu, \"reallocations\": %llu, \"bytes_copied\": %llu, \"errors\": %llu}",
+            (*first) ? "" : ",", level, name, depth, result -> ops, result -> ns_per_op,
+            result -> counters.allocations, result -> counters.reallocations, result -> counters.bytes_copied, result -> errors);
+
+    *first = false;
+}
+
+
+template <typename Policy>
+static BenchResult run_case(int workload, StackSize depth, const StackOptions *options) {
+    BenchResult result = {};
+
+    StackOptions depth_options = *options;
+    depth_options.max_capacity = depth;
+
+    counters = {};
+
+    std::chrono::steady_clock::duration time = std::chrono::steady_clock::duration::zero();
+
+    while (result.ops < OPS_TARGET) {
+        BasicStack<Object, Policy> stack = {};
+
+        result.errors |= stack_constructor(&stack, 1, &depth_options);
+
+        StackSize prefill = (workload == WORKLOAD_POP) ? depth : ((workload == WORKLOAD_MIXED) ? depth / 2 : 0);
+
+        for(StackSize i = 0; i < prefill; i++)
+            result.errors |= stack_push(&stack, (Object) i);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        switch (workload) {
+            case WORKLOAD_PUSH:
+                for(StackSize i = 0; i < depth; i++)
+                    result.errors |= stack_push(&stack, (Object) i);
+
+                result.ops += depth;
+                break;
+
+            case WORKLOAD_POP:
+                for(StackSize i = 0; i < depth; i++) {
+                    Object object = 0;
+                    result.errors |= stack_pop(&stack, &object);
+                }
+
+                result.ops += depth;
+                break;
+
+            case WORKLOAD_MIXED: {
+                // Xorshift keeps operation order the same for every level
+                unsigned random = 2463534242u;
+
+                for(StackSize i = 0; i < 4 * depth; i++) {
+                    random ^= random << 13;
+                    random ^= random >> 17;
+                    random ^= random << 5;
+
+                    if ((random & 1) ? stack.size < depth : stack.size == 0)
+                        result.errors |= stack_push(&stack, (Object) i);
+                    else {
+                        Object object = 0;
+                        result.errors |= stack_pop(&stack, &object);
+                    }
+                }
+
+                result.ops += 4 * depth;
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        time += std::chrono::steady_clock::now() - start;
+
+        result.errors |= stack_destructor(&stack);
+    }
+
+    result.ns_per_op = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(time).count() / (double) result.ops;
+    result.counters = counters;
+
+    return result;
+}
+
+
+template <typename Policy>
+static BenchResult run_restart(int workload, StackSize depth) {
+    BenchResult result = {};
+
+    StackOptions options = {};
+    options.max_capacity = depth;
+
+    counters = {};
+
+    std::chrono::steady_clock::duration time = std::chrono::steady_clock::duration::zero();
+
+    while (result.ops < OPS_TARGET) {
+        BasicStack<Object, Policy> stack = {};
+
+        if (workload != RESTART_LOAD)
+            result.errors |= stack_constructor(&stack, 1, &options);
+
+        // Saved stack is built before the time is taken, its file is loaded by the next workload
+        if (workload == RESTART_SAVE)
+            for(StackSize i = 0; i < depth; i++)
+                result.errors |= stack_push(&stack, (Object) i);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        switch (workload) {
+            case RESTART_REBUILD:
+                for(StackSize i = 0; i < depth; i++)
+                    result.errors |= stack_push(&stack, (Object) i);
+                break;
+
+            case RESTART_SAVE:
+                result.errors |= stack_save(&stack, SNAPSHOT_FILENAME);
+                break;
+
+            case RESTART_LOAD: {
+                result.errors |= stack_load(&stack, SNAPSHOT_FILENAME, &options);
+
+                // Every page is faulted in, so lazy mapping isn't counted as free
+                long long sum = 0;
+
+                for(StackSize i = 0; i < stack.size; i++)
+                    sum += stack.data[i];
+
+                if (sum != depth * (depth - 1) / 2) result.errors |= ERROR_BIT_FLAGS::INVALID_DATA;
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        time += std::chrono::steady_clock::now() - start;
+
+        result.errors |= stack_destructor(&stack);
+        result.ops += depth;
+    }
+
+    result.ns_per_op = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(time).count() / (double) result.ops;
+    result.counters = counters;
+
+    return result;
+}
+
+
+static void *count_allocate(size_t size, void *context) {
+    counters.allocations++;
+
+    return malloc(size);
+}
+
+
+static void *count_reallocate(void *ptr, size_t old_size, size_t new_size, void *context) {
+    counters.reallocations++;
+
+    void *result = realloc(ptr, new_size);
+
+    if (result && result != ptr)
+        counters.bytes_copied += (old_size < new_size) ? old_size : new_size;
+
+    return result;
+}
+
+
+static void count_deallocate(void *ptr, size_t size, void *context) {
+    free(ptr);
+}
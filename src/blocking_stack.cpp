@@ -0,0 +1,367 @@
+/**
+ * \file
+ * \brief Blocking stack module source
+ *
+ * Every push changes pushed word and every pop changes popped word while the lock is held, so thread that saw
+ * no room or no object under the lock parks on the word it read and can't miss the change. Waiter counters
+ * are raised before parking, so the other side skips wake syscall when nobody waits.
+*/
+
+#include <chrono>
+#include <condition_variable>
+#include <limits.h>
+#include "blocking_stack.hpp"
+
+#ifdef __linux__
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <time.h>
+    #include <unistd.h>
+#endif
+
+
+/// Capacity of new stack if bound is larger
+const StackSize INITIAL_CAPACITY = 16;
+
+
+#ifndef __linux__
+    /// Number of parking buckets that wait words are spread over
+    const size_t PARKING_BUCKETS = 64;
+
+    /// Parking bucket, waiters of all words in it sleep on the same condition variable
+    typedef struct {
+        std::mutex mutex;
+        std::condition_variable wake;
+    } ParkingBucket;
+
+    /// Parking buckets
+    static ParkingBucket buckets[PARKING_BUCKETS];
+#endif
+
+
+/**
+ * \brief Returns current time
+ * \return Microseconds of steady clock
+*/
+static long long now_us(void);
+
+
+/**
+ * \brief Returns deadline of timeout
+ * \param timeout_us Timeout in microseconds
+ * \return Deadline in microseconds of steady clock, negative for #BLOCKING_WAIT_FOREVER
+*/
+static long long deadline_us(long long timeout_us);
+
+
+/**
+ * \brief Spins and then parks until word changes or deadline comes
+ * \param word Wait word
+ * \param value Value of word seen under the lock
+ * \param waiters Counter of threads parked on this word
+ * \param deadline Deadline (see deadline_us())
+ * \note Can return before the word changes, caller checks the stack again
+ * \return False if deadline has passed and caller must give up
+*/
+static bool wait_word(std::atomic<unsigned> *word, unsigned value, std::atomic<unsigned> *waiters, long long deadline);
+
+
+/**
+ * \brief Wakes threads parked on word
+ * \param word Wait word
+ * \param waiters Counter of threads parked on this word
+ * \param count Maximum number of threads to wake
+*/
+static void wake_word(std::atomic<unsigned> *word, std::atomic<unsigned> *waiters, StackSize count);
+
+
+/**
+ * \brief Parks thread while word holds value
+ * \param word Wait word
+ * \param value Expected value
+ * \param timeout_us Maximum sleep in microseconds (negative - no limit)
+*/
+static void park(std::atomic<unsigned> *word, unsigned value, long long timeout_us);
+
+
+/**
+ * \brief Wakes threads parked on word
+ * \param word Wait word
+ * \param count Maximum number of threads to wake
+*/
+static void unpark(std::atomic<unsigned> *word, int count);
+
+
+/// Tells CPU that thread spins
+static inline void spin_pause(void);
+
+
+
+
+ErrorBits blocking_stack_constructor(BlockingStack *stack, StackSize bound) {
+    CHECK(right_pointer(stack, sizeof(BlockingStack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+    CHECK(bound > 0, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    StackOptions options = {};
+    options.max_capacity = bound;
+
+    ErrorBits error = stack_constructor(&stack -> stack, (bound < INITIAL_CAPACITY) ? bound : INITIAL_CAPACITY, &options);
+    if (error) return error;
+
+    stack -> bound = bound;
+
+    stack -> pushed.store(0, std::memory_order_relaxed);
+    stack -> popped.store(0, std::memory_order_relaxed);
+    stack -> pop_waiters.store(0, std::memory_order_relaxed);
+    stack -> push_waiters.store(0, std::memory_order_relaxed);
+
+    DefaultPolicy::Canary::set_struct(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits blocking_stack_push(BlockingStack *stack, Object object, long long timeout_us) {
+    return blocking_stack_push_n(stack, &object, 1, NULL, timeout_us);
+}
+
+
+ErrorBits blocking_stack_pop(BlockingStack *stack, Object *object, long long timeout_us) {
+    return blocking_stack_pop_n(stack, object, 1, NULL, timeout_us);
+}
+
+
+ErrorBits blocking_stack_try_push(BlockingStack *stack, Object object) {
+    return blocking_stack_push_n(stack, &object, 1, NULL, 0);
+}
+
+
+ErrorBits blocking_stack_try_pop(BlockingStack *stack, Object *object) {
+    return blocking_stack_pop_n(stack, object, 1, NULL, 0);
+}
+
+
+ErrorBits blocking_stack_push_n(BlockingStack *stack, const Object *objects, StackSize count, StackSize *pushed, long long timeout_us) {
+    CHECK(count >= 0 && (objects || !count), return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    if (pushed) *pushed = 0;
+
+    CHECK(right_pointer(stack, sizeof(BlockingStack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    ErrorBits error = DefaultPolicy::Canary::check_struct(stack);
+    if (error) return error;
+
+    long long deadline = deadline_us(timeout_us);
+    StackSize done = 0;
+
+    while (done < count) {
+        StackSize part = 0;
+        unsigned seen = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(stack -> lock);
+
+            part = stack -> bound - stack -> stack.size;
+            if (part > count - done) part = count - done;
+
+            if (part > 0) {
+                error = stack_push_n(&stack -> stack, objects + done, part);
+
+                if (!error) stack -> pushed.fetch_add(1);
+            }
+
+            seen = stack -> popped.load(std::memory_order_relaxed);
+        }
+
+        if (error) break;
+
+        if (part > 0) {
+            done += part;
+            wake_word(&stack -> pushed, &stack -> pop_waiters, part);
+            continue;
+        }
+
+        if (!wait_word(&stack -> popped, seen, &stack -> push_waiters, deadline)) {
+            error = ERROR_BIT_FLAGS::STACK_OVERFLOW;
+            break;
+        }
+    }
+
+    if (pushed) *pushed = done;
+
+    return error;
+}
+
+
+ErrorBits blocking_stack_pop_n(BlockingStack *stack, Object *objects, StackSize count, StackSize *popped, long long timeout_us) {
+    CHECK(count > 0 && objects, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    if (popped) *popped = 0;
+
+    CHECK(right_pointer(stack, sizeof(BlockingStack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    ErrorBits error = DefaultPolicy::Canary::check_struct(stack);
+    if (error) return error;
+
+    long long deadline = deadline_us(timeout_us);
+
+    for(;;) {
+        StackSize part = 0;
+        unsigned seen = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(stack -> lock);
+
+            part = (stack -> stack.size < count) ? stack -> stack.size : count;
+
+            if (part > 0) {
+                error = stack_pop_n(&stack -> stack, objects, part);
+
+                if (!error) stack -> popped.fetch_add(1);
+            }
+
+            seen = stack -> pushed.load(std::memory_order_relaxed);
+        }
+
+        if (error) return error;
+
+        if (part > 0) {
+            if (popped) *popped = part;
+
+            wake_word(&stack -> popped, &stack -> push_waiters, part);
+
+            return ERROR_BIT_FLAGS::STACK_OK;
+        }
+
+        if (!wait_word(&stack -> pushed, seen, &stack -> pop_waiters, deadline))
+            return ERROR_BIT_FLAGS::EMPTY_STACK;
+    }
+}
+
+
+ErrorBits blocking_stack_destructor(BlockingStack *stack) {
+    ErrorBits error = blocking_stack_check(stack);
+    if (error) return error;
+
+    error = stack_destructor(&stack -> stack);
+    if (error) return error;
+
+    stack -> bound = 0;
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits blocking_stack_check(BlockingStack *stack) {
+    CHECK(right_pointer(stack, sizeof(BlockingStack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    ErrorBits error = DefaultPolicy::Canary::check_struct(stack);
+    if (error) return error;
+
+    std::lock_guard<std::mutex> lock(stack -> lock);
+
+    CHECK(stack -> bound > 0 && stack -> stack.size <= stack -> bound, return ERROR_BIT_FLAGS::INVALID_SIZE);
+
+    return stack_check(&stack -> stack);
+}
+
+
+static long long now_us(void) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+static long long deadline_us(long long timeout_us) {
+    if (timeout_us < 0) return -1;
+
+    return now_us() + timeout_us;
+}
+
+
+static bool wait_word(std::atomic<unsigned> *word, unsigned value, std::atomic<unsigned> *waiters, long long deadline) {
+    long long timeout_us = -1;
+
+    if (deadline >= 0) {
+        timeout_us = deadline - now_us();
+
+        if (timeout_us <= 0) return false;
+    }
+
+    // Short waits end here without syscalls
+    for(int i = 0; i < BLOCKING_SPINS; i++) {
+        if (word -> load(std::memory_order_relaxed) != value) return true;
+
+        spin_pause();
+    }
+
+    // Waker changes word before it reads the counter, so either it sees us or park() sees new word
+    waiters -> fetch_add(1);
+
+    park(word, value, timeout_us);
+
+    waiters -> fetch_sub(1, std::memory_order_relaxed);
+
+    return true;
+}
+
+
+static void wake_word(std::atomic<unsigned> *word, std::atomic<unsigned> *waiters, StackSize count) {
+    if (!waiters -> load()) return;
+
+    unpark(word, (count < INT_MAX) ? (int) count : INT_MAX);
+}
+
+
+#ifdef __linux__
+
+static void park(std::atomic<unsigned> *word, unsigned value, long long timeout_us) {
+    static_assert(sizeof(std::atomic<unsigned>) == sizeof(unsigned), "Futex needs plain 32-bit word");
+
+    struct timespec timeout = {};
+
+    timeout.tv_sec = (time_t)(timeout_us / 1000000);
+    timeout.tv_nsec = (long)(timeout_us % 1000000 * 1000);
+
+    // Returns at once if word has already changed, wakeups and signals are sorted out by the caller
+    syscall(SYS_futex, (unsigned *) word, FUTEX_WAIT_PRIVATE, value, (timeout_us < 0) ? NULL : &timeout, NULL, 0);
+}
+
+
+static void unpark(std::atomic<unsigned> *word, int count) {
+    syscall(SYS_futex, (unsigned *) word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+#else
+
+static void park(std::atomic<unsigned> *word, unsigned value, long long timeout_us) {
+    ParkingBucket *bucket = buckets + (size_t) word / sizeof(unsigned) % PARKING_BUCKETS;
+
+    std::unique_lock<std::mutex> lock(bucket -> mutex);
+
+    if (word -> load() != value) return;
+
+    if (timeout_us < 0)
+        bucket -> wake.wait(lock);
+    else
+        bucket -> wake.wait_for(lock, std::chrono::microseconds(timeout_us));
+}
+
+
+static void unpark(std::atomic<unsigned> *word, int count) {
+    ParkingBucket *bucket = buckets + (size_t) word / sizeof(unsigned) % PARKING_BUCKETS;
+
+    // Lock orders wakeup after the word check of any thread that is about to park
+    { std::lock_guard<std::mutex> lock(bucket -> mutex); }
+
+    // Bucket is shared by several words, so everybody wakes up and checks own word
+    bucket -> wake.notify_all();
+}
+
+#endif
+
+
+static inline void spin_pause(void) {
+    #if defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+    #endif
+}
@@ -0,0 +1,130 @@
+/**
+ * \file
+ * \brief Blocking stack module header
+ *
+ * Contains bounded Stack of #Object shared by threads: pop from empty stack and push to full one wait instead of failing.
+ * Waiting thread spins for a moment and then parks on a wait word (futex on Linux), so idle threads take no CPU
+*/
+
+#ifndef BLOCKING_STACK_HPP
+#define BLOCKING_STACK_HPP
+
+#include <atomic>
+#include <mutex>
+#include "stack.hpp"
+
+
+#define BLOCKING_WAIT_FOREVER -1 ///< Timeout that never expires
+#define BLOCKING_SPINS 128       ///< Checks of wait word before thread parks
+
+
+/// Structure for holding blocking stack
+typedef struct {
+    CanaryType canary_begin = 0;
+
+    Stack stack;                              ///< Objects, changed under lock only
+    StackSize bound = 0;                      ///< Maximum number of objects
+
+    std::mutex lock;                          ///< Guards stack
+    std::atomic<unsigned> pushed {0};         ///< Wait word of poppers, changed after every push
+    std::atomic<unsigned> popped {0};         ///< Wait word of pushers, changed after every pop
+    std::atomic<unsigned> pop_waiters {0};    ///< Poppers parked on pushed
+    std::atomic<unsigned> push_waiters {0};   ///< Pushers parked on popped
+
+    CanaryType canary_end = 0;
+} BlockingStack;
+
+
+/**
+ * \brief Constructs blocking stack
+ * \param stack This stack will be filled
+ * \param bound Maximum number of objects
+ * \note Not thread safe, call it before sharing the stack
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits blocking_stack_constructor(BlockingStack *stack, StackSize bound);
+
+
+/**
+ * \brief Adds object to stack, waits for room if stack is full
+ * \param stack This stack will be pushed
+ * \param object This object will be added to the top of stack
+ * \param timeout_us Maximum wait in microseconds (0 - don't wait, #BLOCKING_WAIT_FOREVER - wait until pushed)
+ * \return Error code (see #ERROR_BIT_FLAGS), #STACK_OVERFLOW if stack stayed full
+*/
+ErrorBits blocking_stack_push(BlockingStack *stack, Object object, long long timeout_us);
+
+
+/**
+ * \brief Pops top object from stack, waits for object if stack is empty
+ * \param stack This stack will be popped
+ * \param object Value of popped object will be written to this pointer
+ * \param timeout_us Maximum wait in microseconds (0 - don't wait, #BLOCKING_WAIT_FOREVER - wait until popped)
+ * \return Error code (see #ERROR_BIT_FLAGS), #EMPTY_STACK if stack stayed empty
+*/
+ErrorBits blocking_stack_pop(BlockingStack *stack, Object *object, long long timeout_us);
+
+
+/**
+ * \brief Adds object to stack if it has room
+ * \param stack This stack will be pushed
+ * \param object This object will be added to the top of stack
+ * \return Error code (see #ERROR_BIT_FLAGS), #STACK_OVERFLOW if stack is full
+*/
+ErrorBits blocking_stack_try_push(BlockingStack *stack, Object object);
+
+
+/**
+ * \brief Pops top object from stack if it has one
+ * \param stack This stack will be popped
+ * \param object Value of popped object will be written to this pointer
+ * \return Error code (see #ERROR_BIT_FLAGS), #EMPTY_STACK if stack is empty
+*/
+ErrorBits blocking_stack_try_pop(BlockingStack *stack, Object *object);
+
+
+/**
+ * \brief Adds array of objects to stack, waits for room while stack is full
+ * \param stack This stack will be pushed
+ * \param objects Objects will be added in the same order as if they were pushed one by one
+ * \param count Number of objects
+ * \param pushed Number of pushed objects will be written here (can be NULL)
+ * \param timeout_us Maximum wait in microseconds (0 - don't wait, #BLOCKING_WAIT_FOREVER - wait until all are pushed)
+ * \note Pushes as many objects as fit under one lock and wakes as many poppers, so objects of other pushers
+ * can get between parts of the array when stack fills up
+ * \return Error code (see #ERROR_BIT_FLAGS), #STACK_OVERFLOW if not all objects are pushed
+*/
+ErrorBits blocking_stack_push_n(BlockingStack *stack, const Object *objects, StackSize count, StackSize *pushed, long long timeout_us);
+
+
+/**
+ * \brief Pops up to count objects from stack, waits for object while stack is empty
+ * \param stack This stack will be popped
+ * \param objects Popped objects will be written here in stack order (last popped object is the former top)
+ * \param count Maximum number of objects
+ * \param popped Number of popped objects will be written here (can be NULL)
+ * \param timeout_us Maximum wait in microseconds (0 - don't wait, #BLOCKING_WAIT_FOREVER - wait until something is popped)
+ * \note Returns as soon as it pops at least one object and wakes as many pushers
+ * \return Error code (see #ERROR_BIT_FLAGS), #EMPTY_STACK if nothing is popped
+*/
+ErrorBits blocking_stack_pop_n(BlockingStack *stack, Object *objects, StackSize count, StackSize *popped, long long timeout_us);
+
+
+/**
+ * \brief Destructs blocking stack
+ * \param stack This stack will be destructed
+ * \note Not thread safe, no other thread can use or wait on the stack at this point
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits blocking_stack_destructor(BlockingStack *stack);
+
+
+/**
+ * \brief Blocking stack verificator
+ * \param stack Stack to check
+ * \note Takes the lock to check inner stack
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits blocking_stack_check(BlockingStack *stack);
+
+#endif
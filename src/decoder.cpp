@@ -0,0 +1,120 @@
+/**
+ * \file
+ * \brief Dump decoder source
+ *
+ * Usage: "decoder.exe dump.bin" prints every dump of the file as text,
+ * "decoder.exe --diff old.bin new.bin" prints differences of dumps with the same number.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dump.hpp"
+
+
+/**
+ * \brief Prints every dump of the file
+ * \param filename Dump file
+ * \return 0 - OK, 1 - FAIL
+*/
+static int render_file(const char *filename);
+
+
+/**
+ * \brief Prints differences of dumps pairwise
+ * \param old_filename First dump file
+ * \param new_filename Second dump file
+ * \return 0 - dumps are the same, 1 - dumps differ or couldn't be read
+*/
+static int diff_files(const char *old_filename, const char *new_filename);
+
+
+
+
+int main(int argc, char *argv[]) {
+    if (argc == 2)
+        return render_file(argv[1]);
+
+    if (argc == 4 && !strcmp(argv[1], "--diff"))
+        return diff_files(argv[2], argv[3]);
+
+    printf("Usage: %s dump.bin\n       %s --diff old.bin new.bin\n", argv[0], argv[0]);
+
+    return 1;
+}
+
+
+static int render_file(const char *filename) {
+    FILE *stream = fopen(filename, "rb");
+
+    if (!stream) {
+        printf("Couldn't open dump file %s!\n", filename);
+        return 1;
+    }
+
+    DumpHeader header = {};
+    char *payload = nullptr;
+
+    for(int i = 0; !dump_read(stream, &header, &payload); i++) {
+        printf("Dump #%d\n", i);
+        dump_render(&header, payload, stdout);
+
+        free(payload);
+    }
+
+    fclose(stream);
+
+    return 0;
+}
+
+
+static int diff_files(const char *old_filename, const char *new_filename) {
+    FILE *old_stream = fopen(old_filename, "rb");
+    FILE *new_stream = fopen(new_filename, "rb");
+
+    if (!old_stream || !new_stream) {
+        printf("Couldn't open dump files %s and %s!\n", old_filename, new_filename);
+
+        if (old_stream) fclose(old_stream);
+        if (new_stream) fclose(new_stream);
+
+        return 1;
+    }
+
+    DumpHeader old_header = {}, new_header = {};
+    char *old_payload = nullptr, *new_payload = nullptr;
+
+    size_t count = 0;
+
+    for(int i = 0; true; i++) {
+        int old_end = dump_read(old_stream, &old_header, &old_payload);
+        int new_end = dump_read(new_stream, &new_header, &new_payload);
+
+        if (old_end || new_end) {
+            if (old_end != new_end) {
+                printf("Dump #%d exists only in %s\n", i, (old_end) ? new_filename : old_filename);
+                count++;
+            }
+
+            free(old_payload);
+            free(new_payload);
+            break;
+        }
+
+        printf("Dump #%d:\n", i);
+
+        size_t differences = dump_diff(&old_header, old_payload, &new_header, new_payload, stdout);
+
+        if (!differences) printf("\tSame\n");
+
+        count += differences;
+
+        free(old_payload);
+        free(new_payload);
+    }
+
+    fclose(old_stream);
+    fclose(new_stream);
+
+    return count != 0;
+}
@@ -0,0 +1,301 @@
+/**
+ * \file
+ * \brief Binary dump module source
+ *
+ * Payload is unpacked to plain slots with poison runs filled back, so rendering and diff work like on the real buffer.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "dump.hpp"
+
+
+/**
+ * \brief Prints difference of header field and counts it
+ * \param [in] name Field name
+ * \param [in] field Field of #DumpHeader
+ * \param [in] format Format of the field
+*/
+#define DIFF_FIELD(name, field, format) \
+do { \
+    if (old_header -> field != new_header -> field) { \
+        fprintf(stream, "\t" name ": " format " -> " format "\n", old_header -> field, new_header -> field); \
+        count++; \
+    } \
+} while(0)
+
+
+/**
+ * \brief Prints slot as #Object if its size matches or as bytes otherwise
+ * \param slot Slot to print
+ * \param object_size Size of slot
+ * \param stream File to print in
+*/
+static void print_slot(const char *slot, unsigned object_size, FILE *stream);
+
+
+/**
+ * \brief Checks if slot is filled with bytes of #POISON_VALUE
+ * \param slot Slot to check
+ * \param object_size Size of slot
+ * \return True if slot is poisoned
+*/
+static bool slot_poison(const char *slot, unsigned object_size);
+
+
+/**
+ * \brief Allocates buffer and unpacks dump slots into it
+ * \param header Dump header
+ * \param payload Dump payload
+ * \return Slots or null if dump has no buffer or is broken
+*/
+static char *unpack_slots(const DumpHeader *header, const char *payload);
+
+
+
+
+int dump_read(FILE *stream, DumpHeader *header, char **payload) {
+    CHECK(stream && header && payload, return 1);
+
+    *payload = nullptr;
+
+    if (fread(header, sizeof(DumpHeader), 1, stream) != 1) return 1;
+
+    if (header -> magic != DUMP_MAGIC || header -> version != DUMP_VERSION) {
+        printf("Broken dump header!\n");
+        return 1;
+    }
+
+    *payload = (char *) malloc((size_t) header -> payload_bytes + 1);
+    CHECK(*payload, return 1);
+
+    if (fread(*payload, 1, (size_t) header -> payload_bytes, stream) != header -> payload_bytes) {
+        printf("Dump is cut off!\n");
+
+        free(*payload);
+        *payload = nullptr;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int dump_unpack(const DumpHeader *header, const char *payload, char *slots) {
+    CHECK(header && payload && slots, return 1);
+
+    if (!header -> has_buffer || header -> size < 0 || header -> size > header -> watermark) return 1;
+
+    size_t object_size = header -> object_size;
+    size_t left = (size_t) header -> payload_bytes;
+
+    if ((size_t) header -> size * object_size > left) return 1;
+
+    memcpy(slots, payload, (size_t) header -> size * object_size);
+
+    payload += (size_t) header -> size * object_size;
+    left -= (size_t) header -> size * object_size;
+
+    for(StackSize i = header -> size; i < header -> watermark;) {
+        StackSize poison = 0, raw = 0;
+
+        if (left < 2 * sizeof(StackSize)) return 1;
+
+        memcpy(&poison, payload, sizeof(StackSize));
+        memcpy(&raw, payload + sizeof(StackSize), sizeof(StackSize));
+
+        payload += 2 * sizeof(StackSize);
+        left -= 2 * sizeof(StackSize);
+
+        if (poison < 0 || raw < 0 || poison + raw == 0 || i + poison + raw > header -> watermark
+                || (size_t) raw * object_size > left)
+            return 1;
+
+        poison_fill((unsigned char *) slots + (size_t) i * object_size, (StackSize)((size_t) poison * object_size));
+        memcpy(slots + (size_t)(i + poison) * object_size, payload, (size_t) raw * object_size);
+
+        payload += (size_t) raw * object_size;
+        left -= (size_t) raw * object_size;
+
+        i += poison + raw;
+    }
+
+    return left != 0;
+}
+
+
+void dump_render(const DumpHeader *header, const char *payload, FILE *stream) {
+    CHECK(header && stream, return);
+
+    fprintf(stream, "\tStack[%p]:\n", (void *) header -> stack_address);
+
+    print_errors(header -> error, stream);
+
+    fprintf(stream, "\tCapacity: %llu\n\tMax capacity: %llu\n\tSize: %llu\n", header -> capacity, header -> max_capacity, header -> size);
+
+    if (header -> flags & STACK_FLAGS::STACK_MAPPED)
+        fprintf(stream, "\tMapped%s\n", (header -> flags & STACK_FLAGS::STACK_HUGE_PAGES) ? " (huge pages)" : "");
+
+    if (header -> flags & STACK_FLAGS::STACK_VERIFIED)
+        fprintf(stream, "\tVerified\n");
+
+    if (header -> flags & STACK_FLAGS::STACK_FILE)
+        fprintf(stream, "\tFile-backed\n");
+
+    if (header -> protection & HASH_PROTECT) {
+        const HashEngine *engine = find_hash_engine(header -> hash_engine);
+
+        fprintf(stream, "\tHash engine: %s\n", (engine && header -> hash_engine != HASH_ENGINE_AUTO) ? engine -> name : "unknown");
+        fprintf(stream, "\tBuffer hash: %0llx\n\tStruct hash: %0llx\n", header -> buffer_hash, header -> struct_hash);
+    }
+
+    fprintf(stream, "\tData[%p]", (void *) header -> data_address);
+
+    if (!header -> has_buffer) {
+        fputc('\n', stream);
+        return;
+    }
+
+    fprintf(stream, ":\n");
+
+    char *slots = unpack_slots(header, payload);
+
+    if (!slots) {
+        fprintf(stream, "\t\t(BROKEN PAYLOAD)\n\n");
+        return;
+    }
+
+    if (header -> protection & CANARY_PROTECT)
+        fprintf(stream, "\t\tCanary: %0llx\n", header -> buffer_canary[0]);
+
+    for(StackSize i = 0; i < header -> watermark; i++) {
+        const char *slot = slots + (size_t) i * header -> object_size;
+
+        fprintf(stream, "\t\t[%03lld] ", i);
+
+        print_slot(slot, header -> object_size, stream);
+
+        if (slot_poison(slot, header -> object_size)) fprintf(stream, " (POISON VALUE)");
+
+        fputc('\n', stream);
+    }
+
+    if (header -> watermark < header -> capacity)
+        fprintf(stream, "\t\t[%03lld - %03lld] (UNTOUCHED)\n", header -> watermark, header -> capacity - 1);
+
+    if (header -> protection & CANARY_PROTECT)
+        fprintf(stream, "\t\tCanary: %0llx\n", header -> buffer_canary[1]);
+
+    fputc('\n', stream);
+
+    free(slots);
+}
+
+
+size_t dump_diff(const DumpHeader *old_header, const char *old_payload,
+                 const DumpHeader *new_header, const char *new_payload, FILE *stream) {
+    CHECK(old_header && new_header && stream, return 0);
+
+    size_t count = 0;
+
+    DIFF_FIELD("Stack", stack_address, "%llx");
+    DIFF_FIELD("Errors", error, "%llx");
+    DIFF_FIELD("Flags", flags, "%x");
+    DIFF_FIELD("Hash engine", hash_engine, "%u");
+    DIFF_FIELD("Capacity", capacity, "%lld");
+    DIFF_FIELD("Max capacity", max_capacity, "%lld");
+    DIFF_FIELD("Size", size, "%lld");
+    DIFF_FIELD("Watermark", watermark, "%lld");
+    DIFF_FIELD("Buffer hash", buffer_hash, "%llx");
+    DIFF_FIELD("Struct hash", struct_hash, "%llx");
+    DIFF_FIELD("Struct canary begin", struct_canary[0], "%llx");
+    DIFF_FIELD("Struct canary end", struct_canary[1], "%llx");
+    DIFF_FIELD("Data", data_address, "%llx");
+    DIFF_FIELD("Buffer canary begin", buffer_canary[0], "%llx");
+    DIFF_FIELD("Buffer canary end", buffer_canary[1], "%llx");
+
+    if (old_header -> object_size != new_header -> object_size) {
+        fprintf(stream, "\tObject size: %u -> %u, slots are not compared\n", old_header -> object_size, new_header -> object_size);
+        return count + 1;
+    }
+
+    char *old_slots = unpack_slots(old_header, old_payload);
+    char *new_slots = unpack_slots(new_header, new_payload);
+
+    if (old_slots && new_slots) {
+        StackSize watermark = (old_header -> watermark > new_header -> watermark) ? old_header -> watermark : new_header -> watermark;
+        unsigned object_size = old_header -> object_size;
+
+        for(StackSize i = 0; i < watermark; i++) {
+            const char *old_slot = (i < old_header -> watermark) ? old_slots + (size_t) i * object_size : nullptr;
+            const char *new_slot = (i < new_header -> watermark) ? new_slots + (size_t) i * object_size : nullptr;
+
+            if (old_slot && new_slot && !memcmp(old_slot, new_slot, object_size)) continue;
+
+            fprintf(stream, "\t\t[%03lld] ", i);
+
+            if (old_slot) print_slot(old_slot, object_size, stream);
+            else fprintf(stream, "(UNTOUCHED)");
+
+            fprintf(stream, " -> ");
+
+            if (new_slot) print_slot(new_slot, object_size, stream);
+            else fprintf(stream, "(UNTOUCHED)");
+
+            fputc('\n', stream);
+
+            count++;
+        }
+    }
+    else if (old_slots || new_slots) {
+        fprintf(stream, "\tData: %s -> %s\n", (old_slots) ? "dumped" : "not dumped", (new_slots) ? "dumped" : "not dumped");
+        count++;
+    }
+
+    free(old_slots);
+    free(new_slots);
+
+    return count;
+}
+
+
+static void print_slot(const char *slot, unsigned object_size, FILE *stream) {
+    if (object_size == sizeof(Object)) {
+        Object object = {};
+        memcpy(&object, slot, sizeof(Object));
+
+        print_object(&object, stream);
+        return;
+    }
+
+    for(unsigned i = 0; i < object_size; i++)
+        fprintf(stream, "%02x", (unsigned char) slot[i]);
+}
+
+
+static bool slot_poison(const char *slot, unsigned object_size) {
+    unsigned char pattern[sizeof(unsigned)] = {};
+    poison_fill(pattern, sizeof(unsigned));
+
+    for(unsigned i = 0; i < object_size; i++)
+        if ((unsigned char) slot[i] != pattern[i % sizeof(unsigned)])
+            return false;
+
+    return true;
+}
+
+
+static char *unpack_slots(const DumpHeader *header, const char *payload) {
+    if (!header -> has_buffer || !payload || header -> watermark < 0) return nullptr;
+
+    char *slots = (char *) malloc((size_t) header -> watermark * header -> object_size + 1);
+    if (!slots) return nullptr;
+
+    if (dump_unpack(header, payload, slots)) {
+        free(slots);
+        return nullptr;
+    }
+
+    return slots;
+}
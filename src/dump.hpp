@@ -0,0 +1,56 @@
+/**
+ * \file
+ * \brief Binary dump module header
+ *
+ * Reads dumps written by stack_dump_binary(), renders them as stack_dump() text and compares them.
+*/
+
+#ifndef DUMP_HPP
+#define DUMP_HPP
+
+#include <stdio.h>
+#include "stack.hpp"
+
+
+/**
+ * \brief Reads next dump from file
+ * \param [in] stream File to read from
+ * \param [out] header Dump header
+ * \param [out] payload Dump payload, must be freed by caller
+ * \return 0 - OK, 1 - FAIL (end of file or broken dump)
+*/
+int dump_read(FILE *stream, DumpHeader *header, char **payload);
+
+
+/**
+ * \brief Unpacks payload to touched slots of the buffer
+ * \param [in] header Dump header
+ * \param [in] payload Dump payload
+ * \param [out] slots Buffer of header -> watermark slots, poison runs are filled with #POISON_VALUE bytes
+ * \return 0 - OK, 1 - FAIL (payload doesn't match header)
+*/
+int dump_unpack(const DumpHeader *header, const char *payload, char *slots);
+
+
+/**
+ * \brief Prints dump the way stack_dump() prints stack
+ * \param header Dump header
+ * \param payload Dump payload
+ * \param stream File to print in
+*/
+void dump_render(const DumpHeader *header, const char *payload, FILE *stream);
+
+
+/**
+ * \brief Prints fields and slots that differ between two dumps
+ * \param old_header Header of the first dump
+ * \param old_payload Payload of the first dump
+ * \param new_header Header of the second dump
+ * \param new_payload Payload of the second dump
+ * \param stream File to print in
+ * \return Number of differences
+*/
+size_t dump_diff(const DumpHeader *old_header, const char *old_payload,
+                 const DumpHeader *new_header, const char *new_payload, FILE *stream);
+
+#endif
@@ -0,0 +1,297 @@
+/**
+ * \file
+ * \brief Guard page module source
+ *
+ * Every buffer gets its own mapping: inaccessible page, buffer pages and inaccessible page again.
+ * Buffer is placed at the end of its pages. Mappings are kept in fixed table that fault handler scans without locks.
+ * Handler only does async-signal-safe work: it notes the fault in a thread slot and writes fixed message with write(),
+ * owner reports the fault after recovery (see guard_recover()).
+*/
+
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include "guard.hpp"
+#include "logs.hpp"
+#include "pointer.hpp"
+#include "verifier.hpp"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <signal.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+
+/// Marks region that is being filled
+#define REGION_CLAIMED ((char *) 1)
+
+
+/// Guarded mapping
+typedef struct {
+    std::atomic<char *> base;  ///< Beginning of mapping (null - free region, #REGION_CLAIMED - being filled)
+    size_t size;               ///< Size of mapping with both guard pages
+    void *owner;               ///< Passed to report function
+    GuardReport report;        ///< Called on fault
+} GuardRegion;
+
+
+/// Fault noted by handler and not reported yet
+typedef struct {
+    std::atomic<char *> address; ///< Faulted address (null - no fault)
+    bool underrun;               ///< Fault hit the page before the buffer
+    void *owner;                 ///< Owner of the faulted buffer
+    GuardReport report;          ///< Report function of the faulted buffer
+} GuardFault;
+
+
+/// Guarded mappings
+static GuardRegion regions[GUARD_MAX_REGIONS] = {};
+
+/// Reported faults
+static std::atomic<unsigned long long> faults(0);
+
+
+#ifndef _WIN32
+/// Handler that was installed before ours
+static struct sigaction previous_action = {};
+
+/// Jump buffer of the current thread (see guard_set_recovery())
+static thread_local sigjmp_buf *thread_recovery = nullptr;
+
+/// Fault of the current thread waiting for guard_recover()
+static thread_local GuardFault thread_fault = {};
+
+/// Descriptor fault handler writes its message to (duplicate of stderr taken before any fault)
+static int fault_fd = -1;
+
+/// Installs fault handler once
+static std::once_flag handler_once;
+#endif
+
+
+/**
+ * \brief Returns page size
+ * \return Page size
+*/
+static size_t page_size(void);
+
+
+/**
+ * \brief Puts mapping in the table
+ * \param base Beginning of mapping
+ * \param size Size of mapping
+ * \param owner Owner of the buffer
+ * \param report Report function
+ * \return 0 - OK, 1 - FAIL (table is full)
+*/
+static int region_add(char *base, size_t size, void *owner, GuardReport report);
+
+
+/**
+ * \brief Removes mapping from the table
+ * \param base Beginning of mapping
+*/
+static void region_remove(char *base);
+
+
+#ifndef _WIN32
+/// Installs fault handler
+static void install_handler(void);
+
+/// Fault handler
+static void fault_handler(int signal, siginfo_t *info, void *context);
+#endif
+
+
+
+
+void *guard_allocate(size_t size, void *owner, GuardReport report) {
+    size_t page = page_size();
+    size_t pages = (size + page - 1) / page * page;
+
+    #ifdef _WIN32
+        char *base = (char *) VirtualAlloc(NULL, pages + 2 * page, MEM_RESERVE, PAGE_NOACCESS);
+        if (!base) return NULL;
+
+        if (!VirtualAlloc(base + page, pages, MEM_COMMIT, PAGE_READWRITE)) {
+            VirtualFree(base, 0, MEM_RELEASE);
+            return NULL;
+        }
+    #else
+        std::call_once(handler_once, &install_handler);
+
+        char *base = (char *) mmap(NULL, pages + 2 * page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) return NULL;
+
+        if (mprotect(base + page, pages, PROT_READ | PROT_WRITE)) {
+            munmap(base, pages + 2 * page);
+            return NULL;
+        }
+    #endif
+
+    // Buffer whose faults can't be reported isn't given out
+    if (region_add(base, pages + 2 * page, owner, report)) {
+        #ifdef _WIN32
+            VirtualFree(base, 0, MEM_RELEASE);
+        #else
+            munmap(base, pages + 2 * page);
+        #endif
+
+        return NULL;
+    }
+
+    return base + page + pages - size;
+}
+
+
+void guard_free(void *ptr, size_t size) {
+    if (!ptr) return;
+
+    size_t page = page_size();
+    size_t pages = (size + page - 1) / page * page;
+
+    char *base = (char *) ptr + size - pages - page;
+
+    region_remove(base);
+
+    #ifdef _WIN32
+        VirtualFree(base, 0, MEM_RELEASE);
+    #else
+        munmap(base, pages + 2 * page);
+    #endif
+
+    pointer_cache_invalidate();
+}
+
+
+unsigned long long guard_faults(void) {
+    return faults.load(std::memory_order_relaxed);
+}
+
+
+#ifndef _WIN32
+void guard_set_recovery(sigjmp_buf *recovery) {
+    thread_recovery = recovery;
+}
+
+
+int guard_recover(void) {
+    char *address = thread_fault.address.exchange(nullptr, std::memory_order_acquire);
+    if (!address) return 0;
+
+    // Jump skipped destructors of VerifierLock between recovery point and the fault
+    verifier_release();
+
+    FILE *log = get_log_file();
+
+    if (log) fprintf(log, "Guard page %s at %p\n", (thread_fault.underrun) ? "underrun" : "overrun", (void *) address);
+
+    if (thread_fault.report) thread_fault.report(thread_fault.owner);
+
+    log_flush();
+
+    return 1;
+}
+#endif
+
+
+static size_t page_size(void) {
+    #ifdef _WIN32
+        return 4096;
+    #else
+        static const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        return page;
+    #endif
+}
+
+
+static int region_add(char *base, size_t size, void *owner, GuardReport report) {
+    for(size_t i = 0; i < GUARD_MAX_REGIONS; i++) {
+        char *expected = nullptr;
+
+        if (!regions[i].base.compare_exchange_strong(expected, REGION_CLAIMED, std::memory_order_acquire)) continue;
+
+        regions[i].size = size;
+        regions[i].owner = owner;
+        regions[i].report = report;
+
+        regions[i].base.store(base, std::memory_order_release);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static void region_remove(char *base) {
+    for(size_t i = 0; i < GUARD_MAX_REGIONS; i++) {
+        if (regions[i].base.load(std::memory_order_relaxed) == base) {
+            regions[i].base.store(nullptr, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+
+#ifndef _WIN32
+static void install_handler(void) {
+    struct sigaction action = {};
+
+    action.sa_sigaction = &fault_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+
+    fault_fd = dup(STDERR_FILENO);
+
+    sigaction(SIGSEGV, &action, &previous_action);
+}
+
+
+static void fault_handler(int signal, siginfo_t *info, void *context) {
+    char *address = (char *) info -> si_addr;
+    size_t page = page_size();
+
+    for(size_t i = 0; i < GUARD_MAX_REGIONS; i++) {
+        char *base = regions[i].base.load(std::memory_order_acquire);
+
+        if (base <= REGION_CLAIMED || address < base || address >= base + regions[i].size) continue;
+
+        bool underrun = address < base + page;
+
+        // Address is inside the buffer pages, so the fault isn't ours
+        if (!underrun && address < base + regions[i].size - page) break;
+
+        faults.fetch_add(1, std::memory_order_relaxed);
+
+        static const char overrun_message[] = "Guard page overrun\n";
+        static const char underrun_message[] = "Guard page underrun\n";
+
+        if (fault_fd >= 0) {
+            ssize_t written = (underrun) ? write(fault_fd, underrun_message, sizeof(underrun_message) - 1)
+                                         : write(fault_fd, overrun_message, sizeof(overrun_message) - 1);
+            (void) written;
+        }
+
+        if (thread_recovery) {
+            // Region may be freed by other thread before the report, so its owner is copied now
+            thread_fault.underrun = underrun;
+            thread_fault.owner = regions[i].owner;
+            thread_fault.report = regions[i].report;
+            thread_fault.address.store(address, std::memory_order_release);
+
+            sigjmp_buf *recovery = thread_recovery;
+            thread_recovery = nullptr;
+
+            siglongjmp(*recovery, 1);
+        }
+
+        break;
+    }
+
+    // Returning with previous handler makes the same access fault again and end up there
+    sigaction(SIGSEGV, &previous_action, NULL);
+}
+#endif
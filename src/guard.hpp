@@ -0,0 +1,72 @@
+/**
+ * \file
+ * \brief Guard page module header
+ *
+ * Allocates buffers between inaccessible pages, so overruns fault on the first wrong access.
+ * Fault handler writes short message to stderr. If the thread set recovery point, the handler jumps there
+ * and the buffer owner reports the fault from guard_recover().
+*/
+
+#ifndef GUARD_HPP
+#define GUARD_HPP
+
+#include <stddef.h>
+
+#ifndef _WIN32
+    #include <setjmp.h>
+#endif
+
+
+#define GUARD_MAX_REGIONS 4096 ///< Maximum number of live guarded buffers (guard_allocate() fails beyond it)
+
+
+/// Called from guard_recover() with owner of the faulted buffer
+typedef void (*GuardReport)(void *owner);
+
+
+/**
+ * \brief Allocates buffer that ends right before inaccessible page
+ * \param size Number of bytes
+ * \param owner Passed to report function on fault
+ * \param report Called after recovery from fault on guard page of this buffer (can be NULL)
+ * \return Buffer or NULL (also when #GUARD_MAX_REGIONS buffers are live)
+ * \note Page before the buffer is inaccessible too, but underrun traps only after it passes rest of the first page.
+ * Each buffer takes at least three pages of address space, so it suits long-living stacks only
+*/
+void *guard_allocate(size_t size, void *owner, GuardReport report);
+
+
+/**
+ * \brief Frees buffer returned by guard_allocate()
+ * \param ptr Buffer to free
+ * \param size Buffer size
+ * \note Drops pointer cache of every thread (see pointer_cache_invalidate())
+*/
+void guard_free(void *ptr, size_t size);
+
+
+/**
+ * \brief Returns number of guard page faults reported since start
+ * \return Number of faults
+*/
+unsigned long long guard_faults(void);
+
+
+#ifndef _WIN32
+/**
+ * \brief Makes fault handler jump to given point of the current thread instead of crashing
+ * \param recovery Jump buffer filled by sigsetjmp() with saved signal mask or NULL to crash again
+ * \note Handler resets it before jump, so it must be set again for the next fault
+*/
+void guard_set_recovery(sigjmp_buf *recovery);
+
+
+/**
+ * \brief Reports fault that made handler jump to recovery point of the current thread
+ * \return 1 if there was such fault, 0 otherwise
+ * \note Call it when sigsetjmp() returns non zero. It also releases verifier slots the jump left held (see verifier_release())
+*/
+int guard_recover(void);
+#endif
+
+#endif
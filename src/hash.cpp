@@ -0,0 +1,298 @@
+/**
+ * \file
+ * \brief Hash module source
+ *
+ * Polynomial engine evaluates the same byte polynomial as byte-wise loop, but eight bytes per step with precomputed powers.
+ * CRC32C engine removes bytes by running the table update backwards (top byte of table entry identifies its index).
+*/
+
+#include <string.h>
+#include <atomic>
+#include "hash.hpp"
+
+
+/// Initial value of #HASH_ENGINE_GNU hash
+const HashType GNU_SEED = 5381;
+
+/// #HASH_ENGINE_GNU multiplier
+const HashType GNU_FACTOR = 33;
+
+/// Multiplicative inverse of #GNU_FACTOR modulo 2^64 (used to remove bytes from hash)
+const HashType GNU_FACTOR_INVERSE = 0x0F83E0F83E0F83E1ull;
+
+/// Initial value of #HASH_ENGINE_POLY hash
+const HashType POLY_SEED = 0xCBF29CE484222325ull;
+
+/// #HASH_ENGINE_POLY multiplier (must be odd to have inverse)
+const HashType POLY_FACTOR = 0x100000001B3ull;
+
+/// Initial value of #HASH_ENGINE_CRC32C hash
+const HashType CRC_SEED = 0xFFFFFFFFull;
+
+/// Reflected CRC32C polynomial
+const unsigned CRC_POLYNOMIAL = 0x82F63B78u;
+
+
+/// Powers of #POLY_FACTOR and their inverses
+typedef struct {
+    HashType powers[9];  ///< POLY_FACTOR^i
+    HashType inverse;    ///< POLY_FACTOR^-1
+    HashType inverse_8;  ///< POLY_FACTOR^-8
+} PolyTables;
+
+
+/// CRC32C table and its inverse
+typedef struct {
+    unsigned forward[256];      ///< Byte update table
+    unsigned char inverse[256]; ///< Index of table entry by its top byte
+} CrcTables;
+
+
+/**
+ * \brief Computes powers of #POLY_FACTOR
+ * \return Tables
+*/
+static constexpr PolyTables make_poly_tables(void) {
+    PolyTables tables = {};
+
+    tables.powers[0] = 1;
+
+    for(int i = 1; i < 9; i++)
+        tables.powers[i] = tables.powers[i - 1] * POLY_FACTOR;
+
+    // Newton's iteration doubles number of correct bits, odd number is its own inverse modulo 8
+    HashType inverse = POLY_FACTOR;
+
+    for(int i = 0; i < 5; i++)
+        inverse *= 2 - POLY_FACTOR * inverse;
+
+    tables.inverse = inverse;
+    tables.inverse_8 = 1;
+
+    for(int i = 0; i < 8; i++)
+        tables.inverse_8 *= inverse;
+
+    return tables;
+}
+
+
+/**
+ * \brief Computes CRC32C tables
+ * \return Tables
+*/
+static constexpr CrcTables make_crc_tables(void) {
+    CrcTables tables = {};
+
+    for(unsigned i = 0; i < 256; i++) {
+        unsigned crc = i;
+
+        for(int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC_POLYNOMIAL : crc >> 1;
+
+        tables.forward[i] = crc;
+        tables.inverse[crc >> 24] = (unsigned char) i;
+    }
+
+    return tables;
+}
+
+
+/// Powers of #POLY_FACTOR
+static constexpr PolyTables POLY = make_poly_tables();
+
+/// CRC32C tables
+static constexpr CrcTables CRC = make_crc_tables();
+
+
+static HashType gnu_append(HashType hash, const void *ptr, size_t size);
+static HashType gnu_remove(HashType hash, const void *ptr, size_t size);
+
+static HashType poly_append(HashType hash, const void *ptr, size_t size);
+static HashType poly_remove(HashType hash, const void *ptr, size_t size);
+
+static HashType crc_append(HashType hash, const void *ptr, size_t size);
+static HashType crc_remove(HashType hash, const void *ptr, size_t size);
+
+#if defined(__x86_64__) && defined(__GNUC__)
+static HashType crc_append_sse42(HashType hash, const void *ptr, size_t size);
+#endif
+
+
+/// Polynomial of eight bytes (first byte has the highest power)
+static inline HashType poly_block(const unsigned char *bytes);
+
+
+/// Engines that don't depend on CPU
+static const HashEngine GNU_ENGINE = {HASH_ENGINE_GNU, "gnu", GNU_SEED, &gnu_append, &gnu_remove};
+static const HashEngine POLY_ENGINE = {HASH_ENGINE_POLY, "poly", POLY_SEED, &poly_append, &poly_remove};
+static const HashEngine CRC_ENGINE = {HASH_ENGINE_CRC32C, "crc32c", CRC_SEED, &crc_append, &crc_remove};
+
+#if defined(__x86_64__) && defined(__GNUC__)
+/// CRC32C with SSE4.2 instruction, gives the same hashes as #CRC_ENGINE
+static const HashEngine CRC_SSE42_ENGINE = {HASH_ENGINE_CRC32C, "crc32c", CRC_SEED, &crc_append_sse42, &crc_remove};
+#endif
+
+
+/// Engine used for stacks (selected on the first use)
+static std::atomic<const HashEngine *> hash_engine(nullptr);
+
+
+
+
+int set_hash_engine(unsigned id) {
+    const HashEngine *engine = find_hash_engine(id);
+    if (!engine) return 1;
+
+    hash_engine.store(engine, std::memory_order_relaxed);
+
+    return 0;
+}
+
+
+const HashEngine *get_hash_engine(void) {
+    const HashEngine *engine = hash_engine.load(std::memory_order_relaxed);
+
+    if (!engine) {
+        engine = find_hash_engine(HASH_ENGINE_AUTO);
+        hash_engine.store(engine, std::memory_order_relaxed);
+    }
+
+    return engine;
+}
+
+
+const HashEngine *find_hash_engine(unsigned id) {
+    switch (id) {
+        case HASH_ENGINE_AUTO:
+            #if defined(__x86_64__) && defined(__GNUC__)
+                if (__builtin_cpu_supports("sse4.2")) return &CRC_SSE42_ENGINE;
+            #endif
+            return &POLY_ENGINE;
+
+        case HASH_ENGINE_GNU:
+            return &GNU_ENGINE;
+
+        case HASH_ENGINE_POLY:
+            return &POLY_ENGINE;
+
+        case HASH_ENGINE_CRC32C:
+            #if defined(__x86_64__) && defined(__GNUC__)
+                if (__builtin_cpu_supports("sse4.2")) return &CRC_SSE42_ENGINE;
+            #endif
+            return &CRC_ENGINE;
+
+        default:
+            return NULL;
+    }
+}
+
+
+HashType hash_bytes(const void *ptr, size_t size) {
+    const HashEngine *engine = get_hash_engine();
+
+    return engine -> append(engine -> seed, ptr, size);
+}
+
+
+HashType hash_append(HashType hash, const void *ptr, size_t size) {
+    return get_hash_engine() -> append(hash, ptr, size);
+}
+
+
+HashType hash_remove(HashType hash, const void *ptr, size_t size) {
+    return get_hash_engine() -> remove(hash, ptr, size);
+}
+
+
+static HashType gnu_append(HashType hash, const void *ptr, size_t size) {
+    for(size_t i = 0; i < size; i++)
+        hash = hash * GNU_FACTOR + ((const char *)(ptr))[i];
+
+    return hash;
+}
+
+
+static HashType gnu_remove(HashType hash, const void *ptr, size_t size) {
+    for(size_t i = size; i > 0; i--)
+        hash = (hash - ((const char *)(ptr))[i - 1]) * GNU_FACTOR_INVERSE;
+
+    return hash;
+}
+
+
+static inline HashType poly_block(const unsigned char *bytes) {
+    // Products don't depend on each other, so they run in parallel unlike byte-wise chain
+    return bytes[0] * POLY.powers[7] + bytes[1] * POLY.powers[6] + bytes[2] * POLY.powers[5] + bytes[3] * POLY.powers[4]
+         + bytes[4] * POLY.powers[3] + bytes[5] * POLY.powers[2] + bytes[6] * POLY.powers[1] + bytes[7];
+}
+
+
+static HashType poly_append(HashType hash, const void *ptr, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) ptr;
+
+    for(; size >= 8; size -= 8, bytes += 8)
+        hash = hash * POLY.powers[8] + poly_block(bytes);
+
+    for(; size > 0; size--, bytes++)
+        hash = hash * POLY_FACTOR + *bytes;
+
+    return hash;
+}
+
+
+static HashType poly_remove(HashType hash, const void *ptr, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) ptr + size;
+
+    for(; size % 8; size--, bytes--)
+        hash = (hash - bytes[-1]) * POLY.inverse;
+
+    for(; size > 0; size -= 8, bytes -= 8)
+        hash = (hash - poly_block(bytes - 8)) * POLY.inverse_8;
+
+    return hash;
+}
+
+
+static HashType crc_append(HashType hash, const void *ptr, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) ptr;
+    unsigned crc = (unsigned) hash;
+
+    for(size_t i = 0; i < size; i++)
+        crc = (crc >> 8) ^ CRC.forward[(crc ^ bytes[i]) & 0xFF];
+
+    return crc;
+}
+
+
+static HashType crc_remove(HashType hash, const void *ptr, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) ptr;
+    unsigned crc = (unsigned) hash;
+
+    for(size_t i = size; i > 0; i--) {
+        unsigned index = CRC.inverse[crc >> 24];
+        crc = ((crc ^ CRC.forward[index]) << 8) | (index ^ bytes[i - 1]);
+    }
+
+    return crc;
+}
+
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2")))
+static HashType crc_append_sse42(HashType hash, const void *ptr, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) ptr;
+    unsigned long long crc = (unsigned) hash;
+
+    for(; size >= 8; size -= 8, bytes += 8) {
+        unsigned long long word = 0;
+        memcpy(&word, bytes, sizeof(word));
+
+        crc = __builtin_ia32_crc32di(crc, word);
+    }
+
+    for(; size > 0; size--, bytes++)
+        crc = __builtin_ia32_crc32qi((unsigned) crc, *bytes);
+
+    return crc;
+}
+#endif
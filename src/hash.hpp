@@ -0,0 +1,89 @@
+/**
+ * \file
+ * \brief Hash module header
+ *
+ * Contains hash engines used for stack protection. Every engine hashes byte sequence so that bytes
+ * can be appended to and removed from its end, which keeps buffer hash incremental.
+*/
+
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <stddef.h>
+
+
+typedef unsigned long long HashType; ///< Type for holding hash sum
+
+
+/// Stable engine identifiers, they are written to binary dumps and must never change
+enum HASH_ENGINES {
+    HASH_ENGINE_AUTO   = 0, ///< Fastest engine supported by CPU (CRC32C with SSE4.2, polynomial otherwise)
+    HASH_ENGINE_GNU    = 1, ///< Original byte-wise hash * 33 + signed char, seed 5381
+    HASH_ENGINE_POLY   = 2, ///< Polynomial of unsigned bytes modulo 2^64, eight bytes per step
+    HASH_ENGINE_CRC32C = 3, ///< CRC32C (Castagnoli) state, eight bytes per instruction with SSE4.2
+};
+
+
+/// Hash engine
+typedef struct {
+    unsigned id;                                                   ///< Engine identifier (see #HASH_ENGINES)
+    const char *name;                                              ///< Engine name
+    HashType seed;                                                 ///< Hash of empty sequence
+    HashType (*append)(HashType hash, const void *ptr, size_t size); ///< Appends bytes to the end of hashed sequence
+    HashType (*remove)(HashType hash, const void *ptr, size_t size); ///< Removes bytes from the end of hashed sequence
+} HashEngine;
+
+
+/**
+ * \brief Selects hash engine for all stacks
+ * \param id Engine identifier (see #HASH_ENGINES)
+ * \return 0 - OK, 1 - FAIL (unknown identifier)
+ * \note Call it before any stack is constructed, hashes of existing stacks become wrong
+*/
+int set_hash_engine(unsigned id);
+
+
+/**
+ * \brief Returns current hash engine
+ * \return Hash engine
+*/
+const HashEngine *get_hash_engine(void);
+
+
+/**
+ * \brief Finds hash engine by its identifier
+ * \param id Engine identifier (see #HASH_ENGINES)
+ * \return Hash engine or NULL, #HASH_ENGINE_AUTO gives the engine it would select
+*/
+const HashEngine *find_hash_engine(unsigned id);
+
+
+/**
+ * \brief Calculates hash sum for object with selected engine (see get_hash_engine())
+ * \param ptr Pointer to object
+ * \param size Object's size
+ * \return Hash sum
+*/
+HashType hash_bytes(const void *ptr, size_t size);
+
+
+/**
+ * \brief Appends bytes to the end of hashed sequence
+ * \param hash Hash sum of the sequence
+ * \param ptr Pointer to bytes
+ * \param size Number of bytes
+ * \return Hash sum of the sequence with appended bytes
+*/
+HashType hash_append(HashType hash, const void *ptr, size_t size);
+
+
+/**
+ * \brief Removes bytes from the end of hashed sequence
+ * \param hash Hash sum of the sequence
+ * \param ptr Pointer to the last bytes of the sequence
+ * \param size Number of bytes
+ * \return Hash sum of the sequence without these bytes
+*/
+HashType hash_remove(HashType hash, const void *ptr, size_t size);
+
+#endif
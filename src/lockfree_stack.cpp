@@ -0,0 +1,326 @@
+/**
+ * \file
+ * \brief Lock-free stack module source
+ * 
+ * Nodes live in blocks that are never freed until destructor, so reading a node
+ * that was concurrently popped is always safe and tagged indices prevent ABA.
+*/
+
+#include "lockfree_stack.hpp"
+
+
+/// Index of no node
+const unsigned NULL_INDEX = 0xFFFFFFFFu;
+
+/// Elimination slot is empty (slots keep their tag when emptied)
+const unsigned EMPTY_SLOT = 0xFFFFFFFFu;
+
+/// Number of spins pusher waits in elimination slot for popper
+const int ELIMINATION_SPINS = 64;
+
+
+/// Returns index part of tagged index
+static inline unsigned tagged_index(TaggedIndex tagged) { return (unsigned)(tagged & 0xFFFFFFFFull); }
+
+/// Returns new tagged index with incremented tag
+static inline TaggedIndex next_tagged(TaggedIndex tagged, unsigned index) { return (((tagged >> 32) + 1) << 32) | index; }
+
+
+/**
+ * \brief Finds node by its index
+ * \param stack Stack owning the node
+ * \param index Node index
+ * \return Node pointer
+*/
+static LockFreeNode *get_node(LockFreeStack *stack, unsigned index);
+
+
+/**
+ * \brief Takes node from free list or allocates new one
+ * \param stack Stack owning the node
+ * \param index Index of the node will be written here
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+static ErrorBits acquire_node(LockFreeStack *stack, unsigned *index);
+
+
+/**
+ * \brief Pushes node to the list
+ * \param stack Stack owning the node
+ * \param list Top of the list
+ * \param index Node index
+ * \return True if node was pushed, false if CAS failed because of contention
+*/
+static bool try_push_node(LockFreeStack *stack, std::atomic<TaggedIndex> *list, unsigned index);
+
+
+/**
+ * \brief Pops node from the list
+ * \param stack Stack owning the node
+ * \param list Top of the list
+ * \param index Index of popped node or #NULL_INDEX if list is empty will be written here
+ * \return True if operation completed, false if CAS failed because of contention
+*/
+static bool try_pop_node(LockFreeStack *stack, std::atomic<TaggedIndex> *list, unsigned *index);
+
+
+/**
+ * \brief Offers node to concurrent pop through elimination array
+ * \param stack Stack
+ * \param index Node index
+ * \param seed Random value to choose slot
+ * \return True if node was taken by popper
+*/
+static bool eliminate_push(LockFreeStack *stack, unsigned index, unsigned seed);
+
+
+/**
+ * \brief Takes node offered by concurrent push
+ * \param stack Stack
+ * \param seed Random value to choose slot
+ * \return Node index or #NULL_INDEX
+*/
+static unsigned eliminate_pop(LockFreeStack *stack, unsigned seed);
+
+
+/// Returns random number for current thread (xorshift)
+static unsigned thread_random(void);
+
+
+
+
+ErrorBits lockfree_stack_constructor(LockFreeStack *stack) {
+    CHECK(right_pointer(stack, sizeof(LockFreeStack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    std::atomic<LockFreeNode *> *blocks = (std::atomic<LockFreeNode *> *) calloc(LOCKFREE_MAX_BLOCKS, sizeof(std::atomic<LockFreeNode *>));
+    CHECK(blocks, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+    for(int i = 0; i < LOCKFREE_MAX_BLOCKS; i++)
+        new (blocks + i) std::atomic<LockFreeNode *>(nullptr);
+
+    stack -> blocks = blocks;
+
+    stack -> top.store(NULL_INDEX, std::memory_order_relaxed);
+    stack -> free_list.store(NULL_INDEX, std::memory_order_relaxed);
+    stack -> allocated.store(0, std::memory_order_relaxed);
+
+    for(int i = 0; i < LOCKFREE_ELIMINATION_SIZE; i++)
+        stack -> elimination[i].store(EMPTY_SLOT, std::memory_order_relaxed);
+
+    stack -> canary_begin = (CanaryType)(stack);
+    stack -> canary_end = (CanaryType)(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits lockfree_stack_push(LockFreeStack *stack, Object object) {
+    #ifdef _DEBUG
+        ErrorBits error = lockfree_stack_check(stack);
+        if (error) return error;
+    #endif
+
+    unsigned index = NULL_INDEX;
+
+    ErrorBits acquire_error = acquire_node(stack, &index);
+    if (acquire_error) return acquire_error;
+
+    get_node(stack, index) -> object = object;
+
+    while (!try_push_node(stack, &stack -> top, index)) {
+        // Contention on top, try to hand node directly to some popper
+        if (eliminate_push(stack, index, thread_random()))
+            break;
+    }
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits lockfree_stack_pop(LockFreeStack *stack, Object *object) {
+    CHECK(object, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    #ifdef _DEBUG
+        ErrorBits error = lockfree_stack_check(stack);
+        if (error) return error;
+    #endif
+
+    unsigned index = NULL_INDEX;
+
+    while (!try_pop_node(stack, &stack -> top, &index)) {
+        // Contention on top, try to take node from some pusher
+        index = eliminate_pop(stack, thread_random());
+        if (index != NULL_INDEX) break;
+    }
+
+    CHECK(index != NULL_INDEX, return ERROR_BIT_FLAGS::EMPTY_STACK);
+
+    LockFreeNode *node = get_node(stack, index);
+
+    #ifdef _DEBUG
+        if (node -> canary != ((CanaryType)(stack) ^ index)) {
+            // Node goes back to free list anyway, so stack doesn't lose it
+            while (!try_push_node(stack, &stack -> free_list, index))
+                ;
+
+            return ERROR_BIT_FLAGS::BUFFER_CANARY;
+        }
+    #endif
+
+    *object = node -> object;
+
+    while (!try_push_node(stack, &stack -> free_list, index))
+        ;
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits lockfree_stack_destructor(LockFreeStack *stack) {
+    ErrorBits error = lockfree_stack_check(stack);
+    if (error) return error;
+
+    for(int i = 0; i < LOCKFREE_MAX_BLOCKS; i++)
+        free(stack -> blocks[i].load(std::memory_order_relaxed));
+
+    free(stack -> blocks);
+    stack -> blocks = nullptr;
+
+    stack -> top.store(NULL_INDEX, std::memory_order_relaxed);
+    stack -> free_list.store(NULL_INDEX, std::memory_order_relaxed);
+    stack -> allocated.store(0, std::memory_order_relaxed);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits lockfree_stack_check(LockFreeStack *stack) {
+    CHECK(right_pointer(stack, sizeof(LockFreeStack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    #ifdef _DEBUG
+        CHECK(stack -> canary_begin == (CanaryType)(stack) && stack -> canary_end == (CanaryType)(stack), return ERROR_BIT_FLAGS::STRUCT_CANARY);
+    #endif
+
+    CHECK(stack -> blocks, return ERROR_BIT_FLAGS::INVALID_DATA);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+static LockFreeNode *get_node(LockFreeStack *stack, unsigned index) {
+    return stack -> blocks[index / LOCKFREE_BLOCK_SIZE].load(std::memory_order_acquire) + index % LOCKFREE_BLOCK_SIZE;
+}
+
+
+static ErrorBits acquire_node(LockFreeStack *stack, unsigned *index) {
+    while (!try_pop_node(stack, &stack -> free_list, index))
+        ;
+
+    if (*index != NULL_INDEX) return ERROR_BIT_FLAGS::STACK_OK;
+
+    unsigned allocated = stack -> allocated.load(std::memory_order_relaxed);
+
+    // Block is allocated before its index is taken, so failed allocation doesn't lose the index
+    do {
+        CHECK(allocated < (unsigned) LOCKFREE_MAX_BLOCKS * LOCKFREE_BLOCK_SIZE, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+        std::atomic<LockFreeNode *> *block = stack -> blocks + allocated / LOCKFREE_BLOCK_SIZE;
+
+        if (!block -> load(std::memory_order_acquire)) {
+            LockFreeNode *nodes = (LockFreeNode *) calloc(LOCKFREE_BLOCK_SIZE, sizeof(LockFreeNode));
+            CHECK(nodes, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+            for(unsigned i = 0; i < LOCKFREE_BLOCK_SIZE; i++) {
+                new (nodes + i) LockFreeNode();
+
+                #ifdef _DEBUG
+                    nodes[i].canary = (CanaryType)(stack) ^ (allocated / LOCKFREE_BLOCK_SIZE * LOCKFREE_BLOCK_SIZE + i);
+                #endif
+            }
+
+            // Several threads can allocate the same block, only one of them wins
+            LockFreeNode *expected = nullptr;
+            if (!block -> compare_exchange_strong(expected, nodes, std::memory_order_acq_rel))
+                free(nodes);
+        }
+    } while (!stack -> allocated.compare_exchange_weak(allocated, allocated + 1, std::memory_order_relaxed));
+
+    *index = allocated;
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+static bool try_push_node(LockFreeStack *stack, std::atomic<TaggedIndex> *list, unsigned index) {
+    LockFreeNode *node = get_node(stack, index);
+
+    TaggedIndex top = list -> load(std::memory_order_relaxed);
+
+    node -> next.store(tagged_index(top), std::memory_order_relaxed);
+
+    return list -> compare_exchange_weak(top, next_tagged(top, index), std::memory_order_release, std::memory_order_relaxed);
+}
+
+
+static bool try_pop_node(LockFreeStack *stack, std::atomic<TaggedIndex> *list, unsigned *index) {
+    TaggedIndex top = list -> load(std::memory_order_acquire);
+
+    if (tagged_index(top) == NULL_INDEX) {
+        *index = NULL_INDEX;
+        return true;
+    }
+
+    // Node could be popped by another thread already, then its next is garbage but tag check fails
+    unsigned next = get_node(stack, tagged_index(top)) -> next.load(std::memory_order_relaxed);
+
+    if (!list -> compare_exchange_weak(top, next_tagged(top, next), std::memory_order_acquire, std::memory_order_relaxed))
+        return false;
+
+    *index = tagged_index(top);
+
+    return true;
+}
+
+
+static bool eliminate_push(LockFreeStack *stack, unsigned index, unsigned seed) {
+    std::atomic<TaggedIndex> *slot = stack -> elimination + seed % LOCKFREE_ELIMINATION_SIZE;
+
+    TaggedIndex empty = slot -> load(std::memory_order_relaxed);
+    if (tagged_index(empty) != EMPTY_SLOT) return false;
+
+    TaggedIndex offer = next_tagged(empty, index);
+    if (!slot -> compare_exchange_strong(empty, offer, std::memory_order_release, std::memory_order_relaxed))
+        return false;
+
+    for(int i = 0; i < ELIMINATION_SPINS; i++)
+        if (slot -> load(std::memory_order_relaxed) != offer) return true;
+
+    // Nobody came, take the node back unless popper got it in the last moment
+    return !slot -> compare_exchange_strong(offer, next_tagged(offer, EMPTY_SLOT), std::memory_order_relaxed, std::memory_order_relaxed);
+}
+
+
+static unsigned eliminate_pop(LockFreeStack *stack, unsigned seed) {
+    std::atomic<TaggedIndex> *slot = stack -> elimination + seed % LOCKFREE_ELIMINATION_SIZE;
+
+    TaggedIndex offer = slot -> load(std::memory_order_acquire);
+    if (tagged_index(offer) == EMPTY_SLOT) return NULL_INDEX;
+
+    if (!slot -> compare_exchange_strong(offer, next_tagged(offer, EMPTY_SLOT), std::memory_order_acquire, std::memory_order_relaxed))
+        return NULL_INDEX;
+
+    return tagged_index(offer);
+}
+
+
+static unsigned thread_random(void) {
+    static thread_local unsigned state = 0;
+
+    if (!state) state = (unsigned)(size_t)(&state) | 1u;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return state;
+}
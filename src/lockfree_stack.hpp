@@ -0,0 +1,97 @@
+/**
+ * \file
+ * \brief Lock-free stack module header
+ *
+ * Contains multi-producer multi-consumer Treiber stack of #Object with elimination array
+*/
+
+#ifndef LOCKFREE_STACK_HPP
+#define LOCKFREE_STACK_HPP
+
+#include <atomic>
+#include "stack.hpp"
+
+
+#define LOCKFREE_BLOCK_SIZE 4096 ///< Number of nodes allocated at once
+#define LOCKFREE_MAX_BLOCKS 4096 ///< Maximum number of node blocks (so stack holds up to 16M objects at once)
+#define LOCKFREE_ELIMINATION_SIZE 16 ///< Number of slots where concurrent push and pop can meet
+
+
+/// Tagged node index, low 32 bits are index and high 32 bits are ABA counter
+typedef unsigned long long TaggedIndex;
+
+
+/// Node of lock-free stack
+typedef struct {
+    #ifdef _DEBUG
+        CanaryType canary = 0; ///< Stack address xor node index
+    #endif
+
+    Object object = 0;
+    std::atomic<unsigned> next {0}; ///< Index of the next node
+} LockFreeNode;
+
+
+/// Structure for holding lock-free stack
+typedef struct {
+    CanaryType canary_begin = 0;
+
+    std::atomic<TaggedIndex> top;       ///< Top node of the stack
+    std::atomic<TaggedIndex> free_list; ///< Top node of the released nodes list
+    std::atomic<unsigned> allocated;    ///< Number of nodes ever taken from blocks
+
+    std::atomic<TaggedIndex> elimination[LOCKFREE_ELIMINATION_SIZE]; ///< Nodes offered by pushers to poppers
+
+    std::atomic<LockFreeNode *> *blocks = nullptr; ///< Table of #LOCKFREE_MAX_BLOCKS node blocks allocated on demand
+
+    CanaryType canary_end = 0;
+} LockFreeStack;
+
+
+/**
+ * \brief Constructs lock-free stack
+ * \param stack This stack will be filled
+ * \note Not thread safe, call it before sharing the stack
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits lockfree_stack_constructor(LockFreeStack *stack);
+
+
+/**
+ * \brief Adds object to stack
+ * \param stack This stack will be pushed
+ * \param object This object will be added to the top of stack
+ * \note Can be called from any number of threads
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits lockfree_stack_push(LockFreeStack *stack, Object object);
+
+
+/**
+ * \brief Pops top object from stack
+ * \param stack This stack will be popped
+ * \param object Value of popped object will be written to this pointer
+ * \note Can be called from any number of threads
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits lockfree_stack_pop(LockFreeStack *stack, Object *object);
+
+
+/**
+ * \brief Destructs lock-free stack
+ * \param stack This stack will be destructed
+ * \note Not thread safe, no other thread can use the stack at this point
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits lockfree_stack_destructor(LockFreeStack *stack);
+
+
+/**
+ * \brief Lock-free stack verificator
+ * \param stack Stack to check
+ * \note Canaries are checked in debug build only
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits lockfree_stack_check(LockFreeStack *stack);
+
+#endif
@@ -1,19 +1,160 @@
 /**
  * \file
- * \brief Log module header
- * 
- * Contains log_file pointer and its setter functions
+ * \brief Log module source
+ *
+ * Thread streams are made with fopencookie(), their write function puts text in bounded
+ * multi-producer ring buffer (Vyukov's queue), so logging thread never touches the file.
+ * Writer thread drains ring buffer to the file and sleeps while it is empty.
+ * Where there is no fopencookie() streams fall back to the file itself.
 */
 
-
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include "logs.hpp"
 
 
+/// Record of the ring buffer
+typedef struct {
+    std::atomic<size_t> sequence; ///< Equals position when slot is free and position + 1 when it holds text
+    size_t length;                ///< Number of text bytes
+    char text[LOG_SLOT_SIZE];     ///< Text
+} LogSlot;
+
+
+/// Stream of one thread
+struct LogStream {
+    FILE *stream = nullptr;          ///< Buffered stream writing to ring buffer
+    unsigned long long generation = 0; ///< Log generation stream was opened for
+
+    ~LogStream() { if (stream) fclose(stream); stream = nullptr; } ///< Flushes stream when thread exits
+};
+
+
 /// Log file
-FILE *log_file = nullptr;
+static FILE *log_file = nullptr;
+
+/// Binary dump file
+static FILE *dump_file = nullptr;
+
+/// Log configuration
+static LogConfig log_config = {};
+
+/// Ring buffer
+static LogSlot *ring = nullptr;
+
+/// Number of ring slots minus one
+static size_t ring_mask = 0;
+
+/// Position of the next record to reserve
+static std::atomic<size_t> enqueue_pos(0);
+
+/// Position of the first record writer hasn't put in file yet
+static std::atomic<size_t> flushed_pos(0);
+
+/// Bytes dropped since log was opened
+static std::atomic<size_t> dropped_bytes(0);
+
+/// Incremented on every open and close so streams of closed log drop text
+static std::atomic<unsigned long long> log_generation(0);
+
+/// Is true while writer thread must keep waiting for records
+static std::atomic<bool> writer_running(false);
+
+/// Is true while writer thread sleeps on #writer_wake
+static std::atomic<bool> writer_parked(false);
+
+/// Drop policy of the open log (see log_drop_when_full())
+static std::atomic<bool> drop_when_full(true);
+
+/// Protects #writer_parked transitions so wake-up isn't lost
+static std::mutex writer_mutex;
+
+/// Writer thread sleeps on it while ring buffer is empty
+static std::condition_variable writer_wake;
+
+/// Writer thread
+static std::thread writer;
+
+
+/// Closes log that is still open at exit, so joinable writer isn't destroyed and file gets all the text
+struct LogGuard {
+    ~LogGuard(); ///< Stops writer thread and closes log file
+};
+
+/// Destroyed before writer thread object and after streams of the main thread
+static LogGuard log_guard;
+
+/// Stream of the current thread
+static thread_local LogStream thread_stream;
+
+/// Stream that replaces log in the current thread (see log_redirect())
+static thread_local FILE *thread_redirect = nullptr;
+
+
+/**
+ * \brief Puts text in ring buffer
+ * \param text Text to put
+ * \param size Text size
+ * \note Text is split into records of #LOG_SLOT_SIZE bytes, rest of the text is dropped if ring is full
+*/
+static void ring_push(const char *text, size_t size);
+
+
+/**
+ * \brief Writes every ready record to the file
+ * \return Number of written records
+*/
+static size_t ring_drain(void);
+
+
+/// Writer thread function
+static void writer_loop(void);
+
+
+/**
+ * \brief Puts writer thread to sleep until records arrive or log is closed
+*/
+static void writer_park(void);
+
+
+/**
+ * \brief Wakes writer thread if it sleeps
+*/
+static void writer_unpark(void);
+
+
+/**
+ * \brief Stops writer thread after it drains ring buffer, closes log file and frees ring buffer
+*/
+static void log_shutdown(void);
+
+
+#ifdef __GLIBC__
+/// Write function of thread streams
+static ssize_t stream_write(void *cookie, const char *buffer, size_t size);
+#endif
+
+
 
 
 int open_log(const char filename[]) {
+    return open_log(filename, NULL);
+}
+
+
+int open_log(const char filename[], const LogConfig *config) {
+    if (log_file) close_log();
+
+    log_config = (config) ? *config : LogConfig();
+
+    size_t slots = 1;
+    while (slots < log_config.ring_slots) slots *= 2;
+
     log_file = fopen(filename, "w");
 
     if (!log_file) {
@@ -21,27 +162,297 @@ int open_log(const char filename[]) {
         return 1;
     }
 
-    setvbuf(log_file, NULL, _IOFBF, 512);
+    ring = (LogSlot *) calloc(slots, sizeof(LogSlot));
+
+    if (!ring) {
+        printf("Couldn't allocate log buffer!\n");
+        fclose(log_file);
+        log_file = nullptr;
+        return 1;
+    }
+
+    for(size_t i = 0; i < slots; i++)
+        new (&ring[i].sequence) std::atomic<size_t>(i);
+
+    ring_mask = slots - 1;
+
+    enqueue_pos.store(0, std::memory_order_relaxed);
+    flushed_pos.store(0, std::memory_order_relaxed);
+    dropped_bytes.store(0, std::memory_order_relaxed);
+    drop_when_full.store(log_config.drop_when_full, std::memory_order_relaxed);
+
+    log_generation.fetch_add(1, std::memory_order_release);
+
+    writer_running.store(true, std::memory_order_release);
+    writer = std::thread(writer_loop);
 
     return 0;
 }
 
 
 FILE *get_log_file(void) {
-    if (!log_file) printf("No log file!\n");
-    return log_file;
+    if (thread_redirect) return thread_redirect;
+
+    if (!log_file) {
+        printf("No log file!\n");
+        return nullptr;
+    }
+
+    #ifdef __GLIBC__
+        unsigned long long generation = log_generation.load(std::memory_order_acquire);
+
+        if (thread_stream.stream && thread_stream.generation == generation)
+            return thread_stream.stream;
+
+        if (thread_stream.stream) fclose(thread_stream.stream);
+
+        cookie_io_functions_t functions = {nullptr, &stream_write, nullptr, nullptr};
+
+        thread_stream.stream = fopencookie((void *)(size_t) generation, "w", functions);
+        thread_stream.generation = generation;
+
+        if (!thread_stream.stream) return log_file;
+
+        // Line buffering passes whole lines to ring buffer (longer lines are split by buffer size)
+        setvbuf(thread_stream.stream, NULL, _IOLBF, log_config.stream_buffer);
+
+        return thread_stream.stream;
+    #else
+        return log_file;
+    #endif
+}
+
+
+FILE *log_redirect(FILE *stream) {
+    FILE *previous = thread_redirect;
+    thread_redirect = stream;
+
+    return previous;
+}
+
+
+void log_flush(void) {
+    if (thread_redirect) fflush(thread_redirect);
+
+    if (!log_file) return;
+
+    if (thread_stream.stream && thread_stream.generation == log_generation.load(std::memory_order_acquire))
+        fflush(thread_stream.stream);
+
+    size_t target = enqueue_pos.load(std::memory_order_acquire);
+
+    while (flushed_pos.load(std::memory_order_acquire) < target)
+        std::this_thread::yield();
+}
+
+
+size_t log_dropped(void) {
+    return dropped_bytes.load(std::memory_order_relaxed);
+}
+
+
+bool log_drop_when_full(bool drop) {
+    return drop_when_full.exchange(drop, std::memory_order_relaxed);
 }
 
 
 int close_log(void) {
-    if (log_file) {
-        fclose(log_file);
-        return 0;
-    }
-    else {
+    if (!log_file) {
         printf("No log file to close!\n");
         return 1;
     }
-    
+
+    if (thread_stream.stream) {
+        fclose(thread_stream.stream);
+        thread_stream.stream = nullptr;
+    }
+
+    log_shutdown();
+
+    return 0;
+}
+
+
+int open_dump(const char filename[]) {
+    if (dump_file) close_dump();
+
+    dump_file = fopen(filename, "wb");
+
+    if (!dump_file) {
+        printf("Couldn't open dump file %s!\n", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+FILE *get_dump_file(void) {
+    return dump_file;
+}
+
+
+int close_dump(void) {
+    if (!dump_file) {
+        printf("No dump file to close!\n");
+        return 1;
+    }
+
+    fclose(dump_file);
+    dump_file = nullptr;
+
+    return 0;
+}
+
+
+static void ring_push(const char *text, size_t size) {
+    while (size > 0) {
+        // Records of one write are reserved together, so text of different threads doesn't interleave
+        size_t count = (size + LOG_SLOT_SIZE - 1) / LOG_SLOT_SIZE;
+        if (count > ring_mask + 1) count = ring_mask + 1;
+
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+        while (true) {
+            // Writer frees records in order, so the last one being free means all of them are
+            size_t sequence = ring[(pos + count - 1) & ring_mask].sequence.load(std::memory_order_acquire);
+
+            if (sequence == pos + count - 1) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+                    break;
+            }
+            else if (sequence < pos + count - 1) {
+                // Ring is full
+                if (drop_when_full.load(std::memory_order_relaxed)) {
+                    dropped_bytes.fetch_add(size, std::memory_order_relaxed);
+                    return;
+                }
+
+                std::this_thread::yield();
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+            else
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+
+        for(size_t i = 0; i < count && size > 0; i++) {
+            LogSlot *slot = ring + ((pos + i) & ring_mask);
+            size_t length = (size < LOG_SLOT_SIZE) ? size : LOG_SLOT_SIZE;
+
+            memcpy(slot -> text, text, length);
+            slot -> length = length;
+            slot -> sequence.store(pos + i + 1, std::memory_order_release);
+
+            text += length;
+            size -= length;
+        }
+
+        // Writer parks only on empty ring, so this wakes it when ring becomes non-empty
+        writer_unpark();
+    }
+}
+
+
+static size_t ring_drain(void) {
+    size_t pos = flushed_pos.load(std::memory_order_relaxed), count = 0;
+
+    while (true) {
+        LogSlot *slot = ring + (pos & ring_mask);
+
+        if (slot -> sequence.load(std::memory_order_acquire) != pos + 1) break;
+
+        fwrite(slot -> text, 1, slot -> length, log_file);
+
+        slot -> sequence.store(pos + ring_mask + 1, std::memory_order_release);
+
+        pos++;
+        count++;
+    }
+
+    if (count) {
+        fflush(log_file);
+        flushed_pos.store(pos, std::memory_order_release);
+    }
+
+    return count;
+}
+
+
+static void writer_loop(void) {
+    while (true) {
+        bool running = writer_running.load(std::memory_order_acquire);
+
+        if (ring_drain()) continue;
+
+        if (!running) break;
+
+        writer_park();
+    }
+}
+
+
+static void writer_park(void) {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+
+    writer_parked.store(true, std::memory_order_relaxed);
+
+    // Pairs with the fence in writer_unpark(): either producer sees the flag or writer sees the record
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    size_t pos = flushed_pos.load(std::memory_order_relaxed);
+
+    if (ring[pos & ring_mask].sequence.load(std::memory_order_acquire) == pos + 1 || !writer_running.load(std::memory_order_acquire)) {
+        writer_parked.store(false, std::memory_order_relaxed);
+        return;
+    }
+
+    writer_wake.wait(lock, []() { return !writer_parked.load(std::memory_order_relaxed); });
+}
+
+
+static void writer_unpark(void) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Mutex is taken only when writer sleeps, so pushing to busy writer stays lock-free
+    if (!writer_parked.load(std::memory_order_relaxed)) return;
+
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        writer_parked.store(false, std::memory_order_relaxed);
+    }
+
+    writer_wake.notify_one();
+}
+
+
+static void log_shutdown(void) {
+    // Writer drains everything before it stops
+    writer_running.store(false, std::memory_order_release);
+    writer_unpark();
+    writer.join();
+
+    log_generation.fetch_add(1, std::memory_order_release);
+
+    fclose(log_file);
     log_file = nullptr;
+
+    free(ring);
+    ring = nullptr;
+}
+
+
+LogGuard::~LogGuard() {
+    // Stream of the main thread is already closed, so the guard doesn't touch it
+    if (log_file) log_shutdown();
+}
+
+
+#ifdef __GLIBC__
+static ssize_t stream_write(void *cookie, const char *buffer, size_t size) {
+    // Stream of closed log just forgets the text
+    if ((unsigned long long)(size_t) cookie == log_generation.load(std::memory_order_acquire))
+        ring_push(buffer, size);
+
+    return (ssize_t) size;
 }
+#endif
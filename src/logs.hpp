@@ -1,13 +1,28 @@
 /**
  * \file
  * \brief Log module header
- * 
- * Contains log_file pointer and its setter functions
+ *
+ * Contains log file setter functions. Log is written by background thread,
+ * every thread gets its own buffered stream that passes text to it through ring buffer.
 */
 
+#ifndef LOGS_HPP
+#define LOGS_HPP
+
 #include <stdio.h>
 
 
+#define LOG_SLOT_SIZE 248 ///< Maximum number of text bytes in one ring buffer record
+
+
+/// Log configuration
+typedef struct {
+    size_t ring_slots = 4096;    ///< Number of records in ring buffer (rounded up to the power of two)
+    size_t stream_buffer = 4096; ///< Size of stdio buffer of each thread's stream
+    bool drop_when_full = true;  ///< Drop records when ring buffer is full instead of waiting for writer thread
+} LogConfig;
+
+
 /**
  * \brief Opens log file by its path
  * \param filename Path to the file
@@ -17,16 +32,79 @@ int open_log(const char filename[]);
 
 
 /**
- * \brief Returns log file
- * \return Log file or null
- * \note Will warn you if log file is null
+ * \brief Opens log file by its path
+ * \param filename Path to the file
+ * \param config Buffer sizes and drop policy (NULL for defaults)
+ * \return 0 - OK, 1 - FAIL
+*/
+int open_log(const char filename[], const LogConfig *config);
+
+
+/**
+ * \brief Returns log stream of the current thread
+ * \return Log stream or null
+ * \note Will warn you if log file is null. Stream is line buffered, text reaches file asynchronously (see log_flush())
 */
 FILE *get_log_file(void);
 
 
+/**
+ * \brief Makes get_log_file() return given stream in the current thread
+ * \param stream Stream to log in or null to return to the log file
+ * \return Previous stream of the current thread
+*/
+FILE *log_redirect(FILE *stream);
+
+
+/**
+ * \brief Flushes stream of the current thread and waits until writer thread puts everything in file
+*/
+void log_flush(void);
+
+
+/**
+ * \brief Returns number of bytes dropped because ring buffer was full
+ * \return Number of bytes
+*/
+size_t log_dropped(void);
+
+
+/**
+ * \brief Changes drop policy of the open log (see LogConfig)
+ * \param drop Drop records when ring buffer is full instead of waiting for writer thread
+ * \return Previous policy
+*/
+bool log_drop_when_full(bool drop);
+
+
 /**
  * \brief Closes log file
  * \return 0 - OK, 1 - FAIL
- * \note In any case log file will be set to null
+ * \note In any case log file will be set to null. Streams of other threads are not flushed, so they must stop logging before.
+ * Log that is still open at exit is closed automatically
 */
 int close_log(void);
+
+
+/**
+ * \brief Opens binary dump file, while it is open stack dumps are written there (see stack_dump_binary())
+ * \param filename Path to the file
+ * \return 0 - OK, 1 - FAIL
+*/
+int open_dump(const char filename[]);
+
+
+/**
+ * \brief Returns binary dump file
+ * \return Dump file or null if it isn't opened
+*/
+FILE *get_dump_file(void);
+
+
+/**
+ * \brief Closes binary dump file
+ * \return 0 - OK, 1 - FAIL
+*/
+int close_dump(void);
+
+#endif
@@ -1,12 +1,51 @@
+#include <chrono>
+#include <string>
+#include <memory>
+#include <thread>
+#include <unistd.h>
 #include "stack.hpp"
+#include "lockfree_stack.hpp"
+#include "work_deque.hpp"
+#include "segmented_stack.hpp"
+#include "blocking_stack.hpp"
+#include "stack_set.hpp"
+#include "dump.hpp"
 #include "logs.hpp"
 #include "test.hpp"
 
 
+/// Object larger than a cache line
+typedef struct {
+    long long fields[8];
+} BigObject;
+
+
 ReturnCode test_normal(void *data); ///< Standart stack check. What could go wrong?
 ReturnCode test_1001_push_and_pop(void *data); ///< Pushes 1001 element in stack, then pops it out
 ReturnCode test_struct_hash(void *data); ///< Changes structure size to see how verificator would work
 ReturnCode test_canary(void *data); ///< Changes structure canary value to see how verificator would work 
+ReturnCode test_buffer_hash(void *data); ///< Changes stack element behind verificator's back to see how audit would work
+ReturnCode test_poison(void *data); ///< Writes to popped slot to see how audit would work
+ReturnCode test_invalid_pointer(void *data); ///< Gives unmapped address as stack to see how pointer validation would work
+ReturnCode test_push_pop_n(void *data); ///< Pushes and pops 1001 element array at once
+ReturnCode test_generic_stack(void *data); ///< Uses stacks of strings and big objects with different policies
+ReturnCode test_lockfree_stack(void *data); ///< Pushes and pops lock-free stack from several threads
+ReturnCode test_work_deque(void *data); ///< Owner pushes and pops deque while thieves steal from it
+ReturnCode test_pool_allocator(void *data); ///< Creates and destroys stacks to see how pool reuses buffers
+ReturnCode test_segmented_stack(void *data); ///< Pushes and pops segmented stack back and forth across chunk border
+ReturnCode test_mapped_stack(void *data); ///< Grows mapped stack far beyond default limit and overflows small one
+ReturnCode test_stack_stats(void *data); ///< Compares hot-path counters with operations made in this and another thread
+ReturnCode test_async_log(void *data); ///< Writes log from several threads and reads it back from file
+ReturnCode test_binary_dump(void *data); ///< Dumps stack in binary format, reads it back, renders and diffs it
+ReturnCode test_guard_pages(void *data); ///< Writes past both ends of guarded buffer and recovers from the faults
+ReturnCode test_hash_engines(void *data); ///< Appends and removes bytes in uneven pieces with every hash engine
+ReturnCode test_small_buffer(void *data); ///< Keeps small stacks inside the structure, spills them to heap and brings them back
+ReturnCode test_background_verifier(void *data); ///< Changes registered stacks while verifier audits them, then breaks one behind its back
+ReturnCode test_runtime_protection(void *data); ///< Breaks stack with protection turned off and on at runtime
+ReturnCode test_snapshot(void *data); ///< Saves and loads stack, breaks snapshot file and reopens file-backed stack after checkpoint
+ReturnCode test_segmented_fork(void *data); ///< Forks segmented stack for many short branches and checks that writes of one copy don't reach the other
+ReturnCode test_blocking_stack(void *data); ///< Producers and consumers meet on small bounded stack, then empty and full stack time out
+ReturnCode test_stack_set(void *data); ///< Creates and destroys thousands of small stacks in one set, then overruns one of them
 
 
 Test tests[] = {
@@ -37,14 +76,148 @@ Test tests[] = {
             ERROR_BIT_FLAGS::STACK_OK,
         #endif
         nullptr
+    },
+    {
+        &test_buffer_hash,
+        #if (PROTECT_LEVEL & HASH_PROTECT)
+            ERROR_BIT_FLAGS::BUFFER_HASH_FAIL,
+        #else
+            ERROR_BIT_FLAGS::STACK_OK,
+        #endif
+        nullptr
+    },
+    {
+        &test_poison,
+        ERROR_BIT_FLAGS::UNEXP_NORMAL_VAL,
+        nullptr
+    },
+    {
+        &test_invalid_pointer,
+        ERROR_BIT_FLAGS::INVALID_POINTER,
+        nullptr
+    },
+    {
+        &test_push_pop_n,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_generic_stack,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_lockfree_stack,
+        ERROR_BIT_FLAGS::EMPTY_STACK,
+        nullptr
+    },
+    {
+        &test_work_deque,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_pool_allocator,
+        #if (PROTECT_LEVEL & GUARD_PROTECT)
+            ERROR_BIT_FLAGS::ALLOCATE_FAIL, // guarded buffers don't use the pool
+        #else
+            ERROR_BIT_FLAGS::STACK_OK,
+        #endif
+        nullptr
+    },
+    {
+        &test_segmented_stack,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_mapped_stack,
+        #if (PROTECT_LEVEL & GUARD_PROTECT)
+            ERROR_BIT_FLAGS::INVALID_DATA, // guarded buffers aren't mapped in place, so they move
+        #else
+            ERROR_BIT_FLAGS::STACK_OVERFLOW,
+        #endif
+        nullptr
+    },
+    {
+        &test_stack_stats,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_async_log,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_binary_dump,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_guard_pages,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_hash_engines,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_small_buffer,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_background_verifier,
+        ERROR_BIT_FLAGS::UNEXP_NORMAL_VAL,
+        nullptr
+    },
+    {
+        &test_runtime_protection,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_snapshot,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_segmented_fork,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_blocking_stack,
+        ERROR_BIT_FLAGS::STACK_OK,
+        nullptr
+    },
+    {
+        &test_stack_set,
+        ERROR_BIT_FLAGS::UNEXP_NORMAL_VAL,
+        nullptr
     }
 };
 
 
+/// Log file of the tests
+const char LOG_FILENAME[] = "log.txt";
+
+/// Prefix of log files of separate tests
+const char TEST_LOG_PREFIX[] = "log_test_";
+
+
 int main() {
-    open_log("log.txt");
+    open_log(LOG_FILENAME);
 
-    run_tests(tests, sizeof(tests) / sizeof(Test), stdin);
+    TestOptions options = {};
+    options.threads = 0;
+    options.log_prefix = TEST_LOG_PREFIX;
+    options.summary = true;
+
+    run_tests(tests, sizeof(tests) / sizeof(Test), stdin, &options);
 
     close_log();
 
@@ -122,3 +295,1276 @@ ReturnCode test_canary(void *data) {
 
     return stack_destructor(&stack);
 }
+
+
+ReturnCode test_buffer_hash(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~~test_buffer_hash~~~~~~~~~\n");
+
+    Stack stack = {};
+
+    stack_constructor(&stack, 10);
+
+    for(int i = 1; i <= 1001; i++)
+        stack_push(&stack, i);
+
+    Object value = stack.data[10];
+    stack.data[10] = -value;
+
+    ErrorBits error = stack_audit(&stack);
+
+    stack.data[10] = value;
+
+    stack_destructor(&stack);
+
+    return error;
+}
+
+
+ReturnCode test_poison(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~~~~test_poison~~~~~~~~~~~\n");
+
+    Stack stack = {};
+
+    stack_constructor(&stack, 10);
+
+    for(int i = 1; i <= 20; i++)
+        stack_push(&stack, i);
+
+    for(int i = 1; i <= 5; i++) {
+        Object value = 0;
+        stack_pop(&stack, &value);
+    }
+
+    stack.data[stack.size + 2] = 1;
+
+    ErrorBits error = stack_audit(&stack);
+
+    stack.data[stack.size + 2] = POISON_VALUE;
+
+    stack_destructor(&stack);
+
+    return error;
+}
+
+
+ReturnCode test_invalid_pointer(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~test_invalid_pointer~~~~~~~\n");
+
+    return stack_check((Stack *) 16);
+}
+
+
+ReturnCode test_push_pop_n(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~~test_push_pop_n~~~~~~~~~~\n");
+
+    static Object input[1001] = {}, output[1001] = {};
+
+    for(int i = 0; i < 1001; i++)
+        input[i] = i + 1;
+
+    Stack stack = {};
+
+    stack_constructor(&stack, 10);
+
+    stack_reserve(&stack, 500);
+
+    stack_push_n(&stack, input, 1001);
+
+    ErrorBits error = stack_audit(&stack);
+
+    stack_pop_n(&stack, output, 1001);
+
+    for(int i = 0; i < 1001; i++)
+        if (input[i] != output[i]) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    if (stack.capacity < 500) error |= ERROR_BIT_FLAGS::INVALID_CAPACITY;
+
+    return error | stack_destructor(&stack);
+}
+
+
+ReturnCode test_generic_stack(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~test_generic_stack~~~~~~~~\n");
+
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    BasicStack<std::string> strings = {};
+
+    error |= stack_constructor(&strings, 2);
+
+    for(int i = 0; i < 100; i++)
+        error |= stack_push(&strings, std::string(40, (char)('a' + i % 26)));
+
+    error |= stack_audit(&strings);
+
+    for(int i = 99; i >= 0; i--) {
+        std::string value;
+        error |= stack_pop(&strings, &value);
+
+        if (value != std::string(40, (char)('a' + i % 26))) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+    }
+
+    error |= stack_destructor(&strings);
+
+    BasicStack<BigObject, NoProtectPolicy> objects = {};
+
+    BigObject input[50] = {}, output[50] = {};
+
+    for(int i = 0; i < 50; i++)
+        input[i].fields[i % 8] = i;
+
+    error |= stack_constructor(&objects, 10);
+
+    error |= stack_push_n(&objects, input, 50);
+
+    error |= stack_pop_n(&objects, output, 50);
+
+    if (memcmp(input, output, sizeof(input))) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    return error | stack_destructor(&objects);
+}
+
+
+ReturnCode test_lockfree_stack(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~test_lockfree_stack~~~~~~~~\n");
+
+    static LockFreeStack stack = {};
+
+    lockfree_stack_constructor(&stack);
+
+    std::atomic<long long> sum(0);
+    std::atomic<ErrorBits> error(ERROR_BIT_FLAGS::STACK_OK);
+
+    std::thread threads[4];
+
+    for(int t = 0; t < 4; t++) {
+        threads[t] = std::thread([&sum, &error, t]() {
+            for(int i = 1; i <= 10000; i++) {
+                error |= lockfree_stack_push(&stack, t * 10000 + i);
+
+                Object value = 0;
+                error |= lockfree_stack_pop(&stack, &value);
+
+                sum += value;
+            }
+        });
+    }
+
+    for(int t = 0; t < 4; t++)
+        threads[t].join();
+
+    // Every pushed object must be popped exactly once
+    if (sum != 40000ll * 40001 / 2) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    Object value = 0;
+    error |= lockfree_stack_pop(&stack, &value);
+
+    error |= lockfree_stack_destructor(&stack);
+
+    return error;
+}
+
+
+ReturnCode test_work_deque(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~~test_work_deque~~~~~~~~~~\n");
+
+    WorkDeque deque = {};
+
+    ErrorBits error = work_deque_constructor(&deque, 4);
+
+    std::atomic<long long> sum(0);
+    std::atomic<bool> done(false);
+
+    std::thread thieves[3];
+
+    for(int t = 0; t < 3; t++) {
+        thieves[t] = std::thread([&deque, &sum, &done]() {
+            while (!done) {
+                Object value = 0;
+                if (!work_deque_steal(&deque, &value)) sum += value;
+            }
+        });
+    }
+
+    for(int i = 1; i <= 20000; i++) {
+        error |= work_deque_push(&deque, i);
+
+        // Owner takes back every other task
+        Object value = 0;
+        if (i % 2 && !work_deque_pop(&deque, &value)) sum += value;
+    }
+
+    Object value = 0;
+    while (!work_deque_pop(&deque, &value))
+        sum += value;
+
+    done = true;
+
+    for(int t = 0; t < 3; t++)
+        thieves[t].join();
+
+    // Every task must be taken exactly once
+    if (sum != 20000ll * 20001 / 2) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    return error | work_deque_destructor(&deque);
+}
+
+
+ReturnCode test_pool_allocator(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~test_pool_allocator~~~~~~~~\n");
+
+    pool_trim();
+
+    ErrorBits error = 0;
+
+    PoolStats before = {};
+
+    for(int round = 0; round < 100; round++) {
+        // First round fills the pool
+        if (round == 1) pool_stats(&before);
+
+        Stack stack = {};
+
+        error |= stack_constructor(&stack, 10);
+
+        for(int i = 0; i < 100; i++)
+            error |= stack_push(&stack, i);
+
+        error |= stack_destructor(&stack);
+    }
+
+    PoolStats after = {};
+    pool_stats(&after);
+
+    fprintf(get_log_file(), "hits %llu, misses %llu, spills %llu, cached %llu bytes\n",
+            after.hits - before.hits, after.misses - before.misses, after.spills - before.spills, after.cached_bytes);
+
+    // Every buffer after the first round should come from the pool
+    if (after.misses != before.misses || after.hits == before.hits) error |= ERROR_BIT_FLAGS::ALLOCATE_FAIL;
+
+    return error;
+}
+
+
+ReturnCode test_segmented_stack(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~test_segmented_stack~~~~~~~~\n");
+
+    SegmentedStack stack = {};
+
+    ErrorBits error = segmented_stack_constructor(&stack);
+
+    for(int i = 0; i < 3 * SEGMENT_CAPACITY; i++)
+        error |= segmented_stack_push(&stack, i);
+
+    // Pops and pushes at the border should reuse the spare chunk
+    for(int i = 0; i < 100; i++) {
+        Object value = 0;
+        error |= segmented_stack_pop(&stack, &value);
+        error |= segmented_stack_push(&stack, value);
+    }
+
+    if (stack.chunks != 3) error |= ERROR_BIT_FLAGS::INVALID_SIZE;
+
+    error |= segmented_stack_audit(&stack);
+
+    for(int i = 3 * SEGMENT_CAPACITY - 1; i >= 0; i--) {
+        Object value = 0;
+        error |= segmented_stack_pop(&stack, &value);
+
+        if (value != i) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+    }
+
+    error |= segmented_stack_audit(&stack);
+
+    segmented_stack_dump(&stack, error, get_log_file());
+
+    return error | segmented_stack_destructor(&stack);
+}
+
+
+ReturnCode test_mapped_stack(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~test_mapped_stack~~~~~~~~~\n");
+
+    static Object objects[1000] = {};
+
+    for(int i = 0; i < 1000; i++)
+        objects[i] = i;
+
+    StackOptions options = {};
+    options.max_capacity = 100000000;
+    options.flags = STACK_FLAGS::STACK_MAPPED | STACK_FLAGS::STACK_HUGE_PAGES;
+
+    Stack stack = {};
+
+    ErrorBits error = stack_constructor(&stack, 16, &options);
+
+    Object *buffer = stack.data;
+
+    for(int i = 0; i < 2000; i++)
+        error |= stack_push_n(&stack, objects, 1000);
+
+    for(int i = 0; i < 2000; i++)
+        error |= stack_pop_n(&stack, objects, 1000);
+
+    // Mapped buffer grows and shrinks in place
+    if (stack.data != buffer || objects[999] != 999) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    error |= stack_audit(&stack);
+    error |= stack_destructor(&stack);
+
+    if (error) return error;
+
+    // Reservation of this many objects doesn't fit in address space
+    options.max_capacity = (StackSize) ((size_t) -1 / 2 / sizeof(Object) + 1);
+
+    if (stack_constructor(&stack, 16, &options) != ERROR_BIT_FLAGS::INVALID_ARGUMENT) return ERROR_BIT_FLAGS::INVALID_CAPACITY;
+
+    options.max_capacity = 8;
+    options.flags = 0;
+
+    error |= stack_constructor(&stack, 4, &options);
+
+    ErrorBits overflow = stack_push_n(&stack, objects, 9);
+
+    STACK_DUMP(&stack, overflow);
+
+    error |= stack_destructor(&stack);
+
+    return error | overflow;
+}
+
+
+ReturnCode test_stack_stats(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~test_stack_stats~~~~~~~~~~\n");
+
+    StackStats before = {}, after = {}, global = {};
+
+    stack_stats_snapshot(&before, false);
+
+    Stack stack = {};
+
+    ErrorBits error = stack_constructor(&stack, 2);
+
+    for(int i = 0; i < 100; i++)
+        error |= stack_push(&stack, i);
+
+    for(int i = 0; i < 100; i++) {
+        Object value = 0;
+        error |= stack_pop(&stack, &value);
+    }
+
+    error |= stack_audit(&stack);
+
+    stack_stats_snapshot(&after, false);
+
+    STACK_DUMP(&stack, error);
+
+    error |= stack_destructor(&stack);
+
+    // Counters of finished thread go to the global sum
+    std::thread worker([]() {
+        Stack other = {};
+        stack_constructor(&other, 2);
+        stack_push(&other, 1);
+        stack_destructor(&other);
+    });
+
+    worker.join();
+
+    stack_stats_snapshot(&global, true);
+
+    #ifdef STACK_STATS
+        if (after.counters[STATS_PUSHES] - before.counters[STATS_PUSHES] != 100 || after.counters[STATS_POPS] - before.counters[STATS_POPS] != 100
+                || after.counters[STATS_AUDITS] == before.counters[STATS_AUDITS] || after.peak_size < 100
+                || after.counters[STATS_GROWS] == before.counters[STATS_GROWS] || after.counters[STATS_SHRINKS] == before.counters[STATS_SHRINKS])
+            error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+        if (global.counters[STATS_PUSHES] < after.counters[STATS_PUSHES] + 1)
+            error |= ERROR_BIT_FLAGS::INVALID_DATA;
+    #else
+        if (after.counters[STATS_CHECKS] || global.counters[STATS_PUSHES])
+            error |= ERROR_BIT_FLAGS::INVALID_DATA;
+    #endif
+
+    return error;
+}
+
+
+ReturnCode test_async_log(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~~test_async_log~~~~~~~~~~~\n");
+
+    // Writers wait for full ring buffer, so every line must reach the file
+    bool drop = log_drop_when_full(false);
+    size_t dropped = log_dropped();
+
+    std::thread writers[4];
+
+    for(int t = 0; t < 4; t++) {
+        writers[t] = std::thread([t]() {
+            for(int i = 0; i < 1000; i++)
+                fprintf(get_log_file(), "async writer %d line %d\n", t, i);
+
+            // Thread stream is flushed when thread exits
+        });
+    }
+
+    for(int t = 0; t < 4; t++)
+        writers[t].join();
+
+    log_flush();
+
+    log_drop_when_full(drop);
+
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    if (log_dropped() != dropped) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    FILE *file = fopen(LOG_FILENAME, "r");
+    CHECK(file, return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    static bool seen[4][1000] = {};
+    memset(seen, 0, sizeof(seen));
+
+    char line[128] = "", expected[128] = "";
+    int lines = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        if (!strstr(line, "async writer ")) continue;
+
+        int t = -1, i = -1;
+
+        // Torn line either doesn't parse back or differs from text its numbers give
+        if (sscanf(line, "async writer %d line %d", &t, &i) != 2 || t < 0 || t >= 4 || i < 0 || i >= 1000 || seen[t][i]) {
+            error |= ERROR_BIT_FLAGS::INVALID_DATA;
+            continue;
+        }
+
+        snprintf(expected, sizeof(expected), "async writer %d line %d\n", t, i);
+
+        if (strcmp(line, expected) != 0) {
+            error |= ERROR_BIT_FLAGS::INVALID_DATA;
+            continue;
+        }
+
+        seen[t][i] = true;
+        lines++;
+    }
+
+    fclose(file);
+
+    if (lines != 4000) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    fprintf(get_log_file(), "%d lines, %zu bytes dropped\n", lines, log_dropped() - dropped);
+
+    return error;
+}
+
+
+ReturnCode test_binary_dump(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~test_binary_dump~~~~~~~~~~\n");
+
+    Stack stack = {};
+
+    ErrorBits error = stack_constructor(&stack, 1);
+
+    for(int i = 0; i < 100; i++)
+        error |= stack_push(&stack, i);
+
+    for(int i = 0; i < 50; i++) {
+        Object value = 0;
+        error |= stack_pop(&stack, &value);
+    }
+
+    FILE *file = tmpfile();
+    CHECK(file, return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    stack_dump_binary(&stack, ERROR_BIT_FLAGS::STACK_OK, file);
+
+    error |= stack_push(&stack, 1000);
+
+    stack_dump_binary(&stack, ERROR_BIT_FLAGS::STACK_OK, file);
+
+    rewind(file);
+
+    DumpHeader old_header = {}, new_header = {};
+    char *old_payload = nullptr, *new_payload = nullptr;
+
+    if (dump_read(file, &old_header, &old_payload) || dump_read(file, &new_header, &new_payload)) {
+        fclose(file);
+        free(old_payload);
+        return error | ERROR_BIT_FLAGS::INVALID_DATA;
+    }
+
+    fclose(file);
+
+    if (old_header.size != 50 || old_header.watermark < 100 || old_header.capacity != stack.capacity)
+        error |= ERROR_BIT_FLAGS::INVALID_SIZE;
+
+    // Popped slots are one poison run
+    if (old_header.payload_bytes != 50 * sizeof(Object) + 2 * sizeof(StackSize))
+        error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    Object *slots = (Object *) calloc((size_t) old_header.watermark, sizeof(Object));
+
+    if (!slots || dump_unpack(&old_header, old_payload, (char *) slots))
+        error |= ERROR_BIT_FLAGS::INVALID_DATA;
+    else {
+        for(int i = 0; i < 50; i++)
+            if (slots[i] != i) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+        if (!is_poison(slots + 50) || !is_poison(slots + old_header.watermark - 1))
+            error |= ERROR_BIT_FLAGS::UNEXP_NORMAL_VAL;
+    }
+
+    dump_render(&old_header, old_payload, get_log_file());
+
+    // Size, buffer hash and slot 50 are changed
+    if (dump_diff(&old_header, old_payload, &new_header, new_payload, get_log_file()) < 2)
+        error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    free(slots);
+    free(old_payload);
+    free(new_payload);
+
+    return error | stack_destructor(&stack);
+}
+
+
+ReturnCode test_guard_pages(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~test_guard_pages~~~~~~~~~~\n");
+
+    typedef BasicStack<Object, StackPolicy<GuardProtect, NoHashProtect, PoisonProtect>> GuardedStack;
+
+    GuardedStack stack = {};
+
+    // Verified stack checks that recovery releases its verifier slot
+    StackOptions options = {};
+    options.flags = STACK_FLAGS::STACK_VERIFIED;
+
+    ErrorBits error = stack_constructor(&stack, 16, &options);
+
+    // Buffer of one page has guard pages right on both sides
+    int count = (int)((size_t) sysconf(_SC_PAGESIZE) / sizeof(Object));
+
+    for(int i = 0; i < count; i++)
+        error |= stack_push(&stack, i);
+
+    if (stack.capacity != count) return error | ERROR_BIT_FLAGS::INVALID_CAPACITY;
+
+    unsigned long long faults = guard_faults();
+
+    static sigjmp_buf recovery;
+
+    volatile Object *overrun = stack.data + stack.capacity;
+    volatile Object *underrun = stack.data - 1;
+
+    int reported = 0;
+
+    if (!sigsetjmp(recovery, 1)) {
+        guard_set_recovery(&recovery);
+
+        // Fault leaves this scope without unlocking the slot
+        VerifierLock lock(stack_verify_slot(&stack));
+        *overrun = 1;
+    }
+    else
+        reported += guard_recover();
+
+    if (!sigsetjmp(recovery, 1)) {
+        guard_set_recovery(&recovery);
+        *underrun = 1;
+    }
+    else
+        reported += guard_recover();
+
+    guard_set_recovery(NULL);
+
+    if (guard_faults() != faults + 2 || reported != 2 || guard_recover()) error |= ERROR_BIT_FLAGS::BUFFER_CANARY;
+
+    for(int i = count - 1; i >= 0; i--) {
+        Object value = 0;
+        error |= stack_pop(&stack, &value);
+
+        if (value != i) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+    }
+
+    error |= stack_audit(&stack);
+    error |= stack_destructor(&stack);
+
+    // Buffer that doesn't fit in region table would fault unreported, so it isn't given out
+    static void *buffers[GUARD_MAX_REGIONS + 1] = {};
+    int allocated = 0;
+
+    while (allocated < GUARD_MAX_REGIONS + 1 && (buffers[allocated] = guard_allocate(sizeof(Object), NULL, NULL)))
+        allocated++;
+
+    if (allocated == 0 || allocated > GUARD_MAX_REGIONS) error |= ERROR_BIT_FLAGS::ALLOCATE_FAIL;
+
+    for(int i = 0; i < allocated; i++)
+        guard_free(buffers[i], sizeof(Object));
+
+    return error;
+}
+
+
+ReturnCode test_hash_engines(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~test_hash_engines~~~~~~~~~\n");
+
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    static unsigned char bytes[1000] = {};
+
+    for(int i = 0; i < 1000; i++)
+        bytes[i] = (unsigned char)(i * 131 + 7);
+
+    const size_t PIECES[] = {1, 7, 8, 9, 4, 64, 3, 100, 13};
+
+    for(unsigned id = HASH_ENGINE_GNU; id <= HASH_ENGINE_CRC32C; id++) {
+        const HashEngine *engine = find_hash_engine(id);
+        CHECK(engine && engine -> id == id, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+        HashType whole = engine -> append(engine -> seed, bytes, sizeof(bytes));
+
+        // Hash must not depend on how sequence was split
+        HashType hash = engine -> seed;
+        size_t offset = 0;
+
+        for(size_t p = 0; offset < sizeof(bytes); p = (p + 1) % (sizeof(PIECES) / sizeof(size_t))) {
+            size_t piece = (PIECES[p] < sizeof(bytes) - offset) ? PIECES[p] : sizeof(bytes) - offset;
+
+            hash = engine -> append(hash, bytes + offset, piece);
+            offset += piece;
+        }
+
+        if (hash != whole) error |= ERROR_BIT_FLAGS::BUFFER_HASH_FAIL;
+
+        for(size_t p = 0; offset > 0; p = (p + 1) % (sizeof(PIECES) / sizeof(size_t))) {
+            size_t piece = (PIECES[p] < offset) ? PIECES[p] : offset;
+
+            offset -= piece;
+            hash = engine -> remove(hash, bytes + offset, piece);
+
+            if (hash != engine -> append(engine -> seed, bytes, offset)) error |= ERROR_BIT_FLAGS::BUFFER_HASH_FAIL;
+        }
+
+        fprintf(get_log_file(), "%u %s: %llx\n", engine -> id, engine -> name, whole);
+    }
+
+    // Standard check value of CRC32C
+    const HashEngine *crc = find_hash_engine(HASH_ENGINE_CRC32C);
+
+    if ((crc -> append(crc -> seed, "123456789", 9) ^ 0xFFFFFFFFull) != 0xE3069283ull) error |= ERROR_BIT_FLAGS::STRUCT_HASH_FAIL;
+
+    fprintf(get_log_file(), "Current engine: %s\n", get_hash_engine() -> name);
+
+    return error;
+}
+
+
+ReturnCode test_small_buffer(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~test_small_buffer~~~~~~~~~\n");
+
+    const StackSize SMALL = small_capacity<Object, DefaultPolicy>();
+
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    PoolStats before = {}, after = {};
+    pool_stats(&before);
+
+    Stack stack = {};
+
+    error |= stack_constructor(&stack, 4);
+
+    for(int i = 0; i < SMALL_CAPACITY; i++)
+        error |= stack_push(&stack, i);
+
+    error |= stack_audit(&stack);
+
+    pool_stats(&after);
+
+    // Guarded stacks have no small buffer, but they don't use pool either
+    if ((stack.data == stack_small(&stack)) != (SMALL > 0) || after.hits + after.misses != before.hits + before.misses)
+        error |= ERROR_BIT_FLAGS::ALLOCATE_FAIL;
+
+    for(int i = SMALL_CAPACITY; i < 3 * SMALL_CAPACITY + 1; i++)
+        error |= stack_push(&stack, i);
+
+    if (stack.data == stack_small(&stack)) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    for(int i = 3 * SMALL_CAPACITY; i >= 2; i--) {
+        Object value = 0;
+        error |= stack_pop(&stack, &value);
+
+        if (value != i) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+    }
+
+    // Shrunk stack returns to small buffer with poisoned slots
+    if ((stack.data == stack_small(&stack)) != (SMALL > 0) || stack.data[0] != 0 || stack.data[1] != 1) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    error |= stack_audit(&stack);
+
+    STACK_DUMP(&stack, error);
+
+    error |= stack_destructor(&stack);
+
+    // Objects that can't be copied bytewise are moved in and out of small buffer one by one
+    BasicStack<std::unique_ptr<int>> pointers = {};
+
+    error |= stack_constructor(&pointers, 1);
+
+    for(int i = 0; i < 40; i++)
+        error |= stack_push(&pointers, std::unique_ptr<int>(new int(i)));
+
+    for(int i = 39; i >= 0; i--) {
+        std::unique_ptr<int> pointer;
+        error |= stack_pop(&pointers, &pointer);
+
+        if (!pointer || *pointer != i) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+    }
+
+    error |= stack_audit(&pointers);
+
+    return error | stack_destructor(&pointers);
+}
+
+
+ReturnCode test_background_verifier(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~test_background_verifier~~~~~~\n");
+
+    const int STACKS = 4;
+
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    StackOptions options = {};
+    options.flags = STACK_FLAGS::STACK_VERIFIED;
+
+    Stack stacks[STACKS] = {};
+
+    for(int s = 0; s < STACKS; s++)
+        error |= stack_constructor(&stacks[s], 4, &options);
+
+    VerifierStats before = {}, after = {};
+    verifier_stats(&before);
+
+    verifier_start(1);
+
+    // Stacks are resized back and forth while verifier audits them
+    for(int round = 0; round < 200; round++) {
+        for(int s = 0; s < STACKS; s++) {
+            for(int i = 0; i < 100; i++)
+                error |= stack_push(&stacks[s], round + i);
+
+            for(int i = 0; i < 100; i++) {
+                Object value = 0;
+                error |= stack_pop(&stacks[s], &value);
+            }
+        }
+    }
+
+    verifier_stop();
+
+    if (verifier_sweep()) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    verifier_stats(&after);
+
+    fprintf(get_log_file(), "sweeps %llu, audits %llu, skipped %llu, errors %llu\n", after.sweeps - before.sweeps,
+            after.audits - before.audits, after.skipped - before.skipped, after.errors - before.errors);
+
+    if (after.audits - before.audits < STACKS || after.errors != before.errors) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    if (error) return error;
+
+    for(int i = 0; i < 20; i++)
+        error |= stack_push(&stacks[0], i);
+
+    for(int i = 0; i < 10; i++) {
+        Object value = 0;
+        error |= stack_pop(&stacks[0], &value);
+    }
+
+    // Slot below the top isn't checked inline, so only verifier finds it
+    stacks[0].data[stacks[0].size + 2] = 1;
+
+    Object value = 0;
+
+    error |= stack_push(&stacks[0], 10);
+    error |= stack_pop(&stacks[0], &value);
+
+    if (verifier_sweep() != 1) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    ErrorBits found = stack_push(&stacks[0], 10);
+
+    stacks[0].data[stacks[0].size + 2] = POISON_VALUE;
+
+    for(int s = 0; s < STACKS; s++)
+        error |= stack_destructor(&stacks[s]);
+
+    typedef BasicStack<Object, StackPolicy<CanaryProtect, HashProtect, PoisonProtect>> HashedStack;
+
+    HashedStack hashed = {};
+    error |= stack_constructor(&hashed, 4, &options);
+
+    // Structure hash is checked inline, so wrong capacity is caught before push touches the buffer
+    StackSize capacity = hashed.capacity;
+    hashed.capacity = 1 << 20;
+
+    if (!HAS_ERROR(stack_push(&hashed, 1), ERROR_BIT_FLAGS::STRUCT_HASH_FAIL)) error |= ERROR_BIT_FLAGS::INVALID_CAPACITY;
+
+    hashed.capacity = capacity;
+    error |= stack_destructor(&hashed);
+
+    return error | found;
+}
+
+
+ReturnCode test_runtime_protection(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~test_runtime_protection~~~~~~~\n");
+
+    typedef BasicStack<Object, RuntimePolicy> RuntimeStack;
+
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    StackOptions options = {};
+    options.protection = 0;
+
+    RuntimeStack stack = {};
+
+    error |= stack_constructor(&stack, 4, &options);
+
+    for(int i = 0; i < 100; i++)
+        error |= stack_push(&stack, i);
+
+    // Nothing notices damage while protection is off
+    stack.canary_begin = 0;
+    stack.min_capacity = 2;
+    stack.data[10] = -10;
+
+    error |= stack_push(&stack, 100);
+
+    if (stack_protection(&stack) != 0) error |= ERROR_BIT_FLAGS::INVALID_ARGUMENT;
+
+    error |= stack_set_protection(&stack, CANARY_PROTECT | HASH_PROTECT);
+    error |= stack_audit(&stack);
+
+    stack.data[10] = 10;
+
+    // Protection is established for the current state, so every change behind its back is found now
+    ErrorBits found = 0, expected = ERROR_BIT_FLAGS::BUFFER_HASH_FAIL | ERROR_BIT_FLAGS::STRUCT_HASH_FAIL | ERROR_BIT_FLAGS::STRUCT_CANARY;
+
+    found |= stack_audit(&stack);
+
+    stack.data[10] = -10;
+    stack.min_capacity = 3;
+
+    found |= stack_check(&stack);
+
+    stack.min_capacity = 2;
+    stack.canary_end = 0;
+
+    found |= stack_check(&stack);
+
+    stack.canary_end = (CanaryType) &stack;
+
+    if (found != expected) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    error |= stack_set_protection(&stack, 0);
+
+    for(int i = 0; i < 100; i++) {
+        Object value = 0;
+        error |= stack_pop(&stack, &value);
+    }
+
+    error |= stack_set_protection(&stack, HASH_PROTECT);
+    error |= stack_audit(&stack);
+
+    // Protections compiled in can't be turned off
+    Stack fixed = {};
+
+    error |= stack_constructor(&fixed, 4);
+
+    if (stack_set_protection(&fixed, CANARY_PROTECT) != ERROR_BIT_FLAGS::INVALID_ARGUMENT && !(DefaultPolicy::RUNTIME & CANARY_PROTECT))
+        error |= ERROR_BIT_FLAGS::INVALID_ARGUMENT;
+
+    error |= stack_destructor(&fixed);
+
+    return error | stack_destructor(&stack);
+}
+
+
+ReturnCode test_snapshot(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~~~~test_snapshot~~~~~~~~~~~~\n");
+
+    const char SNAPSHOT_FILENAME[] = "snapshot_test.bin";
+    const char FILE_STACK_FILENAME[] = "snapshot_file_test.bin";
+
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    Stack stack = {}, loaded = {};
+
+    error |= stack_constructor(&stack, 4);
+
+    for(int i = 0; i < 1000; i++)
+        error |= stack_push(&stack, i);
+
+    for(int i = 0; i < 100; i++) {
+        Object value = 0;
+        error |= stack_pop(&stack, &value);
+    }
+
+    error |= stack_save(&stack, SNAPSHOT_FILENAME);
+    error |= stack_load(&loaded, SNAPSHOT_FILENAME, NULL);
+
+    if (loaded.size != stack.size || loaded.watermark != stack.watermark || memcmp(loaded.data, stack.data, (size_t) stack.size * sizeof(Object)))
+        error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    // Loaded pages are private copies, so the file keeps snapshot state
+    error |= stack_push(&loaded, -1);
+    error |= stack_audit(&loaded);
+    error |= stack_destructor(&loaded);
+
+    error |= stack_load(&loaded, SNAPSHOT_FILENAME, NULL);
+
+    for(int i = 899; i >= 0; i--) {
+        Object value = 0;
+        error |= stack_pop(&loaded, &value);
+
+        if (value != i) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+    }
+
+    error |= stack_destructor(&loaded);
+
+    // Broken buffer and broken header are found before the stack is used
+    FILE *file = fopen(SNAPSHOT_FILENAME, "r+b");
+    if (!file) return error | ERROR_BIT_FLAGS::SNAPSHOT_FAIL;
+
+    const Object wrong = -5;
+    const StackSize wrong_size = 1;
+
+    fseek(file, (long)(SNAPSHOT_DATA_OFFSET + buffer_front<Object, DefaultPolicy>() + 10 * sizeof(Object)), SEEK_SET);
+    fwrite(&wrong, sizeof(wrong), 1, file);
+    fflush(file);
+
+    ErrorBits found = stack_load(&loaded, SNAPSHOT_FILENAME, NULL);
+
+    fseek(file, (long) offsetof(SnapshotHeader, size), SEEK_SET);
+    fwrite(&wrong_size, sizeof(wrong_size), 1, file);
+    fclose(file);
+
+    found |= stack_load(&loaded, SNAPSHOT_FILENAME, NULL);
+
+    if (found != (ERROR_BIT_FLAGS::BUFFER_HASH_FAIL | ERROR_BIT_FLAGS::STRUCT_HASH_FAIL)) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    remove(SNAPSHOT_FILENAME);
+
+    error |= stack_destructor(&stack);
+
+    // Guarded buffers aren't mapped, so they can't live in file
+    if (DefaultPolicy::Canary::GUARDED) return error;
+
+    StackOptions options = {};
+    options.flags = STACK_FLAGS::STACK_FILE;
+    options.path = FILE_STACK_FILENAME;
+
+    error |= stack_constructor(&stack, 4, &options);
+
+    for(int i = 0; i < 500; i++)
+        error |= stack_push(&stack, i);
+
+    error |= stack_sync(&stack);
+
+    // Stack reopened after checkpoint is the same, and destructor leaves the last state
+    error |= stack_load(&loaded, FILE_STACK_FILENAME, NULL);
+
+    if (loaded.size != 500) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    error |= stack_destructor(&loaded);
+
+    for(int i = 500; i < 600; i++)
+        error |= stack_push(&stack, i);
+
+    error |= stack_destructor(&stack);
+
+    error |= stack_load(&stack, FILE_STACK_FILENAME, &options);
+
+    if (stack.size != 600 || stack.data[599] != 599) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    for(int i = 0; i < 300; i++) {
+        Object value = 0;
+        error |= stack_pop(&stack, &value);
+    }
+
+    error |= stack_destructor(&stack);
+
+    error |= stack_load(&loaded, FILE_STACK_FILENAME, NULL);
+
+    if (loaded.size != 300) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    error |= stack_audit(&loaded);
+    error |= stack_destructor(&loaded);
+
+    remove(FILE_STACK_FILENAME);
+
+    return error;
+}
+
+
+ReturnCode test_segmented_fork(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~test_segmented_fork~~~~~~~~~\n");
+
+    const int STACK_SIZE = 2 * SEGMENT_CAPACITY + SEGMENT_CAPACITY / 2;
+
+    SegmentedStack stack = {}, copy = {};
+
+    ErrorBits error = segmented_stack_constructor(&stack);
+
+    for(int i = 0; i < STACK_SIZE; i++)
+        error |= segmented_stack_push(&stack, i);
+
+    error |= segmented_stack_fork(&copy, &stack);
+
+    // Branches write only to their own copy of the top chunk
+    for(int branch = 0; branch < 1000; branch++) {
+        SegmentedStack fork = {};
+
+        error |= segmented_stack_fork(&fork, &stack);
+
+        for(int i = 0; i < 10; i++)
+            error |= segmented_stack_push(&fork, -branch);
+
+        for(int i = 0; i < 20; i++) {
+            Object value = 0;
+            error |= segmented_stack_pop(&fork, &value);
+
+            if (value != ((i < 10) ? -branch : STACK_SIZE - 1 - (i - 10))) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+        }
+
+        error |= segmented_stack_audit(&fork);
+        error |= segmented_stack_destructor(&fork);
+    }
+
+    if (stack.top != copy.top || stack.top -> refs != 2) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    // Stack goes below the chunk border and writes there, copy must still see old objects
+    for(int i = 0; i < SEGMENT_CAPACITY; i++) {
+        Object value = 0;
+        error |= segmented_stack_pop(&stack, &value);
+    }
+
+    for(int i = 0; i < SEGMENT_CAPACITY; i++)
+        error |= segmented_stack_push(&stack, -i);
+
+    error |= segmented_stack_audit(&stack);
+    error |= segmented_stack_audit(&copy);
+
+    for(int i = STACK_SIZE - 1; i >= 0; i--) {
+        Object value = 0;
+        error |= segmented_stack_pop(&copy, &value);
+
+        if (value != i) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+    }
+
+    error |= segmented_stack_audit(&copy);
+    error |= segmented_stack_destructor(&copy);
+
+    error |= segmented_stack_audit(&stack);
+
+    segmented_stack_dump(&stack, error, get_log_file());
+
+    return error | segmented_stack_destructor(&stack);
+}
+
+
+ReturnCode test_blocking_stack(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~test_blocking_stack~~~~~~~~~\n");
+
+    const int BOUND = 8;
+    const int OBJECTS = 20000;
+    const int CONSUMERS = 3;
+    const int BATCH = 5;
+
+    static BlockingStack stack = {};
+
+    std::atomic<ErrorBits> error(blocking_stack_constructor(&stack, BOUND));
+    std::atomic<long long> sum(0), consumed(0);
+
+    std::thread consumers[CONSUMERS];
+
+    // Consumers park on empty stack and stop at -1
+    for(int t = 0; t < CONSUMERS; t++) {
+        consumers[t] = std::thread([&sum, &consumed, &error]() {
+            for(;;) {
+                Object value = 0;
+                error |= blocking_stack_pop(&stack, &value, BLOCKING_WAIT_FOREVER);
+
+                if (value == -1) break;
+
+                sum += value;
+                consumed++;
+            }
+        });
+    }
+
+    // One producer pushes objects one by one, another one in batches, both wait for room most of the time
+    std::thread single([&error]() {
+        for(int i = 1; i <= OBJECTS; i++)
+            error |= blocking_stack_push(&stack, i, BLOCKING_WAIT_FOREVER);
+    });
+
+    std::thread batch([&error]() {
+        for(int i = 1; i <= OBJECTS; i += BATCH) {
+            Object objects[BATCH] = {};
+
+            for(int j = 0; j < BATCH; j++)
+                objects[j] = i + j;
+
+            error |= blocking_stack_push_n(&stack, objects, BATCH, NULL, BLOCKING_WAIT_FOREVER);
+        }
+    });
+
+    single.join();
+    batch.join();
+
+    // Stops go on the top of the stack, so they are pushed when everything else is popped
+    while (consumed < 2 * OBJECTS)
+        std::this_thread::yield();
+
+    Object stops[CONSUMERS] = {};
+
+    for(int t = 0; t < CONSUMERS; t++)
+        stops[t] = -1;
+
+    error |= blocking_stack_push_n(&stack, stops, CONSUMERS, NULL, BLOCKING_WAIT_FOREVER);
+
+    for(int t = 0; t < CONSUMERS; t++)
+        consumers[t].join();
+
+    if (sum != 2 * ((long long) OBJECTS * (OBJECTS + 1) / 2)) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    // Empty stack fails at once when trying and after timeout when waiting
+    Object value = 0;
+
+    if (blocking_stack_try_pop(&stack, &value) != ERROR_BIT_FLAGS::EMPTY_STACK) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (blocking_stack_pop(&stack, &value, 2000) != ERROR_BIT_FLAGS::EMPTY_STACK) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    if (std::chrono::steady_clock::now() - start < std::chrono::microseconds(2000)) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    // Full stack does the same for pushes, partly pushed batch reports its part
+    for(int i = 0; i < BOUND - 2; i++)
+        error |= blocking_stack_try_push(&stack, i);
+
+    Object objects[BOUND] = {};
+    StackSize count = 0;
+
+    if (blocking_stack_push_n(&stack, objects, 4, &count, 1000) != ERROR_BIT_FLAGS::STACK_OVERFLOW || count != 2) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    if (blocking_stack_try_push(&stack, 0) != ERROR_BIT_FLAGS::STACK_OVERFLOW) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    error |= blocking_stack_pop_n(&stack, objects, BOUND * 2, &count, 0);
+
+    if (count != BOUND || objects[BOUND - 3] != BOUND - 3) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    error |= blocking_stack_check(&stack);
+    error |= blocking_stack_destructor(&stack);
+
+    return error;
+}
+
+
+ReturnCode test_stack_set(void *data) {
+    fprintf(get_log_file(), "\n~~~~~~~~~~~test_stack_set~~~~~~~~~~~\n");
+
+    const StackHandle STACKS = 5000;
+    const StackHandle DEEP = 42;
+
+    static StackSet set = {};
+
+    ErrorBits error = stack_set_constructor(&set);
+
+    for(StackHandle i = 0; i < STACKS; i++) {
+        StackHandle handle = STACK_SET_NONE;
+        error |= stack_set_create(&set, &handle);
+
+        if (handle != i) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+        for(StackHandle j = 0; j < i % 7; j++)
+            error |= stack_set_push(&set, handle, (Object)(i * 10 + j));
+    }
+
+    // Deep stack moves to larger blocks, freed small ones are reused
+    for(int i = 0; i < 100; i++)
+        error |= stack_set_push(&set, DEEP, 1000 + i);
+
+    for(int i = 99; i >= 50; i--) {
+        Object value = 0;
+        error |= stack_set_pop(&set, DEEP, &value);
+
+        if (value != 1000 + i) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+    }
+
+    StackHandle destroyed = 0, small = 0;
+
+    for(StackHandle i = 0; i < STACKS; i += 2) {
+        if (i == DEEP) continue;
+
+        error |= stack_set_destroy(&set, i);
+
+        destroyed++;
+        small += (i % 7 <= STACK_SET_MIN_CAPACITY);
+    }
+
+    // New stacks take freed handles and blocks of the smallest capacity
+    unsigned arena_used = set.arena_used;
+
+    for(StackHandle i = 0; i < small; i++) {
+        StackHandle handle = STACK_SET_NONE;
+        error |= stack_set_create(&set, &handle);
+        error |= stack_set_push(&set, handle, 7);
+    }
+
+    if (set.handles != STACKS || set.count != STACKS - destroyed + small || set.arena_used != arena_used) error |= ERROR_BIT_FLAGS::INVALID_SIZE;
+
+    Object value = 0;
+    error |= stack_set_pop(&set, 13, &value);
+
+    if (value != 13 * 10 + 13 % 7 - 1 || set.sizes[13] != 13 % 7 - 1) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    error |= stack_set_audit(&set);
+
+    if (stack_set_push(&set, STACKS, 0) != ERROR_BIT_FLAGS::INVALID_ARGUMENT) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    // Write past the top of one stack, it lands in poisoned slot of its block
+    set.arena[set.offsets[13] + set.sizes[13] + 1] = 0;
+
+    error |= stack_set_audit(&set);
+
+    stack_set_dump(&set, 13, error, get_log_file());
+
+    set.arena[set.offsets[13] + set.sizes[13] + 1] = set.arena[set.offsets[13] + set.sizes[13]];
+
+    // Broken free list links are rejected before they are followed
+    unsigned block = set.offsets[1], link = 0, broken = set.arena_used;
+    error |= stack_set_destroy(&set, 1);
+
+    StackHandle next_handle = set.offsets[1], handle = STACK_SET_NONE;
+    set.offsets[1] = STACKS + 1;
+
+    if (stack_set_create(&set, &handle) != ERROR_BIT_FLAGS::INVALID_DATA) error |= ERROR_BIT_FLAGS::INVALID_SIZE;
+
+    set.offsets[1] = next_handle;
+
+    memcpy(&link, set.arena + block, sizeof(unsigned));
+    memcpy(set.arena + block, &broken, sizeof(unsigned));
+
+    if (stack_set_create(&set, &handle) != ERROR_BIT_FLAGS::INVALID_DATA) error |= ERROR_BIT_FLAGS::INVALID_SIZE;
+
+    memcpy(set.arena + block, &link, sizeof(unsigned));
+
+    error |= stack_set_create(&set, &handle);
+
+    if (handle != 1 || set.offsets[1] != block) error |= ERROR_BIT_FLAGS::INVALID_DATA;
+
+    return error | stack_set_destructor(&set);
+}
@@ -0,0 +1,279 @@
+/**
+ * \file
+ * \brief Pointer validation module source
+ * 
+ * Contains realisation of right_pointer() for Windows and Linux
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "pointer.hpp"
+
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+
+int right_pointer(const void *ptr, size_t size) {
+    if (!ptr) return 0;
+
+    MEMORY_BASIC_INFORMATION info = {};
+
+    if (VirtualQuery(ptr, &info, sizeof(info))) {
+        if (info.Protect & (PAGE_GUARD | PAGE_NOACCESS)) return 0;
+
+        DWORD mask = PAGE_READWRITE;
+
+        return (info.Protect & mask) != 0;
+    }
+
+    return 0;
+}
+
+
+void pointer_cache_invalidate(void) {}
+
+
+void pointer_cache_remember(const void *ptr, size_t size) {}
+
+
+#else
+
+
+/// Continuous readable and writable memory region
+typedef struct {
+    size_t begin = 0; ///< First byte of the region
+    size_t end = 0;   ///< Byte after the last byte of the region
+} MemoryRegion;
+
+
+/// Snapshot of process memory map
+struct RegionCache {
+    MemoryRegion *regions = nullptr; ///< Sorted array of regions
+    size_t size = 0;                 ///< Number of regions
+    size_t capacity = 0;             ///< Size of regions array
+    unsigned long long generation = 0; ///< Value of #cache_generation snapshot was taken at
+
+    ~RegionCache(); ///< Frees snapshot when thread exits
+};
+
+
+/// Incremented on every invalidation so each thread knows its snapshot is outdated
+static std::atomic<unsigned long long> cache_generation(1);
+
+
+/// Memory map snapshot of the current thread (zero generation means there is no snapshot)
+static thread_local RegionCache thread_cache = {};
+
+
+/// Is false after snapshot of the current thread was destroyed (later checks read memory map every time)
+static thread_local bool cache_alive = true;
+
+
+/**
+ * \brief Rereads /proc/self/maps into cache
+ * \param cache Thread cache to fill
+ * \return 0 - OK, 1 - FAIL
+*/
+static int read_memory_map(RegionCache *cache);
+
+
+/**
+ * \brief Makes room for one more region in cache
+ * \param cache Thread cache
+ * \return 0 - OK, 1 - FAIL
+*/
+static int reserve_region(RegionCache *cache);
+
+
+/**
+ * \brief Finds first cached region that ends after address
+ * \param cache Thread cache
+ * \param begin Address
+ * \return Index of region or number of regions if there is no such region
+*/
+static size_t lower_region(const RegionCache *cache, size_t begin);
+
+
+/**
+ * \brief Finds region containing memory range in cache
+ * \param cache Thread cache
+ * \param begin First byte of the range
+ * \param end Byte after the last byte of the range
+ * \return Non zero value if range lies in one region
+*/
+static int find_region(const RegionCache *cache, size_t begin, size_t end);
+
+
+
+
+int right_pointer(const void *ptr, size_t size) {
+    if (!ptr) return 0;
+
+    size_t begin = (size_t) ptr;
+    size_t end = begin + (size ? size : 1);
+
+    if (end < begin) return 0;
+
+    if (!cache_alive) {
+        RegionCache uncached = {};
+
+        return !read_memory_map(&uncached) && find_region(&uncached, begin, end);
+    }
+
+    unsigned long long generation = cache_generation.load(std::memory_order_acquire);
+
+    if (thread_cache.generation == generation && find_region(&thread_cache, begin, end))
+        return 1;
+
+    // Memory map could have changed since last snapshot so reread it once
+    if (read_memory_map(&thread_cache)) return 0;
+
+    thread_cache.generation = generation;
+
+    return find_region(&thread_cache, begin, end);
+}
+
+
+void pointer_cache_invalidate(void) {
+    cache_generation.fetch_add(1, std::memory_order_release);
+}
+
+
+void pointer_cache_remember(const void *ptr, size_t size) {
+    if (!cache_alive) return;
+
+    RegionCache *cache = &thread_cache;
+
+    // Outdated snapshot is reread anyway
+    if (!ptr || !size || cache -> generation != cache_generation.load(std::memory_order_acquire)) return;
+
+    size_t begin = (size_t) ptr;
+    size_t end = begin + size;
+
+    if (end < begin || find_region(cache, begin, end)) return;
+
+    if (reserve_region(cache)) return;
+
+    // Buffer is merged with regions it overlaps or touches, so regions stay sorted, disjoint and merged as in read_memory_map()
+    size_t index = lower_region(cache, begin);
+
+    if (index > 0 && cache -> regions[index - 1].end == begin) index--;
+
+    size_t last = index;
+
+    while (last < cache -> size && cache -> regions[last].begin <= end) {
+        if (cache -> regions[last].begin < begin) begin = cache -> regions[last].begin;
+        if (cache -> regions[last].end > end) end = cache -> regions[last].end;
+
+        last++;
+    }
+
+    MemoryRegion *region = cache -> regions + index;
+
+    if (last == index) {
+        memmove(region + 1, region, (cache -> size - index) * sizeof(MemoryRegion));
+        cache -> size++;
+    }
+    else {
+        memmove(region + 1, cache -> regions + last, (cache -> size - last) * sizeof(MemoryRegion));
+        cache -> size -= last - index - 1;
+    }
+
+    region -> begin = begin;
+    region -> end = end;
+}
+
+
+RegionCache::~RegionCache() {
+    free(regions);
+
+    regions = nullptr;
+    size = 0;
+    capacity = 0;
+    generation = 0;
+
+    if (this == &thread_cache) cache_alive = false;
+}
+
+
+static int read_memory_map(RegionCache *cache) {
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (!maps) return 1;
+
+    cache -> size = 0;
+
+    char line[512] = "";
+
+    while (fgets(line, sizeof(line), maps)) {
+        unsigned long begin = 0, end = 0;
+        char perms[5] = "";
+
+        if (sscanf(line, "%lx-%lx %4s", &begin, &end, perms) != 3) continue;
+
+        if (perms[0] != 'r' || perms[1] != 'w') continue;
+
+        // Merges neighbour regions so buffer crossing their border is still valid
+        if (cache -> size && cache -> regions[cache -> size - 1].end == begin) {
+            cache -> regions[cache -> size - 1].end = end;
+            continue;
+        }
+
+        if (reserve_region(cache)) {
+            fclose(maps);
+            return 1;
+        }
+
+        cache -> regions[cache -> size].begin = begin;
+        cache -> regions[cache -> size].end = end;
+        cache -> size++;
+    }
+
+    fclose(maps);
+
+    return 0;
+}
+
+
+static int reserve_region(RegionCache *cache) {
+    if (cache -> size < cache -> capacity) return 0;
+
+    size_t capacity = cache -> capacity ? 2 * cache -> capacity : 64;
+
+    MemoryRegion *regions = (MemoryRegion *) realloc(cache -> regions, capacity * sizeof(MemoryRegion));
+    if (!regions) return 1;
+
+    cache -> regions = regions;
+    cache -> capacity = capacity;
+
+    return 0;
+}
+
+
+static size_t lower_region(const RegionCache *cache, size_t begin) {
+    size_t left = 0, right = cache -> size;
+
+    // Regions in /proc/self/maps are sorted by address
+    while (left < right) {
+        size_t middle = left + (right - left) / 2;
+
+        if (cache -> regions[middle].end <= begin)
+            left = middle + 1;
+        else
+            right = middle;
+    }
+
+    return left;
+}
+
+
+static int find_region(const RegionCache *cache, size_t begin, size_t end) {
+    size_t left = lower_region(cache, begin);
+
+    return left < cache -> size && cache -> regions[left].begin <= begin && end <= cache -> regions[left].end;
+}
+
+#endif
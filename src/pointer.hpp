@@ -0,0 +1,41 @@
+/**
+ * \file
+ * \brief Pointer validation module header
+ * 
+ * Contains portable functions to check that memory can be read and written
+*/
+
+#ifndef POINTER_HPP
+#define POINTER_HPP
+
+#include <stddef.h>
+
+
+/**
+ * \brief Checks bad read pointer
+ * \param ptr Pointer to check
+ * \param size Pointer size
+ * \note On Linux it looks up cached snapshot of /proc/self/maps and rereads it only on miss
+ * \return Zero value means error
+*/
+int right_pointer(const void *ptr, size_t size);
+
+
+/**
+ * \brief Drops cached memory regions of every thread
+ * \note Call it when memory is unmapped (guard pages, mapped and large heap buffers), so it won't be treated as valid.
+ * Every thread rereads memory map on its next check, so don't call it on hot path. Small heap buffers stay mapped after free,
+ * so their regions are kept
+*/
+void pointer_cache_invalidate(void);
+
+
+/**
+ * \brief Adds buffer just given by allocator to cached memory regions of the calling thread
+ * \param ptr Allocated buffer
+ * \param size Buffer size
+ * \note Buffer in memory that heap has just mapped would miss the cache, so it is added instead of rereading memory map on miss
+*/
+void pointer_cache_remember(const void *ptr, size_t size);
+
+#endif
@@ -0,0 +1,459 @@
+/**
+ * \file
+ * \brief Segmented stack module source
+ * 
+ * Stack keeps a copy of the top chunk header, so #DefaultPolicy protections see it as an ordinary stack.
+ * Chunk headers are synced only when the top moves to another chunk.
+ * Chunk reference counts form a persistent list: stack holds a reference to its top chunk and every chunk holds one to the chunk below,
+ * so fork adds one reference and chunk is copied before write only while it has more than one.
+*/
+
+#include "segmented_stack.hpp"
+
+
+/**
+ * \brief If stack is invalid calls stack dump then returns an error code
+ * \param [in] stack Stack to check
+*/
+#define RETURN_ON_SEGMENT_ERROR(stack) \
+do { \
+    ErrorBits error = segmented_stack_check(stack); \
+    if (error) { \
+        if (get_log_file()) { \
+            fprintf(get_log_file(), "%s at %s(%d)\n", __PRETTY_FUNCTION__, __FILE__, __LINE__); \
+            segmented_stack_dump(stack, error, get_log_file()); \
+            fflush(get_log_file()); \
+        } \
+        return error; \
+    } \
+} while(0)
+
+
+/**
+ * \brief Allocates chunk with empty buffer
+ * \return Chunk or NULL
+*/
+static StackChunk *chunk_allocate(void);
+
+
+/**
+ * \brief Frees chunk and its buffer
+ * \param stack Stack owning the chunk
+ * \param chunk Chunk to free
+*/
+static void chunk_free(SegmentedStack *stack, StackChunk *chunk);
+
+
+/**
+ * \brief Drops reference to chunk, frees it and chunks below it that are left without references
+ * \param stack Stack owning the reference
+ * \param chunk Chunk to release (NULL does nothing)
+*/
+static void chunk_release(SegmentedStack *stack, StackChunk *chunk);
+
+
+/**
+ * \brief Replaces shared top chunk with a copy that belongs to the stack only
+ * \param stack Stack to change
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+static ErrorBits chunk_own(SegmentedStack *stack);
+
+
+/**
+ * \brief Makes chunk the top one
+ * \param stack Stack to change
+ * \param chunk New top chunk (its header must be up to date)
+*/
+static void chunk_load(SegmentedStack *stack, StackChunk *chunk);
+
+
+/**
+ * \brief Writes top chunk state from stack to the chunk header
+ * \param stack Stack to read
+*/
+static void chunk_save(SegmentedStack *stack);
+
+
+/**
+ * \brief Links spare or new chunk above the full top chunk
+ * \param stack Stack to grow
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+static ErrorBits chunk_link(SegmentedStack *stack);
+
+
+/**
+ * \brief Replaces spare chunk with the empty top one and makes previous chunk the top
+ * \param stack Stack to shrink
+*/
+static void chunk_unlink(SegmentedStack *stack);
+
+
+/**
+ * \brief Checks chunk that is not on the top
+ * \param chunk Chunk to check
+ * \param full Chunk must hold #SEGMENT_CAPACITY objects
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+static ErrorBits chunk_audit(StackChunk *chunk, bool full);
+
+
+
+
+ErrorBits segmented_stack_constructor(SegmentedStack *stack) {
+    CHECK(right_pointer(stack, sizeof(SegmentedStack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    stack -> capacity = SEGMENT_CAPACITY;
+
+    StackChunk *chunk = chunk_allocate();
+    CHECK(chunk, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+    stack -> spare = nullptr;
+    stack -> total = 0;
+    stack -> chunks = 1;
+
+    chunk_load(stack, chunk);
+
+    DefaultPolicy::Canary::set_struct(stack);
+    DefaultPolicy::Hash::set_struct(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits segmented_stack_push(SegmentedStack *stack, Object object) {
+    RETURN_ON_SEGMENT_ERROR(stack);
+
+    ErrorBits write_error = (stack -> size == stack -> capacity) ? chunk_link(stack) : chunk_own(stack);
+    if (write_error) return write_error;
+
+    stack -> data[stack -> size] = object;
+
+    DefaultPolicy::Hash::append(stack, &object, sizeof(Object));
+
+    stack -> size++;
+    stack -> total++;
+
+    if (stack -> watermark < stack -> size)
+        stack -> watermark = stack -> size;
+
+    DefaultPolicy::Hash::set_struct(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits segmented_stack_pop(SegmentedStack *stack, Object *object) {
+    CHECK(object, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    RETURN_ON_SEGMENT_ERROR(stack);
+
+    CHECK(stack -> total > 0, return ERROR_BIT_FLAGS::EMPTY_STACK);
+
+    ErrorBits own_error = chunk_own(stack);
+    if (own_error) return own_error;
+
+    stack -> size--;
+    stack -> total--;
+
+    *object = stack -> data[stack -> size];
+
+    DefaultPolicy::Hash::remove(stack, object, sizeof(Object));
+
+    DefaultPolicy::Poison::fill(stack -> data + stack -> size, 1);
+
+    if (stack -> size == 0 && stack -> top -> prev)
+        chunk_unlink(stack);
+
+    DefaultPolicy::Hash::set_struct(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits segmented_stack_fork(SegmentedStack *copy, SegmentedStack *stack) {
+    CHECK(right_pointer(copy, sizeof(SegmentedStack)) && copy != stack, return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    RETURN_ON_SEGMENT_ERROR(stack);
+
+    chunk_save(stack);
+
+    stack -> top -> refs++;
+
+    *copy = *stack;
+    copy -> spare = nullptr;
+
+    DefaultPolicy::Canary::set_struct(copy);
+    DefaultPolicy::Hash::set_struct(copy);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits segmented_stack_destructor(SegmentedStack *stack) {
+    RETURN_ON_SEGMENT_ERROR(stack);
+
+    chunk_release(stack, stack -> top);
+
+    if (stack -> spare) chunk_free(stack, stack -> spare);
+
+    stack -> data = nullptr;
+    stack -> top = nullptr;
+    stack -> spare = nullptr;
+
+    stack -> size = 0;
+    stack -> capacity = 0;
+    stack -> watermark = 0;
+    stack -> total = 0;
+    stack -> chunks = 0;
+
+    DefaultPolicy::Hash::set_struct(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits segmented_stack_check(SegmentedStack *stack) {
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    CHECK(right_pointer(stack, sizeof(SegmentedStack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    error = DefaultPolicy::Canary::check_struct(stack);
+    if (error) return error;
+
+    error = DefaultPolicy::Hash::check_struct(stack);
+    if (error) return error;
+
+    CHECK(stack -> capacity == SEGMENT_CAPACITY, return ERROR_BIT_FLAGS::INVALID_CAPACITY);
+
+    CHECK(right_pointer(stack -> top, sizeof(StackChunk)) && stack -> top -> data == stack -> data, return ERROR_BIT_FLAGS::INVALID_DATA);
+
+    CHECK(right_pointer(stack -> data, (size_t) stack -> capacity * sizeof(Object)), return ERROR_BIT_FLAGS::INVALID_DATA);
+
+    // Chunk may be shared by several stacks, so its canaries are tied to the chunk, not to the stack
+    error = DefaultPolicy::Canary::check_frame(stack -> data, stack -> capacity, (CanaryType)(stack -> top));
+    if (error) return error;
+
+    CHECK(stack -> size >= 0 && stack -> size <= stack -> watermark && stack -> watermark <= stack -> capacity, return ERROR_BIT_FLAGS::INVALID_SIZE);
+
+    // Chunks below the top are full and the top one is empty only if it is the last one
+    CHECK(stack -> chunks > 0 && stack -> total == (stack -> chunks - 1) * stack -> capacity + stack -> size, return ERROR_BIT_FLAGS::INVALID_SIZE);
+    CHECK(stack -> size > 0 || stack -> chunks == 1, return ERROR_BIT_FLAGS::INVALID_SIZE);
+
+    error |= DefaultPolicy::Poison::check_top(stack);
+
+    return error;
+}
+
+
+ErrorBits segmented_stack_audit(SegmentedStack *stack) {
+    ErrorBits error = segmented_stack_check(stack);
+
+    if (HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_SIZE) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_CAPACITY) || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_HASH_FAIL)
+            || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_POINTER) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_DATA) || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_CANARY))
+        return error;
+
+    error |= DefaultPolicy::Hash::check_buffer(stack);
+
+    error |= DefaultPolicy::Poison::check_buffer(stack);
+
+    StackSize chunks = 1;
+
+    for(StackChunk *chunk = stack -> top -> prev; chunk && chunks <= stack -> chunks; chunk = chunk -> prev, chunks++) {
+        error |= chunk_audit(chunk, true);
+
+        if (HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_DATA))
+            return error;
+    }
+
+    CHECK(chunks == stack -> chunks, error |= ERROR_BIT_FLAGS::INVALID_SIZE);
+
+    if (stack -> spare)
+        error |= chunk_audit(stack -> spare, false);
+
+    return error;
+}
+
+
+void segmented_stack_dump(SegmentedStack *stack, ErrorBits error, FILE *stream) {
+    CHECK(right_pointer(stack, sizeof(SegmentedStack)), return);
+
+    fprintf(stream, "\tSegmentedStack[%p]:\n", (void *) stack);
+
+    print_errors(error, stream);
+
+    fprintf(stream, "\tChunk capacity: %llu\n\tChunks: %llu\n\tSize: %llu\n", stack -> capacity, stack -> chunks, stack -> total);
+
+    if (DefaultPolicy::Hash::ENABLED)
+        fprintf(stream, "\tTop chunk hash: %0llx\n\tStruct hash: %0llx\n", stack -> buffer_hash, stack -> struct_hash);
+
+    fprintf(stream, "\tSpare chunk[%p]\n", (void *) stack -> spare);
+
+    if (HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_DATA) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_CAPACITY)
+            || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_HASH_FAIL) || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_CANARY)) {
+        fputc('\n', stream);
+        return;
+    }
+
+    // Objects are numbered from the bottom of the stack
+    StackSize index = stack -> total - stack -> size;
+
+    for(StackChunk *chunk = stack -> top; chunk && right_pointer(chunk, sizeof(StackChunk)); chunk = chunk -> prev) {
+        StackSize watermark = (chunk == stack -> top) ? stack -> watermark : chunk -> watermark;
+
+        fprintf(stream, "\tChunk[%p] Data[%p] References: %u\n", (void *) chunk, (void *) chunk -> data, chunk -> refs);
+
+        for(StackSize i = 0; i < watermark; i++) {
+            fprintf(stream, "\t\t[%03lld] ", index + i);
+
+            print_object(chunk -> data + i, stream);
+
+            if (is_poison(chunk -> data + i)) fprintf(stream, " (POISON VALUE)");
+
+            fputc('\n', stream);
+        }
+
+        if (watermark < stack -> capacity)
+            fprintf(stream, "\t\t[%03lld - %03lld] (UNTOUCHED)\n", index + watermark, index + stack -> capacity - 1);
+
+        index -= stack -> capacity;
+    }
+
+    fputc('\n', stream);
+}
+
+
+static StackChunk *chunk_allocate(void) {
+    StackChunk *chunk = (StackChunk *) stack_allocate(sizeof(StackChunk));
+    CHECK(chunk, return NULL);
+
+    *chunk = StackChunk();
+
+    // Chunk can be shared by forks and doesn't know its stack, so guard page fault is only logged
+    chunk -> data = buffer_allocate<Object, DefaultPolicy>(SEGMENT_CAPACITY, (CanaryType)(chunk), NULL);
+    CHECK(chunk -> data, stack_deallocate(chunk, sizeof(StackChunk)); return NULL);
+
+    chunk -> hash = hash_bytes(chunk -> data, 0);
+
+    return chunk;
+}
+
+
+static void chunk_free(SegmentedStack *stack, StackChunk *chunk) {
+    buffer_free<Object, DefaultPolicy>(chunk -> data, SEGMENT_CAPACITY);
+    stack_deallocate(chunk, sizeof(StackChunk));
+}
+
+
+static void chunk_release(SegmentedStack *stack, StackChunk *chunk) {
+    while (chunk && --chunk -> refs == 0) {
+        StackChunk *prev = chunk -> prev;
+        chunk_free(stack, chunk);
+        chunk = prev;
+    }
+}
+
+
+static ErrorBits chunk_own(SegmentedStack *stack) {
+    StackChunk *shared = stack -> top;
+
+    if (shared -> refs == 1) return ERROR_BIT_FLAGS::STACK_OK;
+
+    StackChunk *chunk = chunk_allocate();
+    CHECK(chunk, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+    // Only live objects are copied, slots above them are untouched in the new buffer
+    memcpy(chunk -> data, stack -> data, (size_t) stack -> size * sizeof(Object));
+
+    chunk -> prev = shared -> prev;
+    chunk -> size = stack -> size;
+    chunk -> watermark = stack -> size;
+    chunk -> hash = stack -> buffer_hash;
+
+    if (chunk -> prev) chunk -> prev -> refs++;
+
+    chunk_release(stack, shared);
+    chunk_load(stack, chunk);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+static void chunk_load(SegmentedStack *stack, StackChunk *chunk) {
+    stack -> top = chunk;
+    stack -> data = chunk -> data;
+    stack -> size = chunk -> size;
+    stack -> watermark = chunk -> watermark;
+    stack -> buffer_hash = chunk -> hash;
+}
+
+
+static void chunk_save(SegmentedStack *stack) {
+    // Shared chunk isn't written, its header is already up to date
+    if (stack -> top -> refs > 1) return;
+
+    stack -> top -> size = stack -> size;
+    stack -> top -> watermark = stack -> watermark;
+    stack -> top -> hash = stack -> buffer_hash;
+}
+
+
+static ErrorBits chunk_link(SegmentedStack *stack) {
+    StackChunk *chunk = stack -> spare;
+
+    if (chunk)
+        stack -> spare = nullptr;
+    else {
+        chunk = chunk_allocate();
+        CHECK(chunk, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+    }
+
+    chunk_save(stack);
+
+    chunk -> prev = stack -> top;
+    stack -> chunks++;
+
+    chunk_load(stack, chunk);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+static void chunk_unlink(SegmentedStack *stack) {
+    StackChunk *chunk = stack -> top;
+
+    chunk_save(stack);
+
+    if (stack -> spare) chunk_free(stack, stack -> spare);
+
+    stack -> spare = chunk;
+    stack -> chunks--;
+
+    chunk_load(stack, chunk -> prev);
+
+    chunk -> prev = nullptr;
+}
+
+
+static ErrorBits chunk_audit(StackChunk *chunk, bool full) {
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    CHECK(right_pointer(chunk, sizeof(StackChunk)), return ERROR_BIT_FLAGS::INVALID_DATA);
+    CHECK(right_pointer(chunk -> data, SEGMENT_CAPACITY * sizeof(Object)), return ERROR_BIT_FLAGS::INVALID_DATA);
+
+    error |= DefaultPolicy::Canary::check_frame(chunk -> data, SEGMENT_CAPACITY, (CanaryType)(chunk));
+
+    CHECK(chunk -> refs > 0, error |= ERROR_BIT_FLAGS::INVALID_DATA);
+
+    CHECK(chunk -> size == (full ? SEGMENT_CAPACITY : 0) && chunk -> watermark >= chunk -> size && chunk -> watermark <= SEGMENT_CAPACITY,
+          return error | ERROR_BIT_FLAGS::INVALID_SIZE);
+
+    if (DefaultPolicy::Hash::ENABLED)
+        CHECK(hash_bytes(chunk -> data, (size_t) chunk -> size * sizeof(Object)) == chunk -> hash, error |= ERROR_BIT_FLAGS::BUFFER_HASH_FAIL);
+
+    CHECK(count_poison(chunk -> data, 0, chunk -> size) == 0, error |= ERROR_BIT_FLAGS::UNEXP_POISON_VAL);
+    CHECK(count_poison(chunk -> data, chunk -> size, chunk -> watermark) == chunk -> watermark - chunk -> size, error |= ERROR_BIT_FLAGS::UNEXP_NORMAL_VAL);
+
+    return error;
+}
@@ -0,0 +1,128 @@
+/**
+ * \file
+ * \brief Segmented stack module header
+ *
+ * Contains stack of #Object stored in a chain of fixed-size chunks, so push and pop never copy existing objects.
+ * Chunks are reference counted and never change while shared, so forked stacks share them and copy only the chunk they write to
+*/
+
+#ifndef SEGMENTED_STACK_HPP
+#define SEGMENTED_STACK_HPP
+
+#include "stack.hpp"
+
+
+#define SEGMENT_CAPACITY 1024 ///< Number of objects in one chunk
+
+
+/// Chunk of segmented stack
+typedef struct StackChunk {
+    struct StackChunk *prev = nullptr; ///< Chunk below this one
+    Object *data = nullptr;            ///< Buffer of #SEGMENT_CAPACITY objects framed with canaries equal to chunk address
+    unsigned refs = 1;                 ///< Number of stacks and chunks pointing at this chunk
+    StackSize size = 0;                ///< Number of objects in the chunk
+    StackSize watermark = 0;           ///< Slots after this index have never been written since allocation
+    HashType hash = 0;                 ///< Hash of the objects in the chunk
+} StackChunk;
+
+
+/**
+ * \brief Structure for holding segmented stack
+ * \note Fields from data to watermark and buffer_hash describe the top chunk, so #DefaultPolicy protections work on it the way they work on Stack.
+ * Header of the top chunk is updated only when another chunk becomes the top.
+*/
+typedef struct {
+    CanaryType canary_begin = 0;
+
+    Object *data = nullptr;      ///< Buffer of the top chunk
+    StackSize size = 0;          ///< Number of objects in the top chunk
+    StackSize capacity = 0;      ///< Capacity of every chunk
+    StackSize watermark = 0;     ///< Watermark of the top chunk
+
+    StackChunk *top = nullptr;   ///< Header of the top chunk
+    StackChunk *spare = nullptr; ///< Empty chunk kept after shrink so push at the chunk border doesn't allocate
+    StackSize total = 0;         ///< Number of objects in all chunks
+    StackSize chunks = 0;        ///< Number of linked chunks
+
+    HashType struct_hash = 0;
+    HashType buffer_hash = 0;    ///< Hash of the objects in the top chunk
+
+    CanaryType canary_end = 0;
+} SegmentedStack;
+
+
+/**
+ * \brief Constructs segmented stack
+ * \param stack This stack will be filled
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits segmented_stack_constructor(SegmentedStack *stack);
+
+
+/**
+ * \brief Adds object to stack
+ * \param stack This stack will be pushed
+ * \param object This object will be added to the top of stack
+ * \note Full top chunk gets a new chunk linked above it, objects are never copied
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits segmented_stack_push(SegmentedStack *stack, Object object);
+
+
+/**
+ * \brief Pops top object from stack
+ * \param stack This stack will be popped
+ * \param object Value of popped object will be written to this pointer
+ * \note Emptied top chunk becomes the spare one, previous spare chunk is freed
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits segmented_stack_pop(SegmentedStack *stack, Object *object);
+
+
+/**
+ * \brief Makes a copy of stack that shares all its chunks
+ * \param copy This stack will be filled (it must not be constructed)
+ * \param stack Stack to copy
+ * \note Takes O(1) time. Shared chunk is copied when either stack writes to it, so each write after fork copies
+ * at most one chunk. Copy has its own canaries and structure hash
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits segmented_stack_fork(SegmentedStack *copy, SegmentedStack *stack);
+
+
+/**
+ * \brief Destructs segmented stack
+ * \param stack This stack will be destructed
+ * \note Chunks shared with forked stacks stay alive until their last stack is destructed
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits segmented_stack_destructor(SegmentedStack *stack);
+
+
+/**
+ * \brief Fast segmented stack verificator
+ * \param stack Stack to check
+ * \note Visits the top chunk only, so it takes O(1) time
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits segmented_stack_check(SegmentedStack *stack);
+
+
+/**
+ * \brief Full segmented stack verificator
+ * \param stack Stack to check
+ * \note Does everything segmented_stack_check() does, also rehashes and scans every chunk
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits segmented_stack_audit(SegmentedStack *stack);
+
+
+/**
+ * \brief Prints stack content
+ * \param stack This stack will printed
+ * \param error This error code will be printed
+ * \param stream File to dump in
+*/
+void segmented_stack_dump(SegmentedStack *stack, ErrorBits error, FILE *stream);
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * \file
+ * \brief Snapshot file module source
+ *
+ * Snapshot buffer is mapped over the beginning of stack reservation, so the rest of reservation stays anonymous
+ * and the stack grows past the file end the same way mapped stack does. Windows has no such overlay, files aren't opened there.
+*/
+
+#include <errno.h>
+#include "snapshot.hpp"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+/**
+ * \brief Returns page size
+ * \return Page size
+*/
+static size_t page_size(void);
+
+
+
+
+int snapshot_open(const char *path, unsigned mode) {
+    #ifdef _WIN32
+        return -1;
+    #else
+        if (!path) return -1;
+
+        int flags = (mode == SNAPSHOT_READ) ? O_RDONLY : O_RDWR;
+
+        if (mode == SNAPSHOT_CREATE) flags |= O_CREAT | O_TRUNC;
+
+        return open(path, flags | O_CLOEXEC, 0644);
+    #endif
+}
+
+
+void snapshot_close(int file) {
+    #ifndef _WIN32
+        if (file >= 0) close(file);
+    #endif
+}
+
+
+bool snapshot_read(int file, size_t offset, void *buffer, size_t size) {
+    #ifdef _WIN32
+        return false;
+    #else
+        char *bytes = (char *) buffer;
+
+        while (size > 0) {
+            ssize_t done = pread(file, bytes, size, (off_t) offset);
+
+            if (done < 0 && errno == EINTR) continue;
+            if (done <= 0) return false;
+
+            bytes += done;
+            offset += (size_t) done;
+            size -= (size_t) done;
+        }
+
+        return true;
+    #endif
+}
+
+
+bool snapshot_write(int file, size_t offset, const void *buffer, size_t size) {
+    #ifdef _WIN32
+        return false;
+    #else
+        const char *bytes = (const char *) buffer;
+
+        while (size > 0) {
+            ssize_t done = pwrite(file, bytes, size, (off_t) offset);
+
+            if (done < 0 && errno == EINTR) continue;
+            if (done <= 0) return false;
+
+            bytes += done;
+            offset += (size_t) done;
+            size -= (size_t) done;
+        }
+
+        return true;
+    #endif
+}
+
+
+size_t snapshot_size(int file) {
+    #ifdef _WIN32
+        return 0;
+    #else
+        struct stat info = {};
+
+        if (fstat(file, &info) || info.st_size < 0) return 0;
+
+        return (size_t) info.st_size;
+    #endif
+}
+
+
+bool snapshot_extend(int file, size_t size) {
+    #ifdef _WIN32
+        return false;
+    #else
+        if (snapshot_size(file) >= size) return true;
+
+        return ftruncate(file, (off_t) size) == 0;
+    #endif
+}
+
+
+bool snapshot_map(void *ptr, int file, size_t offset, size_t size, bool shared) {
+    #ifdef _WIN32
+        return false;
+    #else
+        size_t page = page_size();
+
+        size = (size + page - 1) / page * page;
+
+        if (!size) return true;
+
+        void *mapped = mmap(ptr, size, PROT_READ | PROT_WRITE, ((shared) ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED, file, (off_t) offset);
+
+        return mapped == ptr;
+    #endif
+}
+
+
+bool snapshot_sync(int file, void *ptr, size_t size) {
+    #ifdef _WIN32
+        return false;
+    #else
+        if (ptr && size) {
+            size_t page = page_size();
+            size_t begin = (size_t) ptr / page * page;
+
+            if (msync((void *) begin, (size_t) ptr + size - begin, MS_SYNC)) return false;
+        }
+
+        return fdatasync(file) == 0;
+    #endif
+}
+
+
+static size_t page_size(void) {
+    #ifdef _WIN32
+        return 4096;
+    #else
+        return (size_t) sysconf(_SC_PAGESIZE);
+    #endif
+}
@@ -0,0 +1,102 @@
+/**
+ * \file
+ * \brief Snapshot file module header
+ *
+ * File operations behind stack_save(), stack_load() and stack_sync(). Buffer lies in the file the same way
+ * it lies in memory, so it is mapped instead of parsed and restart cost is the page faults of its first touch.
+*/
+
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <stddef.h>
+
+
+#define SNAPSHOT_DATA_OFFSET 65536 ///< Offset of buffer in snapshot file (multiple of any page size, header is before it)
+
+
+/// How snapshot file is opened
+enum SNAPSHOT_MODES {
+    SNAPSHOT_READ   = 0, ///< Read only
+    SNAPSHOT_WRITE  = 1, ///< Read and write existing file
+    SNAPSHOT_CREATE = 2, ///< Create file or truncate existing one
+};
+
+
+/**
+ * \brief Opens snapshot file
+ * \param path File path
+ * \param mode Open mode (see #SNAPSHOT_MODES)
+ * \return File descriptor or -1
+*/
+int snapshot_open(const char *path, unsigned mode);
+
+
+/**
+ * \brief Closes snapshot file
+ * \param file File descriptor (negative does nothing)
+*/
+void snapshot_close(int file);
+
+
+/**
+ * \brief Reads bytes from file
+ * \param file File descriptor
+ * \param offset Offset in file
+ * \param buffer Bytes will be read here
+ * \param size Number of bytes
+ * \return True if all bytes are read
+*/
+bool snapshot_read(int file, size_t offset, void *buffer, size_t size);
+
+
+/**
+ * \brief Writes bytes to file
+ * \param file File descriptor
+ * \param offset Offset in file
+ * \param buffer Bytes to write
+ * \param size Number of bytes
+ * \return True if all bytes are written
+*/
+bool snapshot_write(int file, size_t offset, const void *buffer, size_t size);
+
+
+/**
+ * \brief Returns file size
+ * \param file File descriptor
+ * \return Size in bytes (0 on fail)
+*/
+size_t snapshot_size(int file);
+
+
+/**
+ * \brief Extends file with a hole, so it takes no disk space until written
+ * \param file File descriptor
+ * \param size Minimum file size
+ * \return True on success (larger file is left as is)
+*/
+bool snapshot_extend(int file, size_t size);
+
+
+/**
+ * \brief Maps file over the beginning of region reserved with map_reserve()
+ * \param ptr Page-aligned beginning of the region
+ * \param file File descriptor
+ * \param offset Page-aligned offset in file
+ * \param size Number of bytes to map (rounded up to pages)
+ * \param shared Writes reach the file, otherwise pages are copied on write
+ * \return True on success
+*/
+bool snapshot_map(void *ptr, int file, size_t offset, size_t size, bool shared);
+
+
+/**
+ * \brief Writes mapped pages and file metadata to disk
+ * \param file File descriptor
+ * \param ptr Mapped bytes to write (NULL - file only)
+ * \param size Number of mapped bytes
+ * \return True on success
+*/
+bool snapshot_sync(int file, void *ptr, size_t size);
+
+#endif
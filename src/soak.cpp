@@ -0,0 +1,463 @@
+/**
+ * \file
+ * \brief Soak test source
+ *
+ * Every thread drives several stacks with random push, pop and burst operations for the configured time.
+ * Each stack has a reference vector, popped values and audited buffers are compared with it.
+ * Latencies go to log-linear histograms like HDR histogram ones: each power of two is split into equal buckets.
+ *
+ * Usage: "soak.exe [config file] [key=value ...]", see soak.cfg for keys.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "stack.hpp"
+#include "logs.hpp"
+
+
+#define HISTOGRAM_SUB_BITS 5 ///< Histogram keeps this many significant bits of latency (about 3% error)
+#define HISTOGRAM_BUCKETS 1024 ///< Enough buckets for any 64-bit latency
+
+
+/// Soak test configuration
+typedef struct {
+    unsigned threads = 4;          ///< Number of threads
+    double seconds = 10;           ///< Duration
+    unsigned stacks = 16;          ///< Number of stacks of each thread
+    unsigned push = 55;            ///< Weight of single pushes
+    unsigned pop = 45;             ///< Weight of single pops
+    unsigned burst = 2;            ///< Weight of push_n/pop_n bursts
+    StackSize burst_max = 4096;    ///< Maximum number of objects in one burst
+    StackSize depth_min = 0;       ///< Minimum target depth
+    StackSize depth_max = 65536;   ///< Maximum target depth
+    bool depth_log = true;         ///< Target depth is log-uniform (uniform otherwise)
+    long long phase_ops = 20000;   ///< Operations on stack before its target depth changes
+    long long audit_every = 50000; ///< Operations on stack between audits with full comparison
+    unsigned seed = 1;             ///< Random seed
+} SoakConfig;
+
+
+/// Measured operations
+enum SOAK_OPS {
+    OP_PUSH,   ///< stack_push()
+    OP_POP,    ///< stack_pop()
+    OP_PUSH_N, ///< stack_push_n()
+    OP_POP_N,  ///< stack_pop_n()
+    OP_AUDIT,  ///< stack_audit()
+    OP_COUNT,  ///< Number of operations
+};
+
+
+/// Operation names
+const char *OP_NAMES[OP_COUNT] = {"push", "pop", "push_n", "pop_n", "audit"};
+
+
+/// Log-linear latency histogram
+typedef struct {
+    std::vector<unsigned long long> counts = std::vector<unsigned long long>(HISTOGRAM_BUCKETS); ///< Number of latencies in each bucket
+    unsigned long long total = 0; ///< Number of latencies
+    unsigned long long max = 0;   ///< Maximum latency
+} Histogram;
+
+
+/// Results of one thread
+typedef struct {
+    Histogram histograms[OP_COUNT] = {}; ///< Latencies of each operation
+    unsigned long long mismatches = 0;   ///< Results that differ from reference
+    ErrorBits errors = 0;                ///< Errors returned by stack functions
+} SoakResult;
+
+
+/// Is set when time is over
+static std::atomic<bool> stop(false);
+
+
+/**
+ * \brief Reads configuration from file and key=value arguments
+ * \param [in] argc Number of arguments
+ * \param [in] argv Arguments
+ * \param [out] config Configuration
+ * \return 0 - OK, 1 - FAIL
+*/
+static int read_config(int argc, char *argv[], SoakConfig *config);
+
+
+/**
+ * \brief Sets configuration key
+ * \param [in] line Line "key = value"
+ * \param [out] config Configuration
+ * \return 0 - OK, 1 - FAIL
+*/
+static int set_config(const char *line, SoakConfig *config);
+
+
+/**
+ * \brief Drives stacks of one thread until time is over
+ * \param config Configuration
+ * \param index Thread index
+ * \param result Thread results
+*/
+static void soak_thread(const SoakConfig *config, unsigned index, SoakResult *result);
+
+
+/**
+ * \brief Returns next random number
+ * \param state Xorshift state
+ * \return Random number
+*/
+static unsigned long long next_random(unsigned long long *state);
+
+
+/**
+ * \brief Draws target depth
+ * \param config Configuration
+ * \param state Random state
+ * \return Depth
+*/
+static StackSize draw_depth(const SoakConfig *config, unsigned long long *state);
+
+
+/**
+ * \brief Adds latency to histogram
+ * \param histogram Histogram
+ * \param value Latency in nanoseconds
+*/
+static void histogram_add(Histogram *histogram, unsigned long long value);
+
+
+/**
+ * \brief Adds every latency of one histogram to another
+ * \param histogram Histogram to add to
+ * \param other Histogram to add
+*/
+static void histogram_merge(Histogram *histogram, const Histogram *other);
+
+
+/**
+ * \brief Returns latency below which given part of latencies are
+ * \param histogram Histogram
+ * \param percentile Percentile from 0 to 100
+ * \return Highest latency of the bucket
+*/
+static unsigned long long histogram_percentile(const Histogram *histogram, double percentile);
+
+
+
+
+int main(int argc, char *argv[]) {
+    SoakConfig config = {};
+
+    if (read_config(argc, argv, &config)) return 1;
+
+    open_log("soak_log.txt");
+
+    printf("%u threads, %u stacks each, %.1f s, mix push:pop:burst %u:%u:%u, depth %lld-%lld (%s)\n",
+           config.threads, config.stacks, config.seconds, config.push, config.pop, config.burst,
+           config.depth_min, config.depth_max, (config.depth_log) ? "log" : "uniform");
+
+    std::vector<SoakResult> results(config.threads);
+    std::vector<std::thread> threads;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for(unsigned t = 0; t < config.threads; t++)
+        threads.emplace_back(soak_thread, &config, t, &results[t]);
+
+    while (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < config.seconds)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    stop.store(true, std::memory_order_relaxed);
+
+    for(std::thread &thread : threads)
+        thread.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    SoakResult total = {};
+
+    for(unsigned t = 0; t < config.threads; t++) {
+        for(int op = 0; op < OP_COUNT; op++)
+            histogram_merge(&total.histograms[op], &results[t].histograms[op]);
+
+        total.mismatches += results[t].mismatches;
+        total.errors |= results[t].errors;
+    }
+
+    unsigned long long ops = 0;
+
+    printf("%-8s %12s %10s %10s %10s %10s\n", "op", "count", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+
+    for(int op = 0; op < OP_COUNT; op++) {
+        const Histogram *histogram = &total.histograms[op];
+
+        printf("%-8s %12llu %10llu %10llu %10llu %10llu\n", OP_NAMES[op], histogram -> total,
+               histogram_percentile(histogram, 50), histogram_percentile(histogram, 99),
+               histogram_percentile(histogram, 99.9), histogram -> max);
+
+        ops += histogram -> total;
+    }
+
+    printf("%.0f ops/s, %llu mismatches, errors: %llx\n", (double) ops / seconds, total.mismatches, total.errors);
+
+    close_log();
+
+    return (total.mismatches || total.errors) ? 1 : 0;
+}
+
+
+static int read_config(int argc, char *argv[], SoakConfig *config) {
+    for(int i = 1; i < argc; i++) {
+        if (strchr(argv[i], '=')) {
+            if (set_config(argv[i], config)) return 1;
+            continue;
+        }
+
+        FILE *file = fopen(argv[i], "r");
+
+        if (!file) {
+            printf("Couldn't open config file %s!\n", argv[i]);
+            return 1;
+        }
+
+        char line[256] = "";
+
+        while (fgets(line, sizeof(line), file)) {
+            char *comment = strchr(line, '#');
+            if (comment) *comment = '\0';
+
+            if (strchr(line, '=') && set_config(line, config)) {
+                fclose(file);
+                return 1;
+            }
+        }
+
+        fclose(file);
+    }
+
+    if (!config -> threads || !config -> stacks || config -> push + config -> pop + config -> burst == 0
+            || config -> depth_min < 0 || config -> depth_max < config -> depth_min || config -> burst_max < 1
+            || config -> phase_ops < 1 || config -> audit_every < 1) {
+        printf("Invalid config!\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static int set_config(const char *line, SoakConfig *config) {
+    char key[64] = "", value[64] = "";
+
+    if (sscanf(line, " %63[a-z_] = %63s", key, value) != 2) {
+        printf("Invalid config line: %s\n", line);
+        return 1;
+    }
+
+    if      (!strcmp(key, "threads"))     config -> threads = (unsigned) atoi(value);
+    else if (!strcmp(key, "seconds"))     config -> seconds = atof(value);
+    else if (!strcmp(key, "stacks"))      config -> stacks = (unsigned) atoi(value);
+    else if (!strcmp(key, "push"))        config -> push = (unsigned) atoi(value);
+    else if (!strcmp(key, "pop"))         config -> pop = (unsigned) atoi(value);
+    else if (!strcmp(key, "burst"))       config -> burst = (unsigned) atoi(value);
+    else if (!strcmp(key, "burst_max"))   config -> burst_max = atoll(value);
+    else if (!strcmp(key, "depth_min"))   config -> depth_min = atoll(value);
+    else if (!strcmp(key, "depth_max"))   config -> depth_max = atoll(value);
+    else if (!strcmp(key, "depth"))       config -> depth_log = !strcmp(value, "log");
+    else if (!strcmp(key, "phase_ops"))   config -> phase_ops = atoll(value);
+    else if (!strcmp(key, "audit_every")) config -> audit_every = atoll(value);
+    else if (!strcmp(key, "seed"))        config -> seed = (unsigned) atoi(value);
+    else {
+        printf("Unknown config key %s!\n", key);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * \brief Measures call and adds its latency to histogram
+ * \param [in] op Operation (see #SOAK_OPS)
+ * \param [in] call Call to measure, its error code is collected
+*/
+#define MEASURE(op, call) \
+do { \
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now(); \
+    result -> errors |= (call); \
+    histogram_add(&result -> histograms[op], (unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count()); \
+} while(0)
+
+
+static void soak_thread(const SoakConfig *config, unsigned index, SoakResult *result) {
+    unsigned long long state = config -> seed * 0x9E3779B97F4A7C15ull + index + 1;
+
+    StackOptions options = {};
+    options.max_capacity = config -> depth_max + config -> burst_max;
+
+    std::vector<Stack> stacks(config -> stacks);
+    std::vector<std::vector<Object>> references(config -> stacks);
+    std::vector<StackSize> targets(config -> stacks);
+    std::vector<long long> counters(config -> stacks);
+    std::vector<Object> burst((size_t) config -> burst_max);
+
+    for(unsigned s = 0; s < config -> stacks; s++) {
+        result -> errors |= stack_constructor(&stacks[s], 1, &options);
+        targets[s] = draw_depth(config, &state);
+    }
+
+    unsigned weights = config -> push + config -> pop + config -> burst;
+
+    while (!stop.load(std::memory_order_relaxed)) {
+        unsigned s = (unsigned)(next_random(&state) % config -> stacks);
+
+        Stack *stack = &stacks[s];
+        std::vector<Object> *reference = &references[s];
+
+        StackSize size = (StackSize) reference -> size();
+
+        if (++counters[s] % config -> phase_ops == 0)
+            targets[s] = draw_depth(config, &state);
+
+        unsigned choice = (unsigned)(next_random(&state) % weights);
+
+        if (choice < config -> burst) {
+            StackSize count = 1 + (StackSize)(next_random(&state) % (unsigned long long) config -> burst_max);
+
+            // Bursts go toward the target, so they cross resize thresholds both ways
+            if (size < targets[s]) {
+                for(StackSize i = 0; i < count; i++)
+                    burst[(size_t) i] = (Object) next_random(&state);
+
+                MEASURE(OP_PUSH_N, stack_push_n(stack, burst.data(), count));
+
+                reference -> insert(reference -> end(), burst.begin(), burst.begin() + count);
+            }
+            else {
+                if (count > size) count = size;
+
+                MEASURE(OP_POP_N, stack_pop_n(stack, burst.data(), count));
+
+                if (memcmp(burst.data(), reference -> data() + size - count, (size_t) count * sizeof(Object)))
+                    result -> mismatches++;
+
+                reference -> resize((size_t)(size - count));
+            }
+        }
+        else {
+            // Bigger weight pulls size toward the target
+            unsigned up = (config -> push > config -> pop) ? config -> push : config -> pop;
+            if (size >= targets[s]) up = config -> push + config -> pop - up;
+
+            if (size == 0 || choice - config -> burst < up) {
+                Object object = (Object) next_random(&state);
+
+                MEASURE(OP_PUSH, stack_push(stack, object));
+
+                reference -> push_back(object);
+            }
+            else {
+                Object object = 0;
+
+                MEASURE(OP_POP, stack_pop(stack, &object));
+
+                if (object != reference -> back()) result -> mismatches++;
+
+                reference -> pop_back();
+            }
+        }
+
+        if (counters[s] % config -> audit_every == 0) {
+            MEASURE(OP_AUDIT, stack_audit(stack));
+
+            if (stack -> size != (StackSize) reference -> size()
+                    || memcmp(stack -> data, reference -> data(), reference -> size() * sizeof(Object)))
+                result -> mismatches++;
+        }
+
+        if (result -> errors) break;
+    }
+
+    for(unsigned s = 0; s < config -> stacks; s++)
+        result -> errors |= stack_destructor(&stacks[s]);
+
+    if (result -> mismatches || result -> errors)
+        fprintf(get_log_file(), "Thread %u: %llu mismatches, errors %llx\n", index, result -> mismatches, result -> errors);
+}
+
+
+static unsigned long long next_random(unsigned long long *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+
+static StackSize draw_depth(const SoakConfig *config, unsigned long long *state) {
+    double uniform = (double)(next_random(state) >> 11) / (double)(1ull << 53);
+
+    if (!config -> depth_log)
+        return config -> depth_min + (StackSize)(uniform * (double)(config -> depth_max - config -> depth_min));
+
+    // Log-uniform depth visits every capacity class equally often
+    double low = log((double) config -> depth_min + 1), high = log((double) config -> depth_max + 1);
+
+    return (StackSize) exp(low + uniform * (high - low)) - 1;
+}
+
+
+static void histogram_add(Histogram *histogram, unsigned long long value) {
+    size_t bucket = (size_t) value;
+
+    if (value >= (1ull << HISTOGRAM_SUB_BITS)) {
+        // Values with the same highest bit share 2^(SUB_BITS - 1) buckets
+        int magnitude = 64 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+        bucket = (size_t) magnitude * (1u << (HISTOGRAM_SUB_BITS - 1)) + (size_t)(value >> magnitude);
+    }
+
+    histogram -> counts[bucket]++;
+    histogram -> total++;
+
+    if (value > histogram -> max) histogram -> max = value;
+}
+
+
+static void histogram_merge(Histogram *histogram, const Histogram *other) {
+    for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        histogram -> counts[i] += other -> counts[i];
+
+    histogram -> total += other -> total;
+
+    if (other -> max > histogram -> max) histogram -> max = other -> max;
+}
+
+
+static unsigned long long histogram_percentile(const Histogram *histogram, double percentile) {
+    if (!histogram -> total) return 0;
+
+    unsigned long long rank = (unsigned long long) ceil(percentile / 100 * (double) histogram -> total), seen = 0;
+    if (rank == 0) rank = 1;
+
+    for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram -> counts[i];
+
+        if (seen < rank) continue;
+
+        if (i < (1u << HISTOGRAM_SUB_BITS)) return i;
+
+        size_t magnitude = i / (1u << (HISTOGRAM_SUB_BITS - 1)) - 1;
+        unsigned long long top = i - magnitude * (1u << (HISTOGRAM_SUB_BITS - 1));
+        unsigned long long highest = ((top + 1) << magnitude) - 1;
+
+        return (highest < histogram -> max) ? highest : histogram -> max;
+    }
+
+    return histogram -> max;
+}
@@ -1,7 +1,18 @@
-#include <stdlib.h>
-#include <windows.h>
+/**
+ * \file
+ * \brief Stack module source
+ * 
+ * Contains hash functions, error printing, hot-path counters and Stack instantiation of BasicStack functions
+*/
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include "stack.hpp"
-#include "logs.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
 
 
 const char *ERROR_DESCRIPTION[] = {
@@ -18,388 +29,233 @@ const char *ERROR_DESCRIPTION[] = {
     "Wrong buffer hash\n",
     "Wrong struct hash\n",
     "Invalid read pointer\n",
+    "Stack overflow\n",
+    "Snapshot file failed\n",
 };
 
 
-/**
- * \brief Does some action in case of error
- * \param [in] condition Condition to check
- * \param [in] action This code will be executed if condition fails
-*/
-#define CHECK(condition, action) \
-do { \
-    if (!(condition)) { \
-        action; \
-    } \
-} while(0)
-
-
-/**
- * \brief Prints stack's content
- * \param [in] stack Stack to print
- * \param [in] error This error code will printed (see #ERROR_BIT_FLAGS and print_errors())
-*/
-#define STACK_DUMP(stack, error) \
-do { \
-    if (get_log_file()) { \
-        fprintf(get_log_file(), "%s at %s(%d)\n", __PRETTY_FUNCTION__, __FILE__, __LINE__); \
-        stack_dump(stack, error, get_log_file()); \
-    } \
-} while(0)
+const char *STATS_DESCRIPTION[] = {
+    "Pushes",
+    "Pops",
+    "Grows",
+    "Shrinks",
+    "Bytes moved",
+    "Checks",
+    "Audits",
+    "Pointer check cycles",
+    "Struct check cycles",
+    "Buffer check cycles",
+    "Poison check cycles",
+    "Buffer hash cycles",
+    "Poison scan cycles",
+};
 
 
-/**
- * \brief If stack is invalid calls stack dump then returns an error code
- * \param [in] stack Stack to check
-*/
-#define RETURN_ON_ERROR(stack) \
-do { \
-    ErrorBits error = stack_check(stack); \
-    if (error) { \
-        STACK_DUMP(stack, error); \
-        return error; \
-    } \
-} while(0)
+/// Counters of one thread, owner thread writes them without contention and others only read
+struct StatsBlock {
+    std::atomic<unsigned long long> counters[STATS_COUNT] = {};
+    std::atomic<StackSize> peak_size {0};
+    StatsBlock *next = nullptr; ///< Next block in #stats_threads list
 
+    StatsBlock();  ///< Adds block to #stats_threads list
+    ~StatsBlock(); ///< Moves counters to #stats_retired and removes block from the list
 
-/// Checks for specific error in error code (see #ERROR_BIT_FLAGS and #ErrorBits type)
-#define HAS_ERROR(bitflag, error) (bitflag & error)
-
+    StatsBlock(const StatsBlock &) = delete;
+    StatsBlock &operator=(const StatsBlock &) = delete;
+};
 
-/**
- * \brief Resizes stack
- * \param stack This stack will be resized automaticaly
- * \return Error code (see #ERROR_BIT_FLAGS)
-*/
-static ErrorBits stack_resize(Stack *stack);
 
+/// Binary dump record buffer of one thread
+struct DumpRecord {
+    char *data = nullptr; ///< Buffer
+    size_t size = 0;      ///< Buffer size
 
-/**
- * \brief Recursive function to print each bit of the number
- * \param n This number will be printed
- * \param stream File to print bin code in
-*/
-static void print_binary(ErrorBits n, FILE *stream);
+    ~DumpRecord() { free(data); } ///< Frees buffer when thread exits
+};
 
 
-/**
- * \brief Checks bad read pointer
- * \param ptr Pointer to check
- * \param size Pointer size
- * \return Zero value means error
-*/
-static int right_pointer(void *ptr, size_t size);
+/// Guards #stats_threads and #stats_retired
+static std::mutex stats_mutex;
 
-#if (PROTECT_LEVEL & HASH_PROTECT)
+/// Counters of running threads
+static StatsBlock *stats_threads = nullptr;
 
-/**
- * \brief Recalculates hash sum for current stack
- * \param stack This stack's hash sum will be updated
-*/
-static void set_hash(Stack *stack);
+/// Sum of counters of finished threads
+static StackStats stats_retired = {};
 
+/// Counters of the current thread
+static thread_local StatsBlock stats_block;
 
-/**
- * \brief Check hash sum of stack structure
- * \param stack This stack's hash sum will be checked
-*/
-static ErrorBits check_struct_hash(Stack *stack);
+/// Binary dump record buffer of the current thread
+static thread_local DumpRecord dump_buffer;
 
 
 /**
- * \brief Calculates hash sum for object
- * \param ptr Pointer to object
- * \param size Object's size
- * \return Hash sum
+ * \brief Recursive function to print each bit of the number
+ * \param n This number will be printed
+ * \param stream File to print bin code in
 */
-static HashType gnu_hash(void *ptr, size_t size);
-
-#endif
-
-
-
-
-ErrorBits stack_constructor(Stack *stack, StackSize capacity) {
-    CHECK(right_pointer(stack, sizeof(Stack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
-    CHECK(capacity > 0, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
-
-    #if (PROTECT_LEVEL & CANARY_PROTECT)
-        char *true_pointer = (char *) calloc(capacity * sizeof(Object) + 2 * sizeof(CanaryType), 1);
-        CHECK(true_pointer, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
-
-        ON_CANARY_PROTECT(*(CanaryType *)(true_pointer) = (CanaryType)(stack);)
-        ON_CANARY_PROTECT(*(CanaryType *)(true_pointer + sizeof(CanaryType) + capacity * sizeof(Object)) = (CanaryType)(stack);)
+static void print_binary(ErrorBits n, FILE *stream);
 
-        stack -> data = (Object *)(true_pointer + sizeof(CanaryType));
-    #else
-        stack -> data = (Object *)calloc(capacity, sizeof(Object));
-        CHECK(stack -> data, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
-    #endif
 
-    for(StackSize i = 0; i < capacity ; i++)
-        (stack -> data)[i] = POISON_VALUE;
-    
-    stack -> capacity = capacity;
-    stack -> size = 0;
 
-    ON_CANARY_PROTECT(stack -> canary_begin = (CanaryType)(stack);)
-    ON_CANARY_PROTECT(stack -> canary_end = (CanaryType)(stack);)
 
-    ON_HASH_PROTECT(set_hash(stack);)
+template ErrorBits stack_constructor<Object, DefaultPolicy>(Stack *stack, StackSize capacity);
+template ErrorBits stack_constructor<Object, DefaultPolicy>(Stack *stack, StackSize capacity, const StackOptions *options);
+template ErrorBits stack_push<Object, DefaultPolicy>(Stack *stack, const Object &object);
+template ErrorBits stack_push<Object, DefaultPolicy>(Stack *stack, Object &&object);
+template ErrorBits stack_pop<Object, DefaultPolicy>(Stack *stack, Object *object);
+template ErrorBits stack_push_n<Object, DefaultPolicy>(Stack *stack, const Object *objects, StackSize count);
+template ErrorBits stack_pop_n<Object, DefaultPolicy>(Stack *stack, Object *objects, StackSize count);
+template ErrorBits stack_reserve<Object, DefaultPolicy>(Stack *stack, StackSize capacity);
+template ErrorBits stack_set_protection<Object, DefaultPolicy>(Stack *stack, unsigned protection);
+template ErrorBits stack_save<Object, DefaultPolicy>(Stack *stack, const char *path);
+template ErrorBits stack_load<Object, DefaultPolicy>(Stack *stack, const char *path, const StackOptions *options);
+template ErrorBits stack_sync<Object, DefaultPolicy>(Stack *stack);
+template ErrorBits stack_destructor<Object, DefaultPolicy>(Stack *stack);
+template ErrorBits stack_check<Object, DefaultPolicy>(Stack *stack);
+template ErrorBits stack_check<Object, DefaultPolicy>(Stack *stack, bool deep);
+template ErrorBits stack_audit<Object, DefaultPolicy>(Stack *stack);
+template void stack_dump<Object, DefaultPolicy>(Stack *stack, ErrorBits error, FILE *stream);
+template void stack_dump_binary<Object, DefaultPolicy>(Stack *stack, ErrorBits error, FILE *stream);
 
-    RETURN_ON_ERROR(stack);
 
-    return ERROR_BIT_FLAGS::STACK_OK;
+void print_object(const Object *object, FILE *stream) {
+    fprintf(stream, OBJECT_TO_STR, *object);
 }
 
 
-static ErrorBits stack_resize(Stack *stack) {
-    RETURN_ON_ERROR(stack);
-
-    if (4 * stack -> size < stack -> capacity)
-        stack -> capacity /= 2;
-    
-    else if (stack -> size == stack -> capacity)
-        stack -> capacity *= 2;
-
-    else 
-        return ERROR_BIT_FLAGS::STACK_OK;
-
-    #if (PROTECT_LEVEL & CANARY_PROTECT)
-        char *true_pointer = ((char *)(stack -> data)) - sizeof(CanaryType);
-        true_pointer = (char *) realloc(true_pointer, stack -> capacity * sizeof(Object) + 2 * sizeof(CanaryType));
-        CHECK(true_pointer, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
-
-        *(CanaryType *)(true_pointer + sizeof(CanaryType) + stack -> capacity * sizeof(Object)) = (CanaryType)(stack);
-
-        stack -> data = (Object *)(true_pointer + sizeof(CanaryType));
-    #else
-        stack -> data = (Object *) realloc(stack -> data, capacity * sizeof(Object));
-        CHECK(stack -> data, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
-    #endif
-
-    for(StackSize i = stack -> size; i < stack -> capacity ; i++)
-        (stack -> data)[i] = POISON_VALUE;
-
-    ON_HASH_PROTECT(set_hash(stack);)
-
-    RETURN_ON_ERROR(stack);
+void print_errors(ErrorBits error, FILE *stream) {
+    if (error == ERROR_BIT_FLAGS::STACK_OK) {
+        fprintf(stream, "\tOk\n");
+        return;
+    }
+    else {
+        fputc('\t', stream);
+        print_binary(error, stream);
+        fputc('\n', stream);
+    }
 
-    return ERROR_BIT_FLAGS::STACK_OK;
+    for(ErrorBits i = 0; i < 16; i++) {
+        if (error & 1)
+            fprintf(stream, "\t[ERROR] %s\n", ERROR_DESCRIPTION[i]);
+        error >>= 1;
+    }
 }
 
 
-ErrorBits stack_push(Stack *stack, Object object) {
-    RETURN_ON_ERROR(stack);
-
-    (stack -> data)[(stack -> size)++] = object;
+static void print_binary(ErrorBits n, FILE *stream) {
+    ErrorBits k = 1ull << 15;
+    while(k > 0) {
+        fputc(((n & k) > 0) + '0', stream);
+        k = k >> 1;
+    }
+}
 
-    ON_HASH_PROTECT(set_hash(stack);)
 
-    RETURN_ON_ERROR(stack);
+void stats_add(int counter, unsigned long long value) {
+    std::atomic<unsigned long long> &cell = stats_block.counters[counter];
 
-    return stack_resize(stack);
+    // Only the owner thread writes, so plain load and store are enough
+    cell.store(cell.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
 }
 
 
-ErrorBits stack_pop(Stack *stack, Object *object) {
-    CHECK(object, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
-
-    RETURN_ON_ERROR(stack);
-
-    CHECK(stack -> size, return ERROR_BIT_FLAGS::EMPTY_STACK);
+void stats_peak(StackSize size) {
+    if (size > stats_block.peak_size.load(std::memory_order_relaxed))
+        stats_block.peak_size.store(size, std::memory_order_relaxed);
+}
 
-    *object = (stack -> data)[--(stack -> size)];
-    (stack -> data)[(stack -> size)] = POISON_VALUE;
 
-    ON_HASH_PROTECT(set_hash(stack);)
+void stats_stage(int counter, unsigned long long *start) {
+    unsigned long long now = stats_cycles();
 
-    RETURN_ON_ERROR(stack);
+    stats_add(counter, now - *start);
 
-    return stack_resize(stack);
+    *start = now;
 }
 
 
-ErrorBits stack_destructor(Stack *stack) {
-    RETURN_ON_ERROR(stack);
-
-    #if (PROTECT_LEVEL & CANARY_PROTECT)
-        free((char *)(stack -> data) - sizeof(CanaryType));
+unsigned long long stats_cycles(void) {
+    #if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
     #else
-        free((char *)(stack -> data));
+        return (unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
     #endif
-
-    stack -> data = NULL;
-    
-    stack -> capacity = 0;
-    stack -> size = 0;
-
-    ON_HASH_PROTECT(set_hash(stack);)
-
-    return ERROR_BIT_FLAGS::STACK_OK;
 }
 
 
-ErrorBits stack_check(Stack *stack) {
-    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
-
-    CHECK(right_pointer(stack, sizeof(Stack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
-
-    ON_CANARY_PROTECT(CHECK(stack -> canary_begin == (CanaryType)(stack) && stack -> canary_end == (CanaryType)(stack), return ERROR_BIT_FLAGS::STRUCT_CANARY);)
-
-    ON_HASH_PROTECT(CHECK(!check_struct_hash(stack), return ERROR_BIT_FLAGS::STRUCT_HASH_FAIL);)
+void stack_stats_snapshot(StackStats *stats, bool all_threads) {
+    CHECK(stats, return);
 
-    CHECK(right_pointer(stack -> data, stack -> capacity * sizeof(Object)), error += ERROR_BIT_FLAGS::INVALID_DATA; return error);
+    *stats = {};
 
-    ON_CANARY_PROTECT(char *true_pointer = ((char *)(stack -> data)) - sizeof(CanaryType);) // pointer to the real buffer start
+    if (!all_threads) {
+        for(int i = 0; i < STATS_COUNT; i++)
+            stats -> counters[i] = stats_block.counters[i].load(std::memory_order_relaxed);
 
-    ON_CANARY_PROTECT(CHECK(*(CanaryType *)(true_pointer) == (CanaryType)(stack),                                                           return ERROR_BIT_FLAGS::BUFFER_CANARY);)
-    ON_CANARY_PROTECT(CHECK(*(CanaryType *)(true_pointer + sizeof(CanaryType) + stack -> capacity * sizeof(Object)) == (CanaryType)(stack), return ERROR_BIT_FLAGS::BUFFER_CANARY);)
+        stats -> peak_size = stats_block.peak_size.load(std::memory_order_relaxed);
 
-    CHECK(stack -> capacity >= 0 && stack -> capacity <= MAX_CAPACITY_VALUE, error += ERROR_BIT_FLAGS::INVALID_CAPACITY);
-
-    CHECK(stack -> size >= 0 && stack -> size <= stack -> capacity, error += ERROR_BIT_FLAGS::INVALID_SIZE);
-
-    ON_HASH_PROTECT(CHECK(gnu_hash(stack -> data, stack -> size * sizeof(Object)) == stack -> buffer_hash, error += ERROR_BIT_FLAGS::BUFFER_HASH_FAIL);)
-
-    if (HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_SIZE) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_CAPACITY) || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_HASH_FAIL))
-        return error;
-
-    for(StackSize i = 0; i < stack -> capacity; i++) {
-        if (i < stack -> size)
-            CHECK((stack -> data)[i] != POISON_VALUE, error += ERROR_BIT_FLAGS::UNEXP_POISON_VAL; i = stack -> size);
-        else
-            CHECK((stack -> data)[i] == POISON_VALUE, error += ERROR_BIT_FLAGS::UNEXP_NORMAL_VAL; break);
-    }
-    
-    return error;
-}
-
-
-void stack_dump(Stack *stack, ErrorBits error, FILE *stream) {
-    CHECK(right_pointer(stack, sizeof(stack)), return);
-    
-    fprintf(stream, "\tStack[%p]:\n", stack);
-
-    print_errors(error, stream);
-
-    fprintf(stream, "\tCapacity: %llu\n\tSize: %llu\n", stack -> capacity, stack -> size);
-
-    ON_HASH_PROTECT(fprintf(stream, "\tBuffer hash: %0llx\n\tStruct hash: %0llx\n", stack -> buffer_hash, stack -> struct_hash);)
-
-    fprintf(stream, "\tData[%p]", stack -> data);
-    
-    if (HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_DATA) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_CAPACITY) 
-            || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_HASH_FAIL) || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_CANARY)) {
-        fputc('\n', stream);
         return;
     }
-    
-    fprintf(stream, ":\n");
 
-    char *true_pointer = ((char *)(stack -> data)) - sizeof(CanaryType);
-    fprintf(stream, "\t\tCanary: %0llx\n", *(CanaryType *) true_pointer);
+    std::lock_guard<std::mutex> lock(stats_mutex);
 
-    for(StackSize i = 0; i < stack -> capacity; i++) {
-        fprintf(stream, "\t\t[%03lld] ", i); // object index
+    *stats = stats_retired;
 
-        fprintf(stream, OBJECT_TO_STR, (stack -> data)[i]); // print value function (possible macros)
+    for(StatsBlock *block = stats_threads; block; block = block -> next) {
+        for(int i = 0; i < STATS_COUNT; i++)
+            stats -> counters[i] += block -> counters[i].load(std::memory_order_relaxed);
 
-        if ((stack -> data)[i] == POISON_VALUE) fprintf(stream, " (POISON VALUE)"); // poison value warning
-            
-        fputc('\n', stream); // new line
+        StackSize peak_size = block -> peak_size.load(std::memory_order_relaxed);
+        if (peak_size > stats -> peak_size) stats -> peak_size = peak_size;
     }
-
-    fprintf(stream, "\t\tCanary: %0llx\n", *(CanaryType *) (true_pointer + sizeof(CanaryType) + stack -> capacity * sizeof(Object)));
-
-    fputc('\n', stream);
 }
 
 
-void print_errors(ErrorBits error, FILE *stream) {
-    if (error == ERROR_BIT_FLAGS::STACK_OK) {
-        fprintf(stream, "\tOk\n");
-        return;
-    }
-    else {
-        fputc('\t', stream);
-        print_binary(error, stream);
-        fputc('\n', stream);
-    }
+void stack_stats_dump(const StackStats *stats, FILE *stream) {
+    CHECK(stats && stream, return);
 
-    for(ErrorBits i = 0; i < 16; i++) {
-        if (error & 1)
-            fprintf(stream, "\t[ERROR] %s\n", ERROR_DESCRIPTION[i]);
-        error >>= 1;
-    }
-}
+    fprintf(stream, "\tStats:\n");
 
+    for(int i = 0; i < STATS_COUNT; i++)
+        fprintf(stream, "\t\t%s: %llu\n", STATS_DESCRIPTION[i], stats -> counters[i]);
 
-static void print_binary(ErrorBits n, FILE *stream) {
-    ErrorBits k = 1ull << 15;
-    while(k > 0) {
-        fputc(((n & k) > 0) + '0', stream);
-        k = k >> 1;
-    }
+    fprintf(stream, "\t\tPeak size: %lld\n", stats -> peak_size);
 }
 
 
-#if (PROTECT_LEVEL & HASH_PROTECT)
-
-static ErrorBits check_struct_hash(Stack *stack) {
-    CHECK(right_pointer(stack, sizeof(Stack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
-
-    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+char *dump_record(size_t size) {
+    if (size <= dump_buffer.size) return dump_buffer.data;
 
-    HashType h1 = stack -> struct_hash, h2 = stack -> buffer_hash;
+    char *data = (char *) realloc(dump_buffer.data, size);
+    CHECK(data, return NULL);
 
-    stack -> struct_hash = 0;
-    stack -> buffer_hash = 0;
+    dump_buffer.data = data;
+    dump_buffer.size = size;
 
-    CHECK(gnu_hash(stack, sizeof(Stack)) == h1, error += ERROR_BIT_FLAGS::STRUCT_HASH_FAIL);
-
-    stack -> struct_hash = h1;
-    stack -> buffer_hash = h2;
-
-    return error;
+    return data;
 }
 
 
-static void set_hash(Stack *stack) {
-    CHECK(stack, return);
+StatsBlock::StatsBlock() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
 
-    stack -> struct_hash = 0;
-    stack -> buffer_hash = 0;
-
-    stack -> struct_hash = gnu_hash(stack, sizeof(Stack));
-    stack -> buffer_hash = gnu_hash(stack -> data, stack -> size * sizeof(Object));
+    next = stats_threads;
+    stats_threads = this;
 }
 
 
-static HashType gnu_hash(void *ptr, size_t size) {
-    HashType hash = 5381;
+StatsBlock::~StatsBlock() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
 
-    for(size_t i = 0; i < size; i++)
-        hash = hash * 33 + ((char *)(ptr))[i];
+    for(int i = 0; i < STATS_COUNT; i++)
+        stats_retired.counters[i] += counters[i].load(std::memory_order_relaxed);
 
-    return hash;
-}
+    if (peak_size > stats_retired.peak_size) stats_retired.peak_size = peak_size;
 
-#endif
-
-static int right_pointer(void *ptr, size_t size) {
-    if (!ptr) return 0;
-
-    MEMORY_BASIC_INFORMATION info = {};
-
-    if (VirtualQuery(ptr, &info, sizeof(info))) {
-        if (info.Protect & (PAGE_GUARD | PAGE_NOACCESS)) return 0;
+    StatsBlock **link = &stats_threads;
+    while (*link != this) link = &(*link) -> next;
 
-        DWORD mask = PAGE_READWRITE;
-
-        return info.Protect & mask;
-    }
-
-    return 0;
+    *link = next;
 }
-
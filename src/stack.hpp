@@ -1,12 +1,41 @@
+/**
+ * \file
+ * \brief Stack module header
+ *
+ * Contains BasicStack template with its protection policies and Stack instantiation used by the rest of the program
+*/
+
+#ifndef STACK_HPP
+#define STACK_HPP
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include "logs.hpp"
+#include "pointer.hpp"
+#include "allocator.hpp"
+#include "guard.hpp"
+#include "hash.hpp"
+#include "verifier.hpp"
+#include "snapshot.hpp"
 
 #define POISON_VALUE 0xC0FFEE
-#define MAX_CAPACITY_VALUE 100000
+#define DUMP_MAGIC 0x444B5453 ///< "STKD" at the beginning of every binary dump
+#define DUMP_VERSION 2 ///< Binary dump format version
+#define SNAPSHOT_MAGIC 0x534B5453 ///< "STKS" at the beginning of every snapshot file
+#define SNAPSHOT_VERSION 1 ///< Snapshot file format version
+#define MAX_CAPACITY_VALUE 100000 ///< Default maximum capacity (see StackOptions)
+#define SMALL_CAPACITY 16 ///< Stacks of at most this capacity keep objects inside the structure
+#define SMALL_MAX_BYTES 256 ///< Objects are kept inside the structure only if #SMALL_CAPACITY of them fit in this number of bytes
 #define OBJECT_TO_STR "%i"
 
 #define CANARY_PROTECT 1
 #define HASH_PROTECT 2
-#define PROTECT_LEVEL 3
+#define GUARD_PROTECT 4 ///< Buffer is placed between guard pages instead of canaries (takes precedence over #CANARY_PROTECT)
+#define RUNTIME_PROTECT 8 ///< Each stack turns canaries and hashes on and off at runtime, other bits give default (see stack_set_protection())
 
 
 #ifndef PROTECT_LEVEL
@@ -17,14 +46,21 @@
 #if (PROTECT_LEVEL & CANARY_PROTECT)
     #define ON_CANARY_PROTECT(...) __VA_ARGS__
 #else
-    #define ON_CANARY_PROTECT(...) 
+    #define ON_CANARY_PROTECT(...)
 #endif
 
 
 #if (PROTECT_LEVEL & HASH_PROTECT)
     #define ON_HASH_PROTECT(...) __VA_ARGS__
 #else
-    #define ON_HASH_PROTECT(...) 
+    #define ON_HASH_PROTECT(...)
+#endif
+
+
+#ifdef STACK_STATS
+    #define ON_STACK_STATS(...) __VA_ARGS__
+#else
+    #define ON_STACK_STATS(...)
 #endif
 
 
@@ -32,22 +68,6 @@ typedef int Object; ///< Stack object type
 typedef long long StackSize; ///< Type for stack size and capacity
 typedef unsigned long long ErrorBits; ///< Type for holding error codes
 typedef unsigned long long CanaryType; ///< Type for holding canary value
-typedef unsigned long long HashType; ///< Type for holding hash sum
-
-
-/// Structure for holding stack
-typedef struct {
-    ON_CANARY_PROTECT(CanaryType canary_begin = 0;)
-
-    Object *data = NULL;
-    StackSize size = 0;
-    StackSize capacity = 0;
-
-    ON_HASH_PROTECT(HashType struct_hash = 0;)
-    ON_HASH_PROTECT(HashType buffer_hash = 0;)
-
-    ON_CANARY_PROTECT(CanaryType canary_end = 0;)
-} Stack;
 
 
 /// Error bit codes
@@ -66,6 +86,529 @@ enum ERROR_BIT_FLAGS {
     BUFFER_HASH_FAIL = 1ull<<10, ///< Wrong buffer hash sum
     STRUCT_HASH_FAIL = 1ull<<11, ///< Wrong stack hash sum
     INVALID_POINTER  = 1ull<<12, ///< Invalid read pointer
+    STACK_OVERFLOW   = 1ull<<13, ///< Stack can't grow beyond its maximum capacity
+    SNAPSHOT_FAIL    = 1ull<<14, ///< Snapshot file can't be read, written or mapped
+};
+
+
+/// Hot-path counters (see StackStats)
+enum STATS_COUNTERS {
+    STATS_PUSHES,          ///< Objects pushed
+    STATS_POPS,            ///< Objects popped
+    STATS_GROWS,           ///< Resizes that increased capacity
+    STATS_SHRINKS,         ///< Resizes that decreased capacity
+    STATS_BYTES_MOVED,     ///< Bytes of objects moved to another buffer by resize
+    STATS_CHECKS,          ///< stack_check() calls
+    STATS_AUDITS,          ///< stack_audit() calls
+    STATS_CYCLES_POINTER,  ///< Cycles spent validating pointers
+    STATS_CYCLES_STRUCT,   ///< Cycles spent checking structure canaries and hash
+    STATS_CYCLES_BUFFER,   ///< Cycles spent checking buffer canaries and sizes
+    STATS_CYCLES_POISON,   ///< Cycles spent checking poison around the top
+    STATS_CYCLES_HASH,     ///< Cycles spent rehashing buffer in stack_audit()
+    STATS_CYCLES_SCAN,     ///< Cycles spent scanning poison in stack_audit()
+    STATS_COUNT,           ///< Number of counters
+};
+
+
+/// Snapshot of hot-path counters
+typedef struct {
+    unsigned long long counters[STATS_COUNT] = {}; ///< Values of #STATS_COUNTERS
+    StackSize peak_size = 0;                       ///< Largest size any stack reached
+} StackStats;
+
+
+/// Stack storage flags (see StackOptions)
+enum STACK_FLAGS {
+    STACK_MAPPED     = 1u,    ///< Buffer is reserved with map_reserve() for maximum capacity, so it grows and shrinks in place
+    STACK_HUGE_PAGES = 1u<<1, ///< Mapped buffer is backed with transparent huge pages
+    STACK_VERIFIED   = 1u<<2, ///< Stack is audited by background verifier and checks only O(1) invariants itself (see verifier_start())
+    STACK_FILE       = 1u<<3, ///< Mapped buffer shares pages with snapshot file, stack_sync() makes it a checkpoint (see StackOptions)
+};
+
+
+/// Stack configuration given to constructor
+typedef struct {
+    StackSize max_capacity = MAX_CAPACITY_VALUE; ///< Stack never grows beyond this capacity
+    unsigned flags = 0;                          ///< Combination of #STACK_FLAGS
+    unsigned protection = PROTECT_LEVEL & (CANARY_PROTECT | HASH_PROTECT); ///< Protections selected at runtime (see StackPolicy::RUNTIME)
+    const char *path = NULL;                     ///< Snapshot file created for stack with #STACK_FILE flag
+} StackOptions;
+
+
+/**
+ * \brief Header of binary stack dump
+ * \note Header is followed by payload_bytes of payload: size objects, then runs of [size, watermark) slots.
+ * Each run is poison slots count and raw slots count (both #StackSize) followed by raw slots.
+*/
+typedef struct {
+    unsigned magic = DUMP_MAGIC;          ///< #DUMP_MAGIC
+    unsigned version = DUMP_VERSION;      ///< #DUMP_VERSION
+    unsigned object_size = 0;             ///< Size of stack object
+    unsigned protection = 0;              ///< #CANARY_PROTECT, #HASH_PROTECT and #GUARD_PROTECT bits of stack policy
+    unsigned hash_engine = 0;             ///< Engine of the hashes (see #HASH_ENGINES)
+    unsigned flags = 0;                   ///< Stack flags (see #STACK_FLAGS)
+    unsigned has_buffer = 0;              ///< Buffer is dumped (it isn't when stack structure is broken)
+    ErrorBits error = 0;                  ///< Error code passed to dump
+    unsigned long long stack_address = 0; ///< Address of the stack structure
+    unsigned long long data_address = 0;  ///< Address of the buffer
+    StackSize capacity = 0;
+    StackSize max_capacity = 0;
+    StackSize size = 0;
+    StackSize watermark = 0;
+    HashType struct_hash = 0;
+    HashType buffer_hash = 0;
+    CanaryType struct_canary[2] = {};     ///< Canaries around the structure
+    CanaryType buffer_canary[2] = {};     ///< Canaries around the buffer
+    unsigned long long payload_bytes = 0; ///< Number of bytes after header
+} DumpHeader;
+
+
+/**
+ * \brief Header of snapshot file
+ * \note Buffer follows at #SNAPSHOT_DATA_OFFSET laid out as in memory: buffer_front bytes, then watermark slots.
+ * Header has no padding, so its hash covers fields only
+*/
+typedef struct {
+    unsigned magic = SNAPSHOT_MAGIC;       ///< #SNAPSHOT_MAGIC
+    unsigned version = SNAPSHOT_VERSION;   ///< #SNAPSHOT_VERSION
+    unsigned object_size = 0;              ///< Size of stack object
+    unsigned hash_engine = 0;              ///< Engine of the hashes (see #HASH_ENGINES)
+    unsigned long long buffer_front = 0;   ///< Bytes before the first object (see buffer_front())
+    StackSize capacity = 0;
+    StackSize max_capacity = 0;
+    StackSize min_capacity = 0;
+    StackSize size = 0;
+    StackSize watermark = 0;
+    HashType buffer_hash = 0;              ///< Hash of size objects
+    HashType struct_hash = 0;              ///< Hash of this header with zero struct_hash (stack structure hash covers addresses, so it isn't saved)
+} SnapshotHeader;
+
+
+/**
+ * \brief Does some action in case of error
+ * \param [in] condition Condition to check
+ * \param [in] action This code will be executed if condition fails
+*/
+#define CHECK(condition, action) \
+do { \
+    if (!(condition)) { \
+        action; \
+    } \
+} while(0)
+
+
+/**
+ * \brief Prints stack's content
+ * \param [in] stack Stack to print
+ * \param [in] error This error code will printed (see #ERROR_BIT_FLAGS and print_errors())
+ * \note If dump file is opened (see open_dump()) stack is dumped there in binary format and log (if it is opened) gets one line about it
+*/
+#define STACK_DUMP(stack, error) \
+do { \
+    if (get_dump_file()) { \
+        stack_dump_binary(stack, error, get_dump_file()); \
+        if (get_log_file()) { \
+            fprintf(get_log_file(), "%s at %s(%d)\n\tBinary dump is written\n\n", __PRETTY_FUNCTION__, __FILE__, __LINE__); \
+            fflush(get_log_file()); \
+        } \
+    } \
+    else if (get_log_file()) { \
+        fprintf(get_log_file(), "%s at %s(%d)\n", __PRETTY_FUNCTION__, __FILE__, __LINE__); \
+        stack_dump(stack, error, get_log_file()); \
+        fflush(get_log_file()); \
+    } \
+} while(0)
+
+
+/**
+ * \brief If stack is invalid calls stack dump then returns an error code
+ * \param [in] stack Stack to check
+*/
+#define RETURN_ON_ERROR(stack) \
+do { \
+    ErrorBits error = stack_check(stack); \
+    if (error) { \
+        STACK_DUMP(stack, error); \
+        return error; \
+    } \
+} while(0)
+
+
+/// Checks for specific error in error code (see #ERROR_BIT_FLAGS and #ErrorBits type)
+#define HAS_ERROR(bitflag, error) (bitflag & error)
+
+
+/**
+ * \brief Adds value to the counter of the current thread
+ * \param counter Counter index (see #STATS_COUNTERS)
+ * \param value Value to add
+ * \note Use it through ON_STACK_STATS(), counters are not compiled in without STACK_STATS
+*/
+void stats_add(int counter, unsigned long long value);
+
+
+/**
+ * \brief Updates peak size of the current thread
+ * \param size Current stack size
+*/
+void stats_peak(StackSize size);
+
+
+/**
+ * \brief Adds cycles passed since start to the counter and restarts measurement
+ * \param counter Counter index (see #STATS_COUNTERS)
+ * \param start Time stamp of the stage beginning, will be set to current time stamp
+*/
+void stats_stage(int counter, unsigned long long *start);
+
+
+/**
+ * \brief Returns processor time stamp (or steady clock nanoseconds where there is no time stamp counter)
+ * \return Time stamp
+*/
+unsigned long long stats_cycles(void);
+
+
+/**
+ * \brief Takes snapshot of hot-path counters
+ * \param stats Snapshot will be written here
+ * \param all_threads Sum counters of every thread (including finished ones) instead of the current thread only
+*/
+void stack_stats_snapshot(StackStats *stats, bool all_threads);
+
+
+/**
+ * \brief Prints counters snapshot
+ * \param stats Snapshot to print
+ * \param stream File to print in
+*/
+void stack_stats_dump(const StackStats *stats, FILE *stream);
+
+
+/**
+ * \brief Returns record buffer of the current thread for binary dumps
+ * \param size Required size in bytes
+ * \note Buffer is kept between dumps and only grows, so dumps stop allocating memory once it is large enough
+ * \return Buffer of at least size bytes or NULL
+*/
+char *dump_record(size_t size);
+
+
+/**
+ * \brief Fills slots with bytes of #POISON_VALUE
+ * \param slots Slots to fill
+ * \param count Number of slots
+*/
+template <typename T>
+void poison_fill(T *slots, StackSize count);
+
+
+/**
+ * \brief Checks if slot is filled with bytes of #POISON_VALUE
+ * \param slot Slot to check
+ * \return True if slot is poisoned
+*/
+template <typename T>
+bool is_poison(const T *slot);
+
+
+/**
+ * \brief Counts poison values in the buffer range
+ * \param data Buffer to scan
+ * \param begin Index of the first slot
+ * \param end Index after the last slot
+ * \return Number of poison values in [begin, end)
+*/
+template <typename T>
+StackSize count_poison(const T *data, StackSize begin, StackSize end);
+
+
+/**
+ * \brief Prints object as its bytes
+ * \param object Object to print
+ * \param stream File to print in
+*/
+template <typename T>
+void print_object(const T *object, FILE *stream);
+
+
+/**
+ * \brief Prints object using #OBJECT_TO_STR format
+ * \param object Object to print
+ * \param stream File to print in
+*/
+void print_object(const Object *object, FILE *stream);
+
+
+/**
+ * \brief Translate bit error code to english
+ * \param error Bit error code to print
+ * \param stream File to print errors in
+*/
+void print_errors(ErrorBits error, FILE *stream);
+
+
+/// Canary protection: structure and buffer are framed with stack address
+struct CanaryProtect {
+    static const bool ENABLED = true; ///< Protection is compiled in
+    static const bool GUARDED = false; ///< Buffer is surrounded by guard pages
+    static const bool RUNTIME = false; ///< Each stack turns protection on and off
+    static const size_t PADDING = sizeof(CanaryType); ///< Bytes reserved before and after buffer
+
+    template <typename T> static void set_frame(T *data, StackSize capacity, CanaryType canary);        ///< Writes canaries around any buffer
+    template <typename T> static ErrorBits check_frame(T *data, StackSize capacity, CanaryType canary); ///< Returns #BUFFER_CANARY if canary around buffer is wrong
+
+    template <typename S> static void set_struct(S *stack);         ///< Writes structure canaries
+    template <typename S> static void set_buffer(S *stack);         ///< Writes buffer canaries
+    template <typename S> static ErrorBits check_struct(S *stack);  ///< Returns #STRUCT_CANARY if structure canary is wrong
+    template <typename S> static ErrorBits check_buffer(S *stack);  ///< Returns #BUFFER_CANARY if buffer canary is wrong
+};
+
+
+/// Canary protection that compiles to nothing
+struct NoCanaryProtect {
+    static const bool ENABLED = false; ///< Protection is compiled in
+    static const bool GUARDED = false; ///< Buffer is surrounded by guard pages
+    static const bool RUNTIME = false; ///< Each stack turns protection on and off
+    static const size_t PADDING = 0; ///< Bytes reserved before and after buffer
+
+    template <typename T> static void set_frame(T *, StackSize, CanaryType) {}
+    template <typename T> static ErrorBits check_frame(T *, StackSize, CanaryType) { return ERROR_BIT_FLAGS::STACK_OK; }
+
+    template <typename S> static void set_struct(S *) {}
+    template <typename S> static void set_buffer(S *) {}
+    template <typename S> static ErrorBits check_struct(S *) { return ERROR_BIT_FLAGS::STACK_OK; }
+    template <typename S> static ErrorBits check_buffer(S *) { return ERROR_BIT_FLAGS::STACK_OK; }
+};
+
+
+/**
+ * \brief Guard page protection: structure keeps canaries, buffer ends right before inaccessible page (see guard_allocate())
+ * \note Overrun faults immediately and is reported by stack_dump() with #BUFFER_CANARY, buffer checks cost nothing.
+ * Buffer is mapped separately and doesn't use stack allocator, #STACK_MAPPED is ignored
+*/
+struct GuardProtect {
+    static const bool ENABLED = false; ///< There are no canaries around buffer
+    static const bool GUARDED = true; ///< Buffer is surrounded by guard pages
+    static const bool RUNTIME = false; ///< Each stack turns protection on and off
+    static const size_t PADDING = 0; ///< Bytes reserved before and after buffer
+
+    template <typename T> static void set_frame(T *, StackSize, CanaryType) {}
+    template <typename T> static ErrorBits check_frame(T *, StackSize, CanaryType) { return ERROR_BIT_FLAGS::STACK_OK; }
+
+    template <typename S> static void set_struct(S *stack) { CanaryProtect::set_struct(stack); }
+    template <typename S> static void set_buffer(S *) {}
+    template <typename S> static ErrorBits check_struct(S *stack) { return CanaryProtect::check_struct(stack); }
+    template <typename S> static ErrorBits check_buffer(S *) { return ERROR_BIT_FLAGS::STACK_OK; }
+};
+
+
+/**
+ * \brief Returns protections of structure that has no runtime selection
+ * \param stack Protected structure
+ * \return #CANARY_PROTECT and #HASH_PROTECT, runtime policies check such structures fully
+*/
+template <typename S>
+unsigned stack_protection(const S *stack);
+
+
+/**
+ * \brief Canary protection selected by each stack at runtime (see stack_set_protection())
+ * \note Canaries are always written, so turning them on costs only rewrite of possibly damaged ones.
+ * Turned off protection costs one well-predicted branch per check
+*/
+struct RuntimeCanaryProtect {
+    static const bool ENABLED = true; ///< Canaries are written and printed
+    static const bool GUARDED = false; ///< Buffer is surrounded by guard pages
+    static const bool RUNTIME = true; ///< Each stack turns protection on and off
+    static const size_t PADDING = sizeof(CanaryType); ///< Bytes reserved before and after buffer
+
+    template <typename T> static void set_frame(T *data, StackSize capacity, CanaryType canary) { CanaryProtect::set_frame(data, capacity, canary); }
+    template <typename T> static ErrorBits check_frame(T *data, StackSize capacity, CanaryType canary) { return CanaryProtect::check_frame(data, capacity, canary); }
+
+    template <typename S> static void set_struct(S *stack) { CanaryProtect::set_struct(stack); }
+    template <typename S> static void set_buffer(S *stack) { CanaryProtect::set_buffer(stack); }
+
+    template <typename S> static ErrorBits check_struct(S *stack) {
+        if (!(stack_protection(stack) & CANARY_PROTECT)) return ERROR_BIT_FLAGS::STACK_OK;
+
+        return CanaryProtect::check_struct(stack);
+    }
+
+    template <typename S> static ErrorBits check_buffer(S *stack) {
+        if (!(stack_protection(stack) & CANARY_PROTECT)) return ERROR_BIT_FLAGS::STACK_OK;
+
+        return CanaryProtect::check_buffer(stack);
+    }
+};
+
+
+/// Hash protection: structure and buffer hash sums are kept in the stack
+struct HashProtect {
+    static const bool ENABLED = true; ///< Protection is compiled in
+    static const bool RUNTIME = false; ///< Each stack turns protection on and off
+
+    template <typename S> static void set(S *stack);                                            ///< Rehashes structure and the whole buffer
+    template <typename S> static void set_struct(S *stack);                                     ///< Rehashes structure only
+    template <typename S> static void append(S *stack, const void *ptr, size_t size);           ///< Adds bytes to the end of buffer hash
+    template <typename S> static void remove(S *stack, const void *ptr, size_t size);           ///< Removes bytes from the end of buffer hash
+    template <typename S> static ErrorBits check_struct(S *stack);                              ///< Returns #STRUCT_HASH_FAIL if structure hash is wrong
+    template <typename S> static ErrorBits check_buffer(S *stack);                              ///< Returns #BUFFER_HASH_FAIL if buffer hash is wrong
+};
+
+
+/// Hash protection that compiles to nothing
+struct NoHashProtect {
+    static const bool ENABLED = false; ///< Protection is compiled in
+    static const bool RUNTIME = false; ///< Each stack turns protection on and off
+
+    template <typename S> static void set(S *) {}
+    template <typename S> static void set_struct(S *) {}
+    template <typename S> static void append(S *, const void *, size_t) {}
+    template <typename S> static void remove(S *, const void *, size_t) {}
+    template <typename S> static ErrorBits check_struct(S *) { return ERROR_BIT_FLAGS::STACK_OK; }
+    template <typename S> static ErrorBits check_buffer(S *) { return ERROR_BIT_FLAGS::STACK_OK; }
+};
+
+
+/**
+ * \brief Hash protection selected by each stack at runtime (see stack_set_protection())
+ * \note Hashes aren't maintained while protection is off, turning it on rehashes the whole buffer
+*/
+struct RuntimeHashProtect {
+    static const bool ENABLED = true; ///< Hashes are kept in the stack
+    static const bool RUNTIME = true; ///< Each stack turns protection on and off
+
+    template <typename S> static void set(S *stack) { if (stack_protection(stack) & HASH_PROTECT) HashProtect::set(stack); }
+    template <typename S> static void set_struct(S *stack) { if (stack_protection(stack) & HASH_PROTECT) HashProtect::set_struct(stack); }
+
+    template <typename S> static void append(S *stack, const void *ptr, size_t size) {
+        if (stack_protection(stack) & HASH_PROTECT) HashProtect::append(stack, ptr, size);
+    }
+
+    template <typename S> static void remove(S *stack, const void *ptr, size_t size) {
+        if (stack_protection(stack) & HASH_PROTECT) HashProtect::remove(stack, ptr, size);
+    }
+
+    template <typename S> static ErrorBits check_struct(S *stack) {
+        if (!(stack_protection(stack) & HASH_PROTECT)) return ERROR_BIT_FLAGS::STACK_OK;
+
+        return HashProtect::check_struct(stack);
+    }
+
+    template <typename S> static ErrorBits check_buffer(S *stack) {
+        if (!(stack_protection(stack) & HASH_PROTECT)) return ERROR_BIT_FLAGS::STACK_OK;
+
+        return HashProtect::check_buffer(stack);
+    }
+};
+
+
+/// Poison protection: free slots are filled with #POISON_VALUE bytes
+struct PoisonProtect {
+    static const bool ENABLED = true; ///< Protection is compiled in
+
+    template <typename T> static void fill(T *slots, StackSize count); ///< Poisons freed slots
+    template <typename S> static ErrorBits check_top(S *stack);        ///< Checks slots next to the top in O(1)
+    template <typename S> static ErrorBits check_buffer(S *stack);     ///< Scans the whole touched region
+};
+
+
+/// Poison protection that compiles to nothing
+struct NoPoisonProtect {
+    static const bool ENABLED = false; ///< Protection is compiled in
+
+    template <typename T> static void fill(T *, StackSize) {}
+    template <typename S> static ErrorBits check_top(S *) { return ERROR_BIT_FLAGS::STACK_OK; }
+    template <typename S> static ErrorBits check_buffer(S *) { return ERROR_BIT_FLAGS::STACK_OK; }
+};
+
+
+/// Set of protections used by stack
+template <typename CanaryPolicy, typename HashPolicy, typename PoisonPolicy>
+struct StackPolicy {
+    typedef CanaryPolicy Canary; ///< Canary protection (CanaryProtect, RuntimeCanaryProtect, GuardProtect or NoCanaryProtect)
+    typedef HashPolicy Hash;     ///< Hash protection (HashProtect, RuntimeHashProtect or NoHashProtect)
+    typedef PoisonPolicy Poison; ///< Poison protection (PoisonProtect or NoPoisonProtect)
+
+    /// Protections compiled in (#CANARY_PROTECT, #HASH_PROTECT and #GUARD_PROTECT bits)
+    static const unsigned PROTECTION = (Canary::ENABLED ? CANARY_PROTECT : 0) | (Hash::ENABLED ? HASH_PROTECT : 0) | (Canary::GUARDED ? GUARD_PROTECT : 0);
+
+    /// Protections each stack turns on and off at runtime
+    static const unsigned RUNTIME = (Canary::RUNTIME ? CANARY_PROTECT : 0) | (Hash::RUNTIME ? HASH_PROTECT : 0);
+};
+
+
+/// Policy selected by #PROTECT_LEVEL
+typedef StackPolicy<
+    std::conditional<(PROTECT_LEVEL & GUARD_PROTECT) != 0, GuardProtect,
+        std::conditional<(PROTECT_LEVEL & RUNTIME_PROTECT) != 0, RuntimeCanaryProtect,
+            std::conditional<(PROTECT_LEVEL & CANARY_PROTECT) != 0, CanaryProtect, NoCanaryProtect>::type>::type>::type,
+    std::conditional<(PROTECT_LEVEL & RUNTIME_PROTECT) != 0, RuntimeHashProtect,
+        std::conditional<(PROTECT_LEVEL & HASH_PROTECT) != 0, HashProtect, NoHashProtect>::type>::type,
+    PoisonProtect
+> DefaultPolicy;
+
+
+/// Policy without any protection
+typedef StackPolicy<NoCanaryProtect, NoHashProtect, NoPoisonProtect> NoProtectPolicy;
+
+
+/// Policy whose canaries and hashes are selected by each stack (see stack_set_protection())
+typedef StackPolicy<RuntimeCanaryProtect, RuntimeHashProtect, PoisonProtect> RuntimePolicy;
+
+
+/// Returns number of bytes reserved before buffer
+template <typename T, typename Policy>
+constexpr size_t buffer_front(void) {
+    return (Policy::Canary::PADDING > alignof(T)) ? Policy::Canary::PADDING : (Policy::Canary::PADDING ? alignof(T) : 0);
+}
+
+
+/// Returns number of bytes to allocate for buffer with canaries
+template <typename T, typename Policy>
+constexpr size_t buffer_bytes(StackSize capacity) {
+    return buffer_front<T, Policy>() + (size_t) capacity * sizeof(T) + Policy::Canary::PADDING;
+}
+
+
+/// Returns number of objects kept inside the stack structure without allocation (see #SMALL_CAPACITY)
+template <typename T, typename Policy>
+constexpr StackSize small_capacity(void) {
+    return (Policy::Canary::GUARDED || sizeof(T) * SMALL_CAPACITY > SMALL_MAX_BYTES) ? 0 : SMALL_CAPACITY;
+}
+
+
+/**
+ * \brief Structure for holding stack of any type
+ * \note Trivially copyable objects are moved with memcpy and realloc, others are constructed in place and moved.
+ * Stack of at most small_capacity() objects keeps them in small buffer and allocates nothing
+*/
+template <typename T, typename Policy = DefaultPolicy>
+struct BasicStack {
+    typedef T Value; ///< Stack object type
+
+    CanaryType canary_begin = 0;
+
+    T *data = NULL;
+    StackSize size = 0;
+    StackSize capacity = 0;
+    StackSize watermark = 0; ///< Slots after this index have never been written since allocation
+    StackSize min_capacity = 0; ///< Stack won't shrink below this capacity (see stack_reserve())
+    StackSize max_capacity = 0; ///< Stack won't grow beyond this capacity (see StackOptions)
+    unsigned flags = 0; ///< Combination of #STACK_FLAGS
+    StackSize peak_size = 0; ///< Largest size stack reached (tracked with STACK_STATS only)
+    int verify_slot = -1; ///< Registry slot of stack with #STACK_VERIFIED flag (see verifier_register())
+    unsigned protection = 0; ///< Protections turned on at runtime (only StackPolicy::RUNTIME bits, see stack_protection())
+    int file = -1; ///< Snapshot file of stack with #STACK_FILE flag
+
+    HashType struct_hash = 0;
+    HashType buffer_hash = 0;
+
+    /// Buffer of small stacks framed the same way as allocated one, structure hash skips it (see stack_small())
+    alignas(T) alignas(CanaryType) char small[(small_capacity<T, Policy>()) ? buffer_bytes<T, Policy>(small_capacity<T, Policy>()) : 1] = {};
+
+    CanaryType canary_end = 0;
 };
 
 
@@ -76,7 +619,31 @@ enum ERROR_BIT_FLAGS {
  * \note Free stack before contsructor to prevent memory leak
  * \return Error code (see #ERROR_BIT_FLAGS)
 */
-ErrorBits stack_constructor(Stack *stack, StackSize capacity);
+template <typename T, typename Policy>
+ErrorBits stack_constructor(BasicStack<T, Policy> *stack, StackSize capacity);
+
+
+/**
+ * \brief Constructs the stack with given configuration
+ * \param stack This stack will be filled
+ * \param capacity New stack capacity
+ * \param options Maximum capacity and storage flags (NULL for defaults)
+ * \note Mapped stack reserves address space for maximum capacity at once, physical memory is taken as stack grows
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_constructor(BasicStack<T, Policy> *stack, StackSize capacity, const StackOptions *options);
+
+
+/**
+ * \brief Constructs object at the end of stack
+ * \param stack This stack will be pushed
+ * \param args Arguments for object constructor
+ * \note Stack will try resize to hold all the objects
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy, typename... Args>
+ErrorBits stack_emplace(BasicStack<T, Policy> *stack, Args&&... args);
 
 
 /**
@@ -86,17 +653,65 @@ ErrorBits stack_constructor(Stack *stack, StackSize capacity);
  * \note Stack will try resize to hold all the objects
  * \return Error code (see #ERROR_BIT_FLAGS)
 */
-ErrorBits stack_push(Stack *stack, Object object);
+template <typename T, typename Policy>
+ErrorBits stack_push(BasicStack<T, Policy> *stack, const typename BasicStack<T, Policy>::Value &object);
+
+
+/**
+ * \brief Moves object to stack
+ * \param stack This stack will be pushed
+ * \param object This object will be moved to the end of stack
+ * \note Stack will try resize to hold all the objects
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_push(BasicStack<T, Policy> *stack, typename BasicStack<T, Policy>::Value &&object);
 
 
 /**
  * \brief Pops last object from stack
  * \param stack This stack will be popped
- * \param object Value of popped object will be written to this pointer
+ * \param object Value of popped object will be moved to this pointer
  * \note Stack will try resize if hold too few objects for its size
  * \return Error code (see #ERROR_BIT_FLAGS)
 */
-ErrorBits stack_pop(Stack *stack, Object *object);
+template <typename T, typename Policy>
+ErrorBits stack_pop(BasicStack<T, Policy> *stack, T *object);
+
+
+/**
+ * \brief Adds array of objects to stack
+ * \param stack This stack will be pushed
+ * \param objects Objects will be added in the same order as if they were pushed one by one
+ * \param count Number of objects
+ * \note Stack is resized and verified once for the whole array
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_push_n(BasicStack<T, Policy> *stack, const T *objects, StackSize count);
+
+
+/**
+ * \brief Pops several last objects from stack
+ * \param stack This stack will be popped
+ * \param objects Popped objects will be written here in stack order (last object of the array is the former top)
+ * \param count Number of objects
+ * \note Fails with #EMPTY_STACK and pops nothing if stack holds less than count objects
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_pop_n(BasicStack<T, Policy> *stack, T *objects, StackSize count);
+
+
+/**
+ * \brief Preallocates memory for objects
+ * \param stack This stack will be resized
+ * \param capacity Stack will be able to hold this number of objects without reallocation
+ * \note Stack won't shrink below this capacity afterwards
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_reserve(BasicStack<T, Policy> *stack, StackSize capacity);
 
 
 /**
@@ -105,15 +720,40 @@ ErrorBits stack_pop(Stack *stack, Object *object);
  * \note Stack won't be free in case of verification error so get ready for memory leak
  * \return Error code (see #ERROR_BIT_FLAGS)
 */
-ErrorBits stack_destructor(Stack *stack);
+template <typename T, typename Policy>
+ErrorBits stack_destructor(BasicStack<T, Policy> *stack);
 
 
 /**
  * \brief Stack verificator
  * \param stack Stack to check
+ * \note Buffer hash is maintained incrementally and isn't recalculated here, only slots near the top are checked for poison (see stack_audit())
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_check(BasicStack<T, Policy> *stack);
+
+
+/**
+ * \brief Stack verificator that can leave checks to background verifier
+ * \param stack Stack to check
+ * \param deep Check registered stack the same way as one that isn't registered
+ * \note Stack registered with #STACK_VERIFIED also returns errors found by verifier unless deep is true,
+ * buffer hash and poison scan are left to verifier and stack_audit() in any case
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_check(BasicStack<T, Policy> *stack, bool deep);
+
+
+/**
+ * \brief Full stack verificator
+ * \param stack Stack to check
+ * \note Does everything stack_check() does, also rehashes the whole buffer and scans every touched slot for poison, so it takes O(watermark) time
  * \return Error code (see #ERROR_BIT_FLAGS)
 */
-ErrorBits stack_check(Stack *stack);
+template <typename T, typename Policy>
+ErrorBits stack_audit(BasicStack<T, Policy> *stack);
 
 
 /**
@@ -122,12 +762,1485 @@ ErrorBits stack_check(Stack *stack);
  * \param error This error code will be printed
  * \param stream File to dump in
 */
-void stack_dump(Stack *stack, ErrorBits error, FILE *stream);
+template <typename T, typename Policy>
+void stack_dump(BasicStack<T, Policy> *stack, ErrorBits error, FILE *stream);
 
 
 /**
- * \brief Translate bit error code to english
- * \param error Bit error code to print
- * \param stream File to print errors in
+ * \brief Writes stack content in binary format (see DumpHeader) with one fwrite
+ * \param stack This stack will be dumped
+ * \param error This error code will be written
+ * \param stream File to dump in
+ * \note Use decoder to render it as text or diff two dumps
 */
-void print_errors(ErrorBits error, FILE *stream);
+template <typename T, typename Policy>
+void stack_dump_binary(BasicStack<T, Policy> *stack, ErrorBits error, FILE *stream);
+
+
+/**
+ * \brief Dumps stack whose guard page was touched (see #GuardProtect)
+ * \param stack Stack that owns the buffer
+*/
+template <typename T, typename Policy>
+void guard_report(void *stack);
+
+
+/**
+ * \brief Turns runtime protections of the stack on and off
+ * \param stack Stack to change
+ * \param protection Combination of StackPolicy::RUNTIME bits, protections compiled in stay on
+ * \note Turned on canaries are written again and turned on hash is calculated for the whole buffer,
+ * so damage done while protection was off isn't reported
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_set_protection(BasicStack<T, Policy> *stack, unsigned protection);
+
+
+/**
+ * \brief Writes stack to snapshot file (see SnapshotHeader)
+ * \param stack Stack to save
+ * \param path File path, existing file is replaced
+ * \note Buffer is written with one call, objects must be trivially copyable.
+ * Don't save stack with #STACK_FILE flag to its own file, use stack_sync()
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_save(BasicStack<T, Policy> *stack, const char *path);
+
+
+/**
+ * \brief Constructs stack from snapshot file
+ * \param stack This stack will be filled
+ * \param path File written by stack_save() or stack_sync()
+ * \param options Storage flags and protection (NULL for defaults), capacities are taken from the file
+ * \note Stack is mapped and file buffer is mapped over it, so nothing is parsed and pages are read on the first touch.
+ * Buffer is rehashed once to check it. With #STACK_FILE the file stays shared with the stack, otherwise its pages are copied on write.
+ * Buffer of another layout (other canary padding or guard pages) is read with one copy
+ * \return Error code (see #ERROR_BIT_FLAGS), #STRUCT_HASH_FAIL and #BUFFER_HASH_FAIL mean broken file
+*/
+template <typename T, typename Policy>
+ErrorBits stack_load(BasicStack<T, Policy> *stack, const char *path, const StackOptions *options);
+
+
+/**
+ * \brief Makes current state of stack with #STACK_FILE flag a checkpoint
+ * \param stack Stack to sync
+ * \note Changed pages reach disk first and header that describes them second.
+ * Changes after the last checkpoint reach the file too, so load after crash can fail with #BUFFER_HASH_FAIL
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_sync(BasicStack<T, Policy> *stack);
+
+
+/**
+ * \brief Fills snapshot header with stack state
+ * \param stack Stack that passed stack_check()
+ * \param header Header to fill
+ * \note Buffer is hashed here if stack doesn't keep its hash
+*/
+template <typename T, typename Policy>
+void snapshot_header(BasicStack<T, Policy> *stack, SnapshotHeader *header);
+
+
+/**
+ * \brief Checks that snapshot header is whole and fits stack and file
+ * \param header Header to check
+ * \param file_size Size of snapshot file
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits snapshot_check(const SnapshotHeader *header, size_t file_size);
+
+
+/**
+ * \brief Fills empty stack constructed by stack_load() with snapshot buffer
+ * \param stack Stack of snapshot capacity
+ * \param file Snapshot file
+ * \param header Checked snapshot header
+ * \param shared Buffer changes must reach the file
+ * \note Stack stays empty if buffer is broken
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_restore(BasicStack<T, Policy> *stack, int file, const SnapshotHeader *header, bool shared);
+
+
+/**
+ * \brief Returns protections stack uses now
+ * \param stack Stack
+ * \return Combination of #CANARY_PROTECT, #HASH_PROTECT and #GUARD_PROTECT
+*/
+template <typename T, typename Policy>
+unsigned stack_protection(const BasicStack<T, Policy> *stack);
+
+
+/**
+ * \brief Audits registered stack and dumps it on error (see #STACK_VERIFIED)
+ * \param stack Stack to audit
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_verify(void *stack);
+
+
+/**
+ * \brief Returns registry slot that stack must hold while it changes
+ * \param stack Stack that passed stack_check()
+ * \return Slot or -1 if stack isn't registered
+*/
+template <typename T, typename Policy>
+int stack_verify_slot(const BasicStack<T, Policy> *stack);
+
+
+/**
+ * \brief Returns small buffer of the stack (see small_capacity())
+ * \param stack Stack that holds the buffer
+ * \return Pointer to the first object of small buffer
+*/
+template <typename T, typename Policy>
+T *stack_small(BasicStack<T, Policy> *stack);
+
+
+/**
+ * \brief Calculates hash sum of any protected structure
+ * \param stack Structure to hash
+ * \return Hash sum of the whole structure
+*/
+template <typename S>
+HashType hash_struct(const S *stack);
+
+
+/**
+ * \brief Calculates hash sum of stack structure without small buffer
+ * \param stack Stack to hash
+ * \note Objects in small buffer are covered by buffer hash, so pushes and pops don't rehash them
+ * \return Hash sum of the structure
+*/
+template <typename T, typename Policy>
+HashType hash_struct(const BasicStack<T, Policy> *stack);
+
+
+/**
+ * \brief Resizes stack
+ * \param stack This stack will be resized automaticaly
+ * \param required Number of objects stack must be able to hold
+ * \note Capacity is doubled until it fits required size and halved while it is four times larger (but not lower than min_capacity).
+ * It never leaves small buffer while required size fits there
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+template <typename T, typename Policy>
+ErrorBits stack_resize(BasicStack<T, Policy> *stack, StackSize required);
+
+
+/**
+ * \brief Allocates buffer framed with canaries the way stack buffer is
+ * \param capacity Number of objects buffer holds
+ * \param canary Value written before and after buffer (if policy has canaries)
+ * \param report Called with canary as owner when guard page of the buffer is touched (NULL - fault is only logged)
+ * \note Memory comes from current stack allocator (see set_stack_allocator()), it is not zeroed and objects are not constructed.
+ * Pass guard_report() for BasicStack buffers only, other owners need their own report function
+ * \return Pointer to the first object or NULL
+*/
+template <typename T, typename Policy>
+T *buffer_allocate(StackSize capacity, CanaryType canary, GuardReport report);
+
+
+/**
+ * \brief Changes capacity of buffer allocated with buffer_allocate()
+ * \param data Buffer to resize
+ * \param old_capacity Current number of objects
+ * \param capacity New number of objects
+ * \param canary Value written before and after buffer (if policy has canaries)
+ * \param report Guard page report function (see buffer_allocate())
+ * \note Objects are moved bytewise so use it for trivially copyable objects only
+ * \return Pointer to the first object or NULL (old buffer stays valid then)
+*/
+template <typename T, typename Policy>
+T *buffer_reallocate(T *data, StackSize old_capacity, StackSize capacity, CanaryType canary, GuardReport report);
+
+
+/**
+ * \brief Frees buffer allocated with buffer_allocate()
+ * \param data Buffer to free
+ * \param capacity Number of objects buffer holds
+*/
+template <typename T, typename Policy>
+void buffer_free(T *data, StackSize capacity);
+
+
+/**
+ * \brief Reserves buffer for max_capacity objects and frames first capacity objects with canaries
+ * \param capacity Number of objects buffer holds now
+ * \param max_capacity Number of objects buffer can grow to in place
+ * \param flags Combination of #STACK_FLAGS
+ * \param canary Value written before and after buffer (if policy has canaries)
+ * \return Pointer to the first object or NULL
+*/
+template <typename T, typename Policy>
+T *buffer_map(StackSize capacity, StackSize max_capacity, unsigned flags, CanaryType canary);
+
+
+/**
+ * \brief Changes capacity of buffer reserved with buffer_map() without moving it
+ * \param data Buffer to resize
+ * \param old_capacity Current number of objects
+ * \param capacity New number of objects (not greater than maximum capacity)
+ * \param canary Value written before and after buffer (if policy has canaries)
+ * \note Pages after the new end are returned to the system on shrink
+ * \return True on success
+*/
+template <typename T, typename Policy>
+bool buffer_remap(T *data, StackSize old_capacity, StackSize capacity, CanaryType canary);
+
+
+/**
+ * \brief Replaces beginning of buffer reserved with buffer_map() with snapshot file buffer
+ * \param data Buffer to replace
+ * \param file Snapshot file
+ * \param bytes Number of bytes to map, buffer front included
+ * \param shared Writes reach the file, otherwise pages are copied on write
+ * \note Canaries come from the file, write them again
+ * \return True on success
+*/
+template <typename T, typename Policy>
+bool buffer_attach(T *data, int file, size_t bytes, bool shared);
+
+
+/**
+ * \brief Releases buffer reserved with buffer_map()
+ * \param data Buffer to release
+ * \param max_capacity Maximum capacity given to buffer_map()
+*/
+template <typename T, typename Policy>
+void buffer_unmap(T *data, StackSize max_capacity);
+
+
+/// Stack of #Object protected according to #PROTECT_LEVEL
+typedef BasicStack<Object, DefaultPolicy> Stack;
+
+
+// Stack functions are instantiated once in stack.cpp
+extern template ErrorBits stack_constructor<Object, DefaultPolicy>(Stack *stack, StackSize capacity);
+extern template ErrorBits stack_constructor<Object, DefaultPolicy>(Stack *stack, StackSize capacity, const StackOptions *options);
+extern template ErrorBits stack_push<Object, DefaultPolicy>(Stack *stack, const Object &object);
+extern template ErrorBits stack_push<Object, DefaultPolicy>(Stack *stack, Object &&object);
+extern template ErrorBits stack_pop<Object, DefaultPolicy>(Stack *stack, Object *object);
+extern template ErrorBits stack_push_n<Object, DefaultPolicy>(Stack *stack, const Object *objects, StackSize count);
+extern template ErrorBits stack_pop_n<Object, DefaultPolicy>(Stack *stack, Object *objects, StackSize count);
+extern template ErrorBits stack_reserve<Object, DefaultPolicy>(Stack *stack, StackSize capacity);
+extern template ErrorBits stack_set_protection<Object, DefaultPolicy>(Stack *stack, unsigned protection);
+extern template ErrorBits stack_save<Object, DefaultPolicy>(Stack *stack, const char *path);
+extern template ErrorBits stack_load<Object, DefaultPolicy>(Stack *stack, const char *path, const StackOptions *options);
+extern template ErrorBits stack_sync<Object, DefaultPolicy>(Stack *stack);
+extern template ErrorBits stack_destructor<Object, DefaultPolicy>(Stack *stack);
+extern template ErrorBits stack_check<Object, DefaultPolicy>(Stack *stack);
+extern template ErrorBits stack_check<Object, DefaultPolicy>(Stack *stack, bool deep);
+extern template ErrorBits stack_audit<Object, DefaultPolicy>(Stack *stack);
+extern template void stack_dump<Object, DefaultPolicy>(Stack *stack, ErrorBits error, FILE *stream);
+extern template void stack_dump_binary<Object, DefaultPolicy>(Stack *stack, ErrorBits error, FILE *stream);
+
+
+
+
+template <typename T, typename Policy>
+T *buffer_allocate(StackSize capacity, CanaryType canary, GuardReport report) {
+    if constexpr (Policy::Canary::GUARDED)
+        return (T *) guard_allocate((size_t) capacity * sizeof(T), (void *) canary, report);
+
+    char *true_pointer = (char *) stack_allocate(buffer_bytes<T, Policy>(capacity));
+    CHECK(true_pointer, return NULL);
+
+    T *data = (T *)(true_pointer + buffer_front<T, Policy>());
+
+    Policy::Canary::set_frame(data, capacity, canary);
+
+    return data;
+}
+
+
+template <typename T, typename Policy>
+T *buffer_reallocate(T *data, StackSize old_capacity, StackSize capacity, CanaryType canary, GuardReport report) {
+    if constexpr (Policy::Canary::GUARDED) {
+        // Buffer end must stay at the guard page, so it always moves
+        T *new_data = buffer_allocate<T, Policy>(capacity, canary, report);
+        CHECK(new_data, return NULL);
+
+        memcpy((void *) new_data, data, (size_t)((old_capacity < capacity) ? old_capacity : capacity) * sizeof(T));
+
+        guard_free(data, (size_t) old_capacity * sizeof(T));
+
+        return new_data;
+    }
+
+    char *true_pointer = (char *) stack_reallocate((char *)(data) - buffer_front<T, Policy>(),
+                                                   buffer_bytes<T, Policy>(old_capacity), buffer_bytes<T, Policy>(capacity));
+    CHECK(true_pointer, return NULL);
+
+    data = (T *)(true_pointer + buffer_front<T, Policy>());
+
+    Policy::Canary::set_frame(data, capacity, canary);
+
+    return data;
+}
+
+
+template <typename T, typename Policy>
+void buffer_free(T *data, StackSize capacity) {
+    if constexpr (Policy::Canary::GUARDED) {
+        guard_free(data, (size_t) capacity * sizeof(T));
+        return;
+    }
+
+    if (data) stack_deallocate((char *)(data) - buffer_front<T, Policy>(), buffer_bytes<T, Policy>(capacity));
+}
+
+
+template <typename T, typename Policy>
+T *buffer_map(StackSize capacity, StackSize max_capacity, unsigned flags, CanaryType canary) {
+    char *true_pointer = (char *) map_reserve(buffer_bytes<T, Policy>(max_capacity), flags & STACK_FLAGS::STACK_HUGE_PAGES);
+    CHECK(true_pointer, return NULL);
+
+    CHECK(map_commit(true_pointer, buffer_bytes<T, Policy>(capacity)), map_release(true_pointer, buffer_bytes<T, Policy>(max_capacity)); return NULL);
+
+    T *data = (T *)(true_pointer + buffer_front<T, Policy>());
+
+    Policy::Canary::set_frame(data, capacity, canary);
+
+    return data;
+}
+
+
+template <typename T, typename Policy>
+bool buffer_remap(T *data, StackSize old_capacity, StackSize capacity, CanaryType canary) {
+    char *true_pointer = (char *)(data) - buffer_front<T, Policy>();
+
+    if (capacity > old_capacity)
+        CHECK(map_commit(true_pointer, buffer_bytes<T, Policy>(capacity)), return false);
+    else
+        map_discard(true_pointer + buffer_bytes<T, Policy>(capacity), buffer_bytes<T, Policy>(old_capacity) - buffer_bytes<T, Policy>(capacity));
+
+    Policy::Canary::set_frame(data, capacity, canary);
+
+    return true;
+}
+
+
+template <typename T, typename Policy>
+bool buffer_attach(T *data, int file, size_t bytes, bool shared) {
+    bool attached = snapshot_map((char *)(data) - buffer_front<T, Policy>(), file, SNAPSHOT_DATA_OFFSET, bytes, shared);
+
+    pointer_cache_invalidate();
+
+    return attached;
+}
+
+
+template <typename T, typename Policy>
+void buffer_unmap(T *data, StackSize max_capacity) {
+    if (data) map_release((char *)(data) - buffer_front<T, Policy>(), buffer_bytes<T, Policy>(max_capacity));
+}
+
+
+template <typename T>
+void poison_fill(T *slots, StackSize count) {
+    const unsigned poison = POISON_VALUE;
+
+    unsigned char *bytes = (unsigned char *) slots;
+    size_t size = (size_t) count * sizeof(T);
+
+    for(size_t i = 0; i < size; i += sizeof(poison))
+        memcpy(bytes + i, &poison, (size - i < sizeof(poison)) ? size - i : sizeof(poison));
+}
+
+
+template <typename T>
+bool is_poison(const T *slot) {
+    const unsigned poison = POISON_VALUE;
+
+    if constexpr (sizeof(T) == sizeof(poison)) {
+        unsigned value = 0;
+        memcpy(&value, slot, sizeof(value));
+        return value == poison;
+    }
+    else {
+        const unsigned char *bytes = (const unsigned char *) slot;
+
+        for(size_t i = 0; i < sizeof(T); i += sizeof(poison))
+            if (memcmp(bytes + i, &poison, (sizeof(T) - i < sizeof(poison)) ? sizeof(T) - i : sizeof(poison)))
+                return false;
+
+        return true;
+    }
+}
+
+
+template <typename T>
+StackSize count_poison(const T *data, StackSize begin, StackSize end) {
+    StackSize count = 0;
+
+    // Branchless so the compiler can vectorize it
+    for(StackSize i = begin; i < end; i++)
+        count += is_poison(data + i);
+
+    return count;
+}
+
+
+template <typename T>
+void print_object(const T *object, FILE *stream) {
+    const unsigned char *bytes = (const unsigned char *) object;
+
+    for(size_t i = 0; i < sizeof(T); i++)
+        fprintf(stream, "%02x", bytes[i]);
+}
+
+
+template <typename T>
+void CanaryProtect::set_frame(T *data, StackSize capacity, CanaryType canary) {
+    memcpy((char *)(data) - sizeof(CanaryType), &canary, sizeof(CanaryType));
+    memcpy((char *)(data + capacity), &canary, sizeof(CanaryType));
+}
+
+
+template <typename T>
+ErrorBits CanaryProtect::check_frame(T *data, StackSize capacity, CanaryType canary) {
+    CanaryType begin = 0, end = 0;
+
+    memcpy(&begin, (char *)(data) - sizeof(CanaryType), sizeof(CanaryType));
+    memcpy(&end, (char *)(data + capacity), sizeof(CanaryType));
+
+    CHECK(begin == canary && end == canary, return ERROR_BIT_FLAGS::BUFFER_CANARY);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename S>
+void CanaryProtect::set_struct(S *stack) {
+    stack -> canary_begin = (CanaryType)(stack);
+    stack -> canary_end = (CanaryType)(stack);
+}
+
+
+template <typename S>
+void CanaryProtect::set_buffer(S *stack) {
+    set_frame(stack -> data, stack -> capacity, (CanaryType)(stack));
+}
+
+
+template <typename S>
+ErrorBits CanaryProtect::check_struct(S *stack) {
+    CHECK(stack -> canary_begin == (CanaryType)(stack) && stack -> canary_end == (CanaryType)(stack), return ERROR_BIT_FLAGS::STRUCT_CANARY);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename S>
+ErrorBits CanaryProtect::check_buffer(S *stack) {
+    return check_frame(stack -> data, stack -> capacity, (CanaryType)(stack));
+}
+
+
+template <typename S>
+unsigned stack_protection(const S *) {
+    return CANARY_PROTECT | HASH_PROTECT;
+}
+
+
+template <typename T, typename Policy>
+unsigned stack_protection(const BasicStack<T, Policy> *stack) {
+    return (Policy::PROTECTION & ~Policy::RUNTIME) | (stack -> protection & Policy::RUNTIME);
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_verify(void *stack) {
+    BasicStack<T, Policy> *verified = (BasicStack<T, Policy> *) stack;
+
+    ErrorBits error = stack_audit(verified);
+
+    if (error) STACK_DUMP(verified, error);
+
+    return error;
+}
+
+
+template <typename T, typename Policy>
+int stack_verify_slot(const BasicStack<T, Policy> *stack) {
+    return (stack -> flags & STACK_FLAGS::STACK_VERIFIED) ? stack -> verify_slot : -1;
+}
+
+
+template <typename T, typename Policy>
+T *stack_small(BasicStack<T, Policy> *stack) {
+    return (T *)(stack -> small + buffer_front<T, Policy>());
+}
+
+
+template <typename S>
+HashType hash_struct(const S *stack) {
+    return hash_bytes(stack, sizeof(S));
+}
+
+
+template <typename T, typename Policy>
+HashType hash_struct(const BasicStack<T, Policy> *stack) {
+    const char *begin = (const char *) stack;
+    const char *small_end = stack -> small + sizeof(stack -> small);
+
+    HashType hash = hash_bytes(begin, (size_t)(stack -> small - begin));
+
+    return hash_append(hash, small_end, sizeof(*stack) - (size_t)(small_end - begin));
+}
+
+
+template <typename S>
+void HashProtect::set(S *stack) {
+    stack -> buffer_hash = hash_bytes(stack -> data, (size_t) stack -> size * sizeof(*stack -> data));
+
+    set_struct(stack);
+}
+
+
+template <typename S>
+void HashProtect::set_struct(S *stack) {
+    HashType buffer_hash = stack -> buffer_hash;
+
+    stack -> struct_hash = 0;
+    stack -> buffer_hash = 0;
+
+    stack -> struct_hash = hash_struct(stack);
+    stack -> buffer_hash = buffer_hash;
+}
+
+
+template <typename S>
+void HashProtect::append(S *stack, const void *ptr, size_t size) {
+    stack -> buffer_hash = hash_append(stack -> buffer_hash, ptr, size);
+}
+
+
+template <typename S>
+void HashProtect::remove(S *stack, const void *ptr, size_t size) {
+    stack -> buffer_hash = hash_remove(stack -> buffer_hash, ptr, size);
+}
+
+
+template <typename S>
+ErrorBits HashProtect::check_struct(S *stack) {
+    // Copy is hashed, so the stack isn't written and background verifier can check it while owner reads it
+    S copy = *stack;
+
+    copy.struct_hash = 0;
+    copy.buffer_hash = 0;
+
+    CHECK(hash_struct(&copy) == stack -> struct_hash, return ERROR_BIT_FLAGS::STRUCT_HASH_FAIL);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename S>
+ErrorBits HashProtect::check_buffer(S *stack) {
+    CHECK(hash_bytes(stack -> data, (size_t) stack -> size * sizeof(*stack -> data)) == stack -> buffer_hash, return ERROR_BIT_FLAGS::BUFFER_HASH_FAIL);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename T>
+void PoisonProtect::fill(T *slots, StackSize count) {
+    poison_fill(slots, count);
+}
+
+
+template <typename S>
+ErrorBits PoisonProtect::check_top(S *stack) {
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    // Only slots around the top are checked here, touched region is scanned by stack_audit()
+    if (stack -> size > 0)
+        CHECK(!is_poison(stack -> data + stack -> size - 1), error += ERROR_BIT_FLAGS::UNEXP_POISON_VAL);
+
+    if (stack -> size < stack -> watermark)
+        CHECK(is_poison(stack -> data + stack -> size), error += ERROR_BIT_FLAGS::UNEXP_NORMAL_VAL);
+
+    return error;
+}
+
+
+template <typename S>
+ErrorBits PoisonProtect::check_buffer(S *stack) {
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    CHECK(count_poison(stack -> data, 0, stack -> size) == 0, error |= ERROR_BIT_FLAGS::UNEXP_POISON_VAL);
+
+    CHECK(count_poison(stack -> data, stack -> size, stack -> watermark) == stack -> watermark - stack -> size, error |= ERROR_BIT_FLAGS::UNEXP_NORMAL_VAL);
+
+    return error;
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_constructor(BasicStack<T, Policy> *stack, StackSize capacity) {
+    return stack_constructor(stack, capacity, NULL);
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_constructor(BasicStack<T, Policy> *stack, StackSize capacity, const StackOptions *options) {
+    static_assert(alignof(T) <= alignof(max_align_t), "Over-aligned types are not supported");
+
+    const StackOptions defaults = {};
+    if (!options) options = &defaults;
+
+    CHECK(right_pointer(stack, sizeof(*stack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+    CHECK(capacity > 0 && capacity <= options -> max_capacity, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    // Byte sizes of buffer (and of reservation for mapped stack) must not overflow
+    CHECK((size_t) options -> max_capacity <= (size_t) -1 / 2 / sizeof(T), return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    unsigned flags = options -> flags;
+
+    if (Policy::Canary::GUARDED)
+        flags &= ~(STACK_FLAGS::STACK_MAPPED | STACK_FLAGS::STACK_HUGE_PAGES | STACK_FLAGS::STACK_FILE);
+
+    // File-backed buffer is mapped buffer whose pages are shared with the file
+    if (flags & STACK_FLAGS::STACK_FILE) {
+        CHECK(options -> path && std::is_trivially_copyable<T>::value, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+        flags |= STACK_FLAGS::STACK_MAPPED;
+    }
+
+    if (flags & STACK_FLAGS::STACK_MAPPED)
+        stack -> data = buffer_map<T, Policy>(capacity, options -> max_capacity, flags, (CanaryType)(stack));
+    else if (capacity <= small_capacity<T, Policy>()) {
+        stack -> data = stack_small(stack);
+        Policy::Canary::set_frame(stack -> data, capacity, (CanaryType)(stack));
+    }
+    else
+        stack -> data = buffer_allocate<T, Policy>(capacity, (CanaryType)(stack), &guard_report<T, Policy>);
+
+    CHECK(stack -> data, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+    if (stack -> data != stack_small(stack))
+        pointer_cache_remember(stack -> data, (size_t) capacity * sizeof(T));
+
+    stack -> file = -1;
+
+    if (flags & STACK_FLAGS::STACK_FILE) {
+        size_t bytes = buffer_bytes<T, Policy>(options -> max_capacity);
+
+        stack -> file = snapshot_open(options -> path, SNAPSHOT_CREATE);
+
+        bool attached = stack -> file >= 0 && snapshot_extend(stack -> file, SNAPSHOT_DATA_OFFSET + bytes)
+                        && buffer_attach<T, Policy>(stack -> data, stack -> file, bytes, true);
+
+        if (!attached) {
+            snapshot_close(stack -> file);
+            buffer_unmap<T, Policy>(stack -> data, options -> max_capacity);
+
+            stack -> file = -1;
+            stack -> data = NULL;
+
+            return ERROR_BIT_FLAGS::SNAPSHOT_FAIL;
+        }
+
+        Policy::Canary::set_frame(stack -> data, capacity, (CanaryType)(stack));
+    }
+
+    stack -> capacity = capacity;
+    stack -> size = 0;
+    stack -> watermark = 0;
+    stack -> min_capacity = 1;
+    stack -> max_capacity = options -> max_capacity;
+    stack -> peak_size = 0;
+    stack -> verify_slot = -1;
+    stack -> protection = options -> protection & Policy::RUNTIME;
+
+    // Slot comes locked, so verifier waits until the stack is filled
+    if (flags & STACK_FLAGS::STACK_VERIFIED) {
+        stack -> verify_slot = verifier_register(stack, &stack_verify<T, Policy>);
+
+        if (stack -> verify_slot < 0) flags &= ~STACK_FLAGS::STACK_VERIFIED;
+    }
+
+    stack -> flags = flags;
+
+    Policy::Canary::set_struct(stack);
+
+    Policy::Hash::set(stack);
+
+    verifier_unlock(stack -> verify_slot);
+
+    RETURN_ON_ERROR(stack);
+
+    // File gets header of empty stack, so it loads from the start
+    if (flags & STACK_FLAGS::STACK_FILE)
+        return stack_sync(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_resize(BasicStack<T, Policy> *stack, StackSize required) {
+    RETURN_ON_ERROR(stack);
+
+    CHECK(required <= stack -> max_capacity, return ERROR_BIT_FLAGS::STACK_OVERFLOW);
+
+    StackSize capacity = stack -> capacity;
+
+    while (capacity < required)
+        capacity *= 2;
+
+    if (capacity > stack -> max_capacity)
+        capacity = stack -> max_capacity;
+
+    // Growth stops at small buffer end while it still fits
+    if (required > stack -> capacity && required <= small_capacity<T, Policy>() && capacity > small_capacity<T, Policy>()
+            && stack -> min_capacity <= small_capacity<T, Policy>() && !(stack -> flags & STACK_FLAGS::STACK_MAPPED))
+        capacity = small_capacity<T, Policy>();
+
+    while (4 * required < capacity && capacity / 2 >= stack -> min_capacity)
+        capacity /= 2;
+
+    if (capacity == stack -> capacity)
+        return ERROR_BIT_FLAGS::STACK_OK;
+
+    T *old_data = stack -> data;
+    T *small = stack_small(stack);
+
+    bool to_small = capacity <= small_capacity<T, Policy>() && !(stack -> flags & STACK_FLAGS::STACK_MAPPED);
+
+    if (stack -> flags & STACK_FLAGS::STACK_MAPPED) {
+        // Buffer never moves, so objects of any type stay in place
+        CHECK((buffer_remap<T, Policy>(old_data, stack -> capacity, capacity, (CanaryType)(stack))), return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+        if (stack -> watermark > capacity)
+            stack -> watermark = capacity;
+    }
+    else if (old_data == small && to_small) {
+        Policy::Canary::set_frame(small, capacity, (CanaryType)(stack));
+
+        if (stack -> watermark > capacity)
+            stack -> watermark = capacity;
+    }
+    else if (std::is_trivially_copyable<T>::value && old_data != small && !to_small) {
+        T *data = buffer_reallocate<T, Policy>(old_data, stack -> capacity, capacity, (CanaryType)(stack), &guard_report<T, Policy>);
+        CHECK(data, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+        stack -> data = data;
+
+        if (stack -> watermark > capacity)
+            stack -> watermark = capacity;
+    }
+    else {
+        // Objects can't be relocated with realloc (or leave small buffer) so they are moved one by one
+        T *data = (to_small) ? small : buffer_allocate<T, Policy>(capacity, (CanaryType)(stack), &guard_report<T, Policy>);
+        CHECK(data, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+        if (to_small)
+            Policy::Canary::set_frame(data, capacity, (CanaryType)(stack));
+
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            if (stack -> watermark > capacity)
+                stack -> watermark = capacity;
+
+            // Poisoned slots are copied too, so the touched region stays the same
+            memcpy((void *) data, old_data, (size_t) stack -> watermark * sizeof(T));
+        }
+        else {
+            for(StackSize i = 0; i < stack -> size; i++) {
+                new (data + i) T(std::move(old_data[i]));
+                old_data[i].~T();
+            }
+
+            stack -> watermark = stack -> size;
+        }
+
+        if (old_data != small)
+            buffer_free<T, Policy>(old_data, stack -> capacity);
+
+        stack -> data = data;
+    }
+
+    ON_STACK_STATS(
+        stats_add((capacity > stack -> capacity) ? STATS_GROWS : STATS_SHRINKS, 1);
+        if (stack -> data != old_data) stats_add(STATS_BYTES_MOVED, (unsigned long long) stack -> size * sizeof(T));
+    )
+
+    // Freeing that unmaps memory drops pointer cache itself, new buffer is added to it so its check needs no reread
+    if (stack -> data != old_data && stack -> data != small)
+        pointer_cache_remember(stack -> data, (size_t) capacity * sizeof(T));
+
+    stack -> capacity = capacity;
+
+    // Moved objects can differ bytewise so their hash is recalculated
+    if (std::is_trivially_copyable<T>::value || stack -> data == old_data)
+        Policy::Hash::set_struct(stack);
+    else
+        Policy::Hash::set(stack);
+
+    RETURN_ON_ERROR(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename T, typename Policy, typename... Args>
+ErrorBits stack_emplace(BasicStack<T, Policy> *stack, Args&&... args) {
+    RETURN_ON_ERROR(stack);
+
+    VerifierLock lock(stack_verify_slot(stack));
+
+    ErrorBits resize_error = stack_resize(stack, stack -> size + 1);
+    if (resize_error) return resize_error;
+
+    T *slot = stack -> data + stack -> size;
+
+    new (slot) T(std::forward<Args>(args)...);
+
+    Policy::Hash::append(stack, slot, sizeof(T));
+
+    stack -> size++;
+
+    if (stack -> size > stack -> watermark)
+        stack -> watermark = stack -> size;
+
+    ON_STACK_STATS(
+        stats_add(STATS_PUSHES, 1);
+        if (stack -> size > stack -> peak_size) stats_peak(stack -> peak_size = stack -> size);
+    )
+
+    Policy::Hash::set_struct(stack);
+
+    RETURN_ON_ERROR(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_push(BasicStack<T, Policy> *stack, const typename BasicStack<T, Policy>::Value &object) {
+    return stack_emplace(stack, object);
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_push(BasicStack<T, Policy> *stack, typename BasicStack<T, Policy>::Value &&object) {
+    return stack_emplace(stack, std::move(object));
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_push_n(BasicStack<T, Policy> *stack, const T *objects, StackSize count) {
+    CHECK(count >= 0 && (objects || !count), return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    RETURN_ON_ERROR(stack);
+
+    VerifierLock lock(stack_verify_slot(stack));
+
+    ErrorBits resize_error = stack_resize(stack, stack -> size + count);
+    if (resize_error) return resize_error;
+
+    T *slots = stack -> data + stack -> size;
+
+    if constexpr (std::is_trivially_copyable<T>::value)
+        memcpy(slots, objects, (size_t) count * sizeof(T));
+    else
+        for(StackSize i = 0; i < count; i++)
+            new (slots + i) T(objects[i]);
+
+    Policy::Hash::append(stack, slots, (size_t) count * sizeof(T));
+
+    stack -> size += count;
+
+    if (stack -> size > stack -> watermark)
+        stack -> watermark = stack -> size;
+
+    ON_STACK_STATS(
+        stats_add(STATS_PUSHES, (unsigned long long) count);
+        if (stack -> size > stack -> peak_size) stats_peak(stack -> peak_size = stack -> size);
+    )
+
+    Policy::Hash::set_struct(stack);
+
+    RETURN_ON_ERROR(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_pop(BasicStack<T, Policy> *stack, T *object) {
+    CHECK(object, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    RETURN_ON_ERROR(stack);
+
+    VerifierLock lock(stack_verify_slot(stack));
+
+    CHECK(stack -> size, return ERROR_BIT_FLAGS::EMPTY_STACK);
+
+    T *slot = stack -> data + --(stack -> size);
+
+    Policy::Hash::remove(stack, slot, sizeof(T));
+
+    *object = std::move(*slot);
+    slot -> ~T();
+
+    Policy::Poison::fill(slot, 1);
+
+    ON_STACK_STATS(stats_add(STATS_POPS, 1));
+
+    Policy::Hash::set_struct(stack);
+
+    RETURN_ON_ERROR(stack);
+
+    return stack_resize(stack, stack -> size);
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_pop_n(BasicStack<T, Policy> *stack, T *objects, StackSize count) {
+    CHECK(count >= 0 && (objects || !count), return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    RETURN_ON_ERROR(stack);
+
+    VerifierLock lock(stack_verify_slot(stack));
+
+    CHECK(count <= stack -> size, return ERROR_BIT_FLAGS::EMPTY_STACK);
+
+    stack -> size -= count;
+
+    T *slots = stack -> data + stack -> size;
+
+    Policy::Hash::remove(stack, slots, (size_t) count * sizeof(T));
+
+    if constexpr (std::is_trivially_copyable<T>::value)
+        memcpy(objects, slots, (size_t) count * sizeof(T));
+    else
+        for(StackSize i = 0; i < count; i++) {
+            objects[i] = std::move(slots[i]);
+            slots[i].~T();
+        }
+
+    Policy::Poison::fill(slots, count);
+
+    ON_STACK_STATS(stats_add(STATS_POPS, (unsigned long long) count));
+
+    Policy::Hash::set_struct(stack);
+
+    RETURN_ON_ERROR(stack);
+
+    return stack_resize(stack, stack -> size);
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_reserve(BasicStack<T, Policy> *stack, StackSize capacity) {
+    RETURN_ON_ERROR(stack);
+
+    VerifierLock lock(stack_verify_slot(stack));
+
+    CHECK(capacity > 0 && capacity <= stack -> max_capacity, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    stack -> min_capacity = capacity;
+
+    Policy::Hash::set_struct(stack);
+
+    return stack_resize(stack, capacity);
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_set_protection(BasicStack<T, Policy> *stack, unsigned protection) {
+    RETURN_ON_ERROR(stack);
+
+    CHECK(!(protection & ~Policy::RUNTIME), return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    VerifierLock lock(stack_verify_slot(stack));
+
+    bool rehash = (protection & ~stack -> protection) & HASH_PROTECT;
+
+    stack -> protection = protection;
+
+    // Canaries and objects could be overwritten while protection was off
+    if (protection & CANARY_PROTECT) {
+        Policy::Canary::set_struct(stack);
+        Policy::Canary::set_buffer(stack);
+    }
+
+    if (rehash)
+        Policy::Hash::set(stack);
+    else
+        Policy::Hash::set_struct(stack);
+
+    RETURN_ON_ERROR(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_save(BasicStack<T, Policy> *stack, const char *path) {
+    static_assert(std::is_trivially_copyable<T>::value, "Snapshot keeps objects bytewise");
+
+    CHECK(path, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    RETURN_ON_ERROR(stack);
+
+    SnapshotHeader header = {};
+    snapshot_header(stack, &header);
+
+    size_t bytes = header.buffer_front + (size_t) stack -> watermark * sizeof(T);
+
+    int file = snapshot_open(path, SNAPSHOT_CREATE);
+    CHECK(file >= 0, return ERROR_BIT_FLAGS::SNAPSHOT_FAIL);
+
+    // Header is written after the buffer reaches disk, so file cut off by crash is rejected
+    bool saved = snapshot_extend(file, SNAPSHOT_DATA_OFFSET + bytes)
+                 && snapshot_write(file, SNAPSHOT_DATA_OFFSET, (char *)(stack -> data) - header.buffer_front, bytes)
+                 && snapshot_sync(file, NULL, 0)
+                 && snapshot_write(file, 0, &header, sizeof(header))
+                 && snapshot_sync(file, NULL, 0);
+
+    snapshot_close(file);
+
+    CHECK(saved, return ERROR_BIT_FLAGS::SNAPSHOT_FAIL);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_load(BasicStack<T, Policy> *stack, const char *path, const StackOptions *options) {
+    static_assert(std::is_trivially_copyable<T>::value, "Snapshot keeps objects bytewise");
+
+    const StackOptions defaults = {};
+    if (!options) options = &defaults;
+
+    CHECK(path, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    bool shared = options -> flags & STACK_FLAGS::STACK_FILE;
+
+    int file = snapshot_open(path, (shared) ? SNAPSHOT_WRITE : SNAPSHOT_READ);
+    CHECK(file >= 0, return ERROR_BIT_FLAGS::SNAPSHOT_FAIL);
+
+    SnapshotHeader header = {};
+
+    ErrorBits load_error = ERROR_BIT_FLAGS::SNAPSHOT_FAIL;
+
+    if (snapshot_read(file, 0, &header, sizeof(header)))
+        load_error = snapshot_check<T, Policy>(&header, snapshot_size(file));
+
+    CHECK(!load_error, snapshot_close(file); return load_error);
+
+    // Stack is constructed empty in reserved address space, then file buffer takes its place
+    StackOptions load_options = *options;
+    load_options.max_capacity = header.max_capacity;
+    load_options.flags = (options -> flags | STACK_FLAGS::STACK_MAPPED) & ~STACK_FLAGS::STACK_FILE;
+
+    load_error = stack_constructor(stack, header.capacity, &load_options);
+    CHECK(!load_error, snapshot_close(file); return load_error);
+
+    load_error = stack_restore(stack, file, &header, shared);
+
+    if (!(stack -> flags & STACK_FLAGS::STACK_FILE))
+        snapshot_close(file);
+
+    CHECK(!load_error, stack_destructor(stack); return load_error);
+
+    RETURN_ON_ERROR(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_sync(BasicStack<T, Policy> *stack) {
+    RETURN_ON_ERROR(stack);
+
+    CHECK(stack -> flags & STACK_FLAGS::STACK_FILE, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    SnapshotHeader header = {};
+    snapshot_header(stack, &header);
+
+    // Buffer reaches disk before header that describes it
+    bool synced = snapshot_sync(stack -> file, (char *)(stack -> data) - header.buffer_front, header.buffer_front + (size_t) stack -> watermark * sizeof(T))
+                  && snapshot_write(stack -> file, 0, &header, sizeof(header))
+                  && snapshot_sync(stack -> file, NULL, 0);
+
+    CHECK(synced, return ERROR_BIT_FLAGS::SNAPSHOT_FAIL);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename T, typename Policy>
+void snapshot_header(BasicStack<T, Policy> *stack, SnapshotHeader *header) {
+    header -> object_size = (unsigned) sizeof(T);
+    header -> hash_engine = get_hash_engine() -> id;
+    header -> buffer_front = buffer_front<T, Policy>();
+    header -> capacity = stack -> capacity;
+    header -> max_capacity = stack -> max_capacity;
+    header -> min_capacity = stack -> min_capacity;
+    header -> size = stack -> size;
+    header -> watermark = stack -> watermark;
+
+    // Kept hash is checked by load anyway, stacks without it are hashed once here
+    if (stack_protection(stack) & HASH_PROTECT)
+        header -> buffer_hash = stack -> buffer_hash;
+    else
+        header -> buffer_hash = hash_bytes(stack -> data, (size_t) stack -> size * sizeof(T));
+
+    header -> struct_hash = 0;
+    header -> struct_hash = hash_struct(header);
+}
+
+
+template <typename T, typename Policy>
+ErrorBits snapshot_check(const SnapshotHeader *header, size_t file_size) {
+    CHECK(header -> magic == SNAPSHOT_MAGIC && header -> version == SNAPSHOT_VERSION && header -> object_size == sizeof(T),
+          return ERROR_BIT_FLAGS::SNAPSHOT_FAIL);
+
+    const HashEngine *engine = find_hash_engine(header -> hash_engine);
+    CHECK(engine && header -> hash_engine != HASH_ENGINE_AUTO, return ERROR_BIT_FLAGS::SNAPSHOT_FAIL);
+
+    SnapshotHeader copy = *header;
+    copy.struct_hash = 0;
+
+    CHECK(engine -> append(engine -> seed, &copy, sizeof(copy)) == header -> struct_hash, return ERROR_BIT_FLAGS::STRUCT_HASH_FAIL);
+
+    CHECK(header -> capacity > 0 && header -> capacity <= header -> max_capacity && header -> min_capacity > 0
+          && header -> min_capacity <= header -> max_capacity && (size_t) header -> max_capacity <= (size_t) -1 / 2 / sizeof(T),
+          return ERROR_BIT_FLAGS::INVALID_CAPACITY);
+
+    CHECK(header -> size >= 0 && header -> size <= header -> watermark && header -> watermark <= header -> capacity,
+          return ERROR_BIT_FLAGS::INVALID_SIZE);
+
+    CHECK(header -> buffer_front < SNAPSHOT_DATA_OFFSET
+          && file_size >= SNAPSHOT_DATA_OFFSET + header -> buffer_front + (size_t) header -> watermark * sizeof(T),
+          return ERROR_BIT_FLAGS::SNAPSHOT_FAIL);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_restore(BasicStack<T, Policy> *stack, int file, const SnapshotHeader *header, bool shared) {
+    VerifierLock lock(stack_verify_slot(stack));
+
+    size_t bytes = (shared) ? buffer_bytes<T, Policy>(header -> max_capacity) : header -> buffer_front + (size_t) header -> watermark * sizeof(T);
+
+    // Buffer of the same layout is mapped, the rest of reservation stays anonymous for growth
+    bool mapped = (stack -> flags & STACK_FLAGS::STACK_MAPPED) && header -> buffer_front == buffer_front<T, Policy>()
+                  && (!shared || snapshot_extend(file, SNAPSHOT_DATA_OFFSET + bytes))
+                  && buffer_attach<T, Policy>(stack -> data, file, bytes, shared);
+
+    if (!mapped)
+        CHECK(!shared && snapshot_read(file, SNAPSHOT_DATA_OFFSET + header -> buffer_front, stack -> data, (size_t) header -> watermark * sizeof(T)),
+              return ERROR_BIT_FLAGS::SNAPSHOT_FAIL);
+
+    // File holds canaries of another address
+    Policy::Canary::set_buffer(stack);
+
+    const HashEngine *engine = find_hash_engine(header -> hash_engine);
+
+    CHECK(engine -> append(engine -> seed, stack -> data, (size_t) header -> size * sizeof(T)) == header -> buffer_hash,
+          return ERROR_BIT_FLAGS::BUFFER_HASH_FAIL);
+
+    stack -> size = header -> size;
+    stack -> watermark = header -> watermark;
+    stack -> min_capacity = header -> min_capacity;
+    stack -> buffer_hash = header -> buffer_hash;
+
+    if (shared) {
+        stack -> file = file;
+        stack -> flags |= STACK_FLAGS::STACK_FILE;
+    }
+
+    // Hash of another engine is replaced with hash of the current one
+    if (header -> hash_engine == get_hash_engine() -> id)
+        Policy::Hash::set_struct(stack);
+    else
+        Policy::Hash::set(stack);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_destructor(BasicStack<T, Policy> *stack) {
+    // Unregistered stack is checked fully, verifier errors are found again if they are still there
+    if (right_pointer(stack, sizeof(*stack)) && verifier_owns(stack -> verify_slot, stack))
+        verifier_unregister(stack -> verify_slot);
+
+    RETURN_ON_ERROR(stack);
+
+    // Clean shutdown leaves file that loads without errors
+    ErrorBits sync_error = ERROR_BIT_FLAGS::STACK_OK;
+
+    if (stack -> flags & STACK_FLAGS::STACK_FILE)
+        sync_error = stack_sync(stack);
+
+    if constexpr (!std::is_trivially_destructible<T>::value)
+        for(StackSize i = 0; i < stack -> size; i++)
+            stack -> data[i].~T();
+
+    // Unmapped buffers drop pointer cache themselves (see pointer_cache_invalidate())
+    if (stack -> flags & STACK_FLAGS::STACK_MAPPED)
+        buffer_unmap<T, Policy>(stack -> data, stack -> max_capacity);
+    else if (stack -> data != stack_small(stack))
+        buffer_free<T, Policy>(stack -> data, stack -> capacity);
+
+    snapshot_close(stack -> file);
+
+    stack -> data = NULL;
+
+    stack -> capacity = 0;
+    stack -> size = 0;
+    stack -> watermark = 0;
+    stack -> min_capacity = 0;
+    stack -> max_capacity = 0;
+    stack -> flags = 0;
+    stack -> verify_slot = -1;
+    stack -> file = -1;
+
+    Policy::Hash::set(stack);
+
+    return sync_error;
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_check(BasicStack<T, Policy> *stack) {
+    return stack_check(stack, false);
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_check(BasicStack<T, Policy> *stack, bool deep) {
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    ON_STACK_STATS(
+        stats_add(STATS_CHECKS, 1);
+        unsigned long long stage = stats_cycles();
+    )
+
+    CHECK(right_pointer(stack, sizeof(*stack)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    ON_STACK_STATS(stats_stage(STATS_CYCLES_POINTER, &stage));
+
+    error = Policy::Canary::check_struct(stack);
+    if (error) return error;
+
+    error = Policy::Hash::check_struct(stack);
+
+    // Buffer of registered stack is rehashed by background verifier, so errors it found are added to the inline ones
+    if (!deep && (stack -> flags & STACK_FLAGS::STACK_VERIFIED) && verifier_owns(stack -> verify_slot, stack))
+        error |= verifier_error(stack -> verify_slot);
+
+    if (error) return error;
+
+    ON_STACK_STATS(stats_stage(STATS_CYCLES_STRUCT, &stage));
+
+    CHECK(right_pointer(stack -> data, (size_t) stack -> capacity * sizeof(T)), error += ERROR_BIT_FLAGS::INVALID_DATA; return error);
+
+    ON_STACK_STATS(stats_stage(STATS_CYCLES_POINTER, &stage));
+
+    error = Policy::Canary::check_buffer(stack);
+    if (error) return error;
+
+    CHECK(stack -> capacity >= 0 && stack -> capacity <= stack -> max_capacity, error += ERROR_BIT_FLAGS::INVALID_CAPACITY);
+
+    CHECK(stack -> size >= 0 && stack -> size <= stack -> watermark && stack -> watermark <= stack -> capacity, error += ERROR_BIT_FLAGS::INVALID_SIZE);
+
+    if (HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_SIZE) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_CAPACITY))
+        return error;
+
+    ON_STACK_STATS(stats_stage(STATS_CYCLES_BUFFER, &stage));
+
+    error |= Policy::Poison::check_top(stack);
+
+    ON_STACK_STATS(stats_stage(STATS_CYCLES_POISON, &stage));
+
+    return error;
+}
+
+
+template <typename T, typename Policy>
+ErrorBits stack_audit(BasicStack<T, Policy> *stack) {
+    ErrorBits error = stack_check(stack, true);
+
+    if (HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_SIZE) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_CAPACITY) || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_HASH_FAIL)
+            || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_POINTER) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_DATA))
+        return error;
+
+    ON_STACK_STATS(
+        stats_add(STATS_AUDITS, 1);
+        unsigned long long stage = stats_cycles();
+    )
+
+    error |= Policy::Hash::check_buffer(stack);
+
+    ON_STACK_STATS(stats_stage(STATS_CYCLES_HASH, &stage));
+
+    error |= Policy::Poison::check_buffer(stack);
+
+    ON_STACK_STATS(stats_stage(STATS_CYCLES_SCAN, &stage));
+
+    return error;
+}
+
+
+template <typename T, typename Policy>
+void stack_dump(BasicStack<T, Policy> *stack, ErrorBits error, FILE *stream) {
+    CHECK(right_pointer(stack, sizeof(*stack)), return);
+
+    fprintf(stream, "\tStack[%p]:\n", (void *) stack);
+
+    print_errors(error, stream);
+
+    fprintf(stream, "\tCapacity: %llu\n\tMax capacity: %llu\n\tSize: %llu\n", stack -> capacity, stack -> max_capacity, stack -> size);
+
+    ON_STACK_STATS(fprintf(stream, "\tPeak size: %llu\n", stack -> peak_size));
+
+    if (stack -> flags & STACK_FLAGS::STACK_MAPPED)
+        fprintf(stream, "\tMapped%s\n", (stack -> flags & STACK_FLAGS::STACK_HUGE_PAGES) ? " (huge pages)" : "");
+
+    if (stack -> data == stack_small(stack))
+        fprintf(stream, "\tSmall buffer\n");
+
+    if (stack -> flags & STACK_FLAGS::STACK_VERIFIED)
+        fprintf(stream, "\tVerified (slot %d)\n", stack -> verify_slot);
+
+    if (stack -> flags & STACK_FLAGS::STACK_FILE)
+        fprintf(stream, "\tFile-backed (descriptor %d)\n", stack -> file);
+
+    if (Policy::RUNTIME)
+        fprintf(stream, "\tProtection: %u\n", stack_protection(stack));
+
+    if (stack_protection(stack) & HASH_PROTECT)
+        fprintf(stream, "\tBuffer hash: %0llx\n\tStruct hash: %0llx\n", stack -> buffer_hash, stack -> struct_hash);
+
+    fprintf(stream, "\tData[%p]", (void *) stack -> data);
+
+    if (HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_DATA) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_CAPACITY)
+            || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_HASH_FAIL) || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_CANARY)) {
+        fputc('\n', stream);
+        return;
+    }
+
+    fprintf(stream, ":\n");
+
+    CanaryType canary = 0;
+
+    if (Policy::Canary::ENABLED) {
+        memcpy(&canary, (char *)(stack -> data) - sizeof(CanaryType), sizeof(CanaryType));
+        fprintf(stream, "\t\tCanary: %0llx\n", canary);
+    }
+
+    for(StackSize i = 0; i < stack -> watermark; i++) {
+        fprintf(stream, "\t\t[%03lld] ", i); // object index
+
+        print_object(stack -> data + i, stream); // print value function (possible overload)
+
+        if (is_poison(stack -> data + i)) fprintf(stream, " (POISON VALUE)"); // poison value warning
+
+        fputc('\n', stream); // new line
+    }
+
+    if (stack -> watermark < stack -> capacity)
+        fprintf(stream, "\t\t[%03lld - %03lld] (UNTOUCHED)\n", stack -> watermark, stack -> capacity - 1);
+
+    if (Policy::Canary::ENABLED) {
+        memcpy(&canary, stack -> data + stack -> capacity, sizeof(CanaryType));
+        fprintf(stream, "\t\tCanary: %0llx\n", canary);
+    }
+
+    ON_STACK_STATS(
+        StackStats stats = {};
+        stack_stats_snapshot(&stats, false);
+        stack_stats_dump(&stats, stream);
+    )
+
+    fputc('\n', stream);
+}
+
+template <typename T, typename Policy>
+void stack_dump_binary(BasicStack<T, Policy> *stack, ErrorBits error, FILE *stream) {
+    CHECK(right_pointer(stack, sizeof(*stack)), return);
+
+    DumpHeader header = {};
+
+    header.object_size = (unsigned) sizeof(T);
+    header.protection = stack_protection(stack);
+    header.hash_engine = get_hash_engine() -> id;
+    header.flags = stack -> flags;
+    header.error = error;
+    header.stack_address = (unsigned long long) stack;
+    header.data_address = (unsigned long long) stack -> data;
+    header.capacity = stack -> capacity;
+    header.max_capacity = stack -> max_capacity;
+    header.size = stack -> size;
+    header.watermark = stack -> watermark;
+    header.struct_hash = stack -> struct_hash;
+    header.buffer_hash = stack -> buffer_hash;
+    header.struct_canary[0] = stack -> canary_begin;
+    header.struct_canary[1] = stack -> canary_end;
+
+    // Buffer is saved under the same conditions text dump prints it
+    header.has_buffer = !(HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_DATA) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_CAPACITY)
+                          || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_HASH_FAIL) || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_CANARY))
+                        && stack -> size >= 0 && stack -> size <= stack -> watermark && stack -> watermark <= stack -> capacity;
+
+    StackSize untouched = (header.has_buffer) ? stack -> watermark - stack -> size : 0;
+    size_t bound = (header.has_buffer) ? (size_t) stack -> size * sizeof(T) + (size_t) untouched * (sizeof(T) + 2 * sizeof(StackSize)) : 0;
+
+    char *record = dump_record(sizeof(DumpHeader) + bound);
+    CHECK(record, return);
+
+    char *payload = record + sizeof(DumpHeader);
+
+    if (header.has_buffer) {
+        if (Policy::Canary::ENABLED) {
+            memcpy(&header.buffer_canary[0], (char *)(stack -> data) - sizeof(CanaryType), sizeof(CanaryType));
+            memcpy(&header.buffer_canary[1], stack -> data + stack -> capacity, sizeof(CanaryType));
+        }
+
+        memcpy(payload, stack -> data, (size_t) stack -> size * sizeof(T));
+        payload += (size_t) stack -> size * sizeof(T);
+
+        // Popped slots are normally one poison run
+        for(StackSize i = stack -> size; i < stack -> watermark;) {
+            StackSize poison = 0, raw = 0;
+
+            while (i + poison < stack -> watermark && is_poison(stack -> data + i + poison)) poison++;
+            while (i + poison + raw < stack -> watermark && !is_poison(stack -> data + i + poison + raw)) raw++;
+
+            memcpy(payload, &poison, sizeof(StackSize));
+            memcpy(payload + sizeof(StackSize), &raw, sizeof(StackSize));
+            memcpy(payload + 2 * sizeof(StackSize), stack -> data + i + poison, (size_t) raw * sizeof(T));
+
+            payload += 2 * sizeof(StackSize) + (size_t) raw * sizeof(T);
+            i += poison + raw;
+        }
+    }
+
+    header.payload_bytes = (unsigned long long)(payload - record) - sizeof(DumpHeader);
+
+    memcpy(record, &header, sizeof(DumpHeader));
+
+    fwrite(record, 1, (size_t)(payload - record), stream);
+}
+
+template <typename T, typename Policy>
+void guard_report(void *stack) {
+    STACK_DUMP((BasicStack<T, Policy> *) stack, ERROR_BIT_FLAGS::BUFFER_CANARY);
+}
+
+#endif
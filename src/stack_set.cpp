@@ -0,0 +1,599 @@
+/**
+ * \file
+ * \brief Stack set module source
+ *
+ * Blocks are powers of two carved from the arena end and reused through per-capacity free lists. Arena grows with realloc,
+ * so blocks are addressed by offsets and stay valid when it moves.
+*/
+
+#include "stack_set.hpp"
+
+
+/**
+ * \brief If set is invalid calls set dump then returns an error code
+ * \param [in] set Set to check
+*/
+#define RETURN_ON_SET_ERROR(set) \
+do { \
+    ErrorBits error = stack_set_check(set); \
+    if (error) { \
+        if (get_log_file()) { \
+            fprintf(get_log_file(), "%s at %s(%d)\n", __PRETTY_FUNCTION__, __FILE__, __LINE__); \
+            stack_set_dump(set, STACK_SET_NONE, error, get_log_file()); \
+            fflush(get_log_file()); \
+        } \
+        return error; \
+    } \
+} while(0)
+
+
+/// Arena capacity of new set
+const unsigned ARENA_MIN_CAPACITY = 1024;
+
+/// Arena never grows beyond this capacity, so offset plus block capacity fits unsigned
+const unsigned ARENA_MAX_CAPACITY = 1u << 31;
+
+/// Length of per-stack arrays of new set
+const StackHandle HANDLES_MIN_CAPACITY = 256;
+
+/// Stacks checked by one step of audit sweep, fixed step lets -O2 vectorize it without scalar tail
+const StackHandle SWEEP_LANES = 8;
+
+
+static_assert(sizeof(Object) >= sizeof(unsigned), "Free block keeps offset of the next one in its first slot");
+
+
+/**
+ * \brief Returns index of block capacity in free block lists
+ * \param capacity Block capacity (power of two)
+ * \return Index in StackSet::free_blocks
+*/
+static unsigned block_class(unsigned capacity);
+
+
+/**
+ * \brief Takes block from free list or from the arena end
+ * \param set Set owning the arena
+ * \param capacity Block capacity
+ * \param offset Offset of the block will be written here
+ * \note Block is poisoned, arena can move
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+static ErrorBits block_allocate(StackSet *set, unsigned capacity, unsigned *offset);
+
+
+/**
+ * \brief Poisons block and puts it to free list
+ * \param set Set owning the arena
+ * \param offset Block offset
+ * \param capacity Block capacity
+*/
+static void block_free(StackSet *set, unsigned offset, unsigned capacity);
+
+
+/**
+ * \brief Lengthens per-stack arrays twice
+ * \param set Set to change
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+static ErrorBits handles_grow(StackSet *set);
+
+
+/**
+ * \brief Resizes per-stack array
+ * \param array Array to resize (NULL - allocate new one)
+ * \param old_length Current length
+ * \param length New length
+ * \return True on success, old array stays valid otherwise
+*/
+template <typename A>
+static bool array_resize(A **array, StackHandle old_length, StackHandle length);
+
+
+/**
+ * \brief Checks offset, size and capacity of one stack without branches
+ * \param offset Block offset
+ * \param size Stack size
+ * \param capacity Block capacity (0 - handle is free, its offset isn't checked)
+ * \param used Objects given to blocks
+ * \return 1 if fields are broken, 0 otherwise
+*/
+static inline unsigned sweep_broken(unsigned offset, unsigned size, unsigned capacity, unsigned used);
+
+
+/**
+ * \brief Checks handle and slots around the top of its stack
+ * \param set Set owning the stack
+ * \param handle Handle to check
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+static ErrorBits handle_check(StackSet *set, StackHandle handle);
+
+
+/**
+ * \brief Writes structure canaries and hash
+ * \param set Set to seal
+*/
+static void set_seal(StackSet *set);
+
+
+/**
+ * \brief Checks structure hash
+ * \param set Set to check
+ * \return #STRUCT_HASH_FAIL if structure hash is wrong
+*/
+static ErrorBits check_struct_hash(StackSet *set);
+
+
+/**
+ * \brief Dumps set whose arena guard page was touched (see #GuardProtect)
+ * \param set Set that owns the arena
+*/
+static void set_guard_report(void *set);
+
+
+
+
+ErrorBits stack_set_constructor(StackSet *set) {
+    CHECK(right_pointer(set, sizeof(StackSet)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    *set = StackSet();
+
+    for(unsigned i = 0; i < STACK_SET_CLASSES; i++)
+        set -> free_blocks[i] = STACK_SET_NONE;
+
+    set -> free_handle = STACK_SET_NONE;
+
+    set -> arena = buffer_allocate<Object, DefaultPolicy>(ARENA_MIN_CAPACITY, (CanaryType)(set), &set_guard_report);
+    CHECK(set -> arena, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+    set -> arena_capacity = ARENA_MIN_CAPACITY;
+
+    ErrorBits error = handles_grow(set);
+
+    if (error) {
+        buffer_free<Object, DefaultPolicy>(set -> arena, ARENA_MIN_CAPACITY);
+        set -> arena = nullptr;
+
+        return error;
+    }
+
+    set_seal(set);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits stack_set_create(StackSet *set, StackHandle *handle) {
+    CHECK(handle, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    RETURN_ON_SET_ERROR(set);
+
+    if (set -> free_handle == STACK_SET_NONE && set -> handles == set -> handle_capacity) {
+        ErrorBits grow_error = handles_grow(set);
+
+        // Some arrays could move even if others failed to
+        set_seal(set);
+
+        if (grow_error) return grow_error;
+    }
+
+    StackHandle created = set -> free_handle;
+
+    // Free handles are linked through offsets that structure hash doesn't cover
+    if (created != STACK_SET_NONE)
+        CHECK(created < set -> handles && (set -> offsets[created] == STACK_SET_NONE || set -> offsets[created] < set -> handles),
+              return ERROR_BIT_FLAGS::INVALID_DATA);
+
+    unsigned offset = 0;
+
+    ErrorBits block_error = block_allocate(set, STACK_SET_MIN_CAPACITY, &offset);
+    if (block_error) return block_error;
+
+    if (created != STACK_SET_NONE)
+        set -> free_handle = set -> offsets[created];
+    else
+        created = set -> handles++;
+
+    set -> offsets[created] = offset;
+    set -> sizes[created] = 0;
+    set -> capacities[created] = STACK_SET_MIN_CAPACITY;
+
+    if (DefaultPolicy::Hash::ENABLED)
+        set -> hashes[created] = hash_bytes(set -> arena, 0);
+
+    set -> count++;
+
+    set_seal(set);
+
+    *handle = created;
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits stack_set_destroy(StackSet *set, StackHandle handle) {
+    RETURN_ON_SET_ERROR(set);
+
+    ErrorBits error = handle_check(set, handle);
+    if (error) return error;
+
+    block_free(set, set -> offsets[handle], set -> capacities[handle]);
+
+    set -> offsets[handle] = set -> free_handle;
+    set -> sizes[handle] = 0;
+    set -> capacities[handle] = 0;
+
+    set -> free_handle = handle;
+    set -> count--;
+
+    set_seal(set);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits stack_set_push(StackSet *set, StackHandle handle, Object object) {
+    RETURN_ON_SET_ERROR(set);
+
+    ErrorBits error = handle_check(set, handle);
+    if (error) return error;
+
+    unsigned size = set -> sizes[handle];
+    unsigned capacity = set -> capacities[handle];
+
+    if (size == capacity) {
+        CHECK(capacity < STACK_SET_MAX_CAPACITY, return ERROR_BIT_FLAGS::STACK_OVERFLOW);
+
+        unsigned offset = 0;
+
+        error = block_allocate(set, capacity * 2, &offset);
+        if (error) return error;
+
+        memcpy(set -> arena + offset, set -> arena + set -> offsets[handle], (size_t) size * sizeof(Object));
+
+        block_free(set, set -> offsets[handle], capacity);
+
+        set -> offsets[handle] = offset;
+        set -> capacities[handle] = capacity * 2;
+
+        set_seal(set);
+    }
+
+    set -> arena[set -> offsets[handle] + size] = object;
+
+    if (DefaultPolicy::Hash::ENABLED)
+        set -> hashes[handle] = hash_append(set -> hashes[handle], &object, sizeof(Object));
+
+    set -> sizes[handle] = size + 1;
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits stack_set_pop(StackSet *set, StackHandle handle, Object *object) {
+    CHECK(object, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    RETURN_ON_SET_ERROR(set);
+
+    ErrorBits error = handle_check(set, handle);
+    if (error) return error;
+
+    CHECK(set -> sizes[handle] > 0, return ERROR_BIT_FLAGS::EMPTY_STACK);
+
+    unsigned size = --set -> sizes[handle];
+    Object *slot = set -> arena + set -> offsets[handle] + size;
+
+    *object = *slot;
+
+    if (DefaultPolicy::Hash::ENABLED)
+        set -> hashes[handle] = hash_remove(set -> hashes[handle], object, sizeof(Object));
+
+    DefaultPolicy::Poison::fill(slot, 1);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits stack_set_destructor(StackSet *set) {
+    RETURN_ON_SET_ERROR(set);
+
+    buffer_free<Object, DefaultPolicy>(set -> arena, set -> arena_capacity);
+
+    stack_deallocate(set -> offsets, (size_t) set -> handle_capacity * sizeof(unsigned));
+    stack_deallocate(set -> sizes, (size_t) set -> handle_capacity * sizeof(unsigned));
+    stack_deallocate(set -> capacities, (size_t) set -> handle_capacity * sizeof(unsigned));
+
+    if (set -> hashes)
+        stack_deallocate(set -> hashes, (size_t) set -> handle_capacity * sizeof(HashType));
+
+    *set = StackSet();
+
+    set_seal(set);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits stack_set_check(StackSet *set) {
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    CHECK(right_pointer(set, sizeof(StackSet)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    error = DefaultPolicy::Canary::check_struct(set);
+    if (error) return error;
+
+    error = check_struct_hash(set);
+    if (error) return error;
+
+    CHECK(set -> arena_used <= set -> arena_capacity && set -> arena_capacity <= ARENA_MAX_CAPACITY, return ERROR_BIT_FLAGS::INVALID_CAPACITY);
+    CHECK(set -> count <= set -> handles && set -> handles <= set -> handle_capacity, return ERROR_BIT_FLAGS::INVALID_SIZE);
+
+    CHECK(right_pointer(set -> arena, (size_t) set -> arena_capacity * sizeof(Object)), return ERROR_BIT_FLAGS::INVALID_DATA);
+
+    CHECK(right_pointer(set -> offsets, (size_t) set -> handle_capacity * sizeof(unsigned))
+          && right_pointer(set -> sizes, (size_t) set -> handle_capacity * sizeof(unsigned))
+          && right_pointer(set -> capacities, (size_t) set -> handle_capacity * sizeof(unsigned)), return ERROR_BIT_FLAGS::INVALID_DATA);
+
+    if (DefaultPolicy::Hash::ENABLED)
+        CHECK(right_pointer(set -> hashes, (size_t) set -> handle_capacity * sizeof(HashType)), return ERROR_BIT_FLAGS::INVALID_DATA);
+
+    return DefaultPolicy::Canary::check_frame(set -> arena, set -> arena_capacity, (CanaryType)(set));
+}
+
+
+ErrorBits stack_set_audit(StackSet *set) {
+    ErrorBits error = stack_set_check(set);
+    if (error) return error;
+
+    const unsigned *offsets = set -> offsets;
+    const unsigned *sizes = set -> sizes;
+    const unsigned *capacities = set -> capacities;
+
+    unsigned used = set -> arena_used;
+    unsigned broken = 0;
+    StackHandle handles = set -> handles, live = 0;
+
+    StackHandle swept = 0;
+
+    for(; swept + SWEEP_LANES <= handles; swept += SWEEP_LANES) {
+        for(StackHandle lane = swept; lane < swept + SWEEP_LANES; lane++) {
+            broken |= sweep_broken(offsets[lane], sizes[lane], capacities[lane], used);
+            live += (capacities[lane] != 0);
+        }
+    }
+
+    for(; swept < handles; swept++) {
+        broken |= sweep_broken(offsets[swept], sizes[swept], capacities[swept], used);
+        live += (capacities[swept] != 0);
+    }
+
+    CHECK(!broken && live == set -> count, return ERROR_BIT_FLAGS::INVALID_SIZE);
+
+    for(StackHandle i = 0; i < handles; i++) {
+        if (!capacities[i]) continue;
+
+        const Object *data = set -> arena + offsets[i];
+
+        if (DefaultPolicy::Hash::ENABLED)
+            CHECK(hash_bytes(data, (size_t) sizes[i] * sizeof(Object)) == set -> hashes[i], error |= ERROR_BIT_FLAGS::BUFFER_HASH_FAIL);
+
+        if (DefaultPolicy::Poison::ENABLED) {
+            CHECK(count_poison(data, 0, sizes[i]) == 0, error |= ERROR_BIT_FLAGS::UNEXP_POISON_VAL);
+            CHECK(count_poison(data, sizes[i], capacities[i]) == capacities[i] - sizes[i], error |= ERROR_BIT_FLAGS::UNEXP_NORMAL_VAL);
+        }
+    }
+
+    return error;
+}
+
+
+void stack_set_dump(StackSet *set, StackHandle handle, ErrorBits error, FILE *stream) {
+    CHECK(right_pointer(set, sizeof(StackSet)), return);
+
+    fprintf(stream, "\tStackSet[%p]:\n", (void *) set);
+
+    print_errors(error, stream);
+
+    fprintf(stream, "\tStacks: %u\n\tHandles: %u of %u\n\tArena: %u of %u objects\n", set -> count, set -> handles, set -> handle_capacity,
+            set -> arena_used, set -> arena_capacity);
+
+    if (DefaultPolicy::Hash::ENABLED)
+        fprintf(stream, "\tStruct hash: %0llx\n", set -> struct_hash);
+
+    if (HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_DATA) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_SIZE) || HAS_ERROR(error, ERROR_BIT_FLAGS::INVALID_CAPACITY)
+            || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_HASH_FAIL) || HAS_ERROR(error, ERROR_BIT_FLAGS::STRUCT_CANARY)) {
+        fputc('\n', stream);
+        return;
+    }
+
+    // Block of broken or free handle isn't printed
+    ErrorBits handle_error = handle_check(set, handle);
+
+    if (HAS_ERROR(handle_error, ERROR_BIT_FLAGS::INVALID_ARGUMENT) || HAS_ERROR(handle_error, ERROR_BIT_FLAGS::INVALID_SIZE)) {
+        fputc('\n', stream);
+        return;
+    }
+
+    fprintf(stream, "\tStack %u:\n\tSize: %u\n\tCapacity: %u\n", handle, set -> sizes[handle], set -> capacities[handle]);
+
+    if (DefaultPolicy::Hash::ENABLED)
+        fprintf(stream, "\tBuffer hash: %0llx\n", set -> hashes[handle]);
+
+    const Object *data = set -> arena + set -> offsets[handle];
+
+    fprintf(stream, "\tData[%p]:\n", (const void *) data);
+
+    for(unsigned i = 0; i < set -> capacities[handle]; i++) {
+        fprintf(stream, "\t\t[%03u] ", i);
+
+        print_object(data + i, stream);
+
+        if (is_poison(data + i)) fprintf(stream, " (POISON VALUE)");
+
+        fputc('\n', stream);
+    }
+
+    fputc('\n', stream);
+}
+
+
+static unsigned block_class(unsigned capacity) {
+    unsigned index = 0;
+
+    while (((unsigned) STACK_SET_MIN_CAPACITY << index) < capacity)
+        index++;
+
+    return index;
+}
+
+
+static ErrorBits block_allocate(StackSet *set, unsigned capacity, unsigned *offset) {
+    unsigned index = block_class(capacity);
+
+    if (set -> free_blocks[index] != STACK_SET_NONE) {
+        unsigned block = set -> free_blocks[index], next = 0;
+
+        // Free blocks are linked through arena slots that structure hash doesn't cover
+        CHECK(set -> arena_used >= capacity && block <= set -> arena_used - capacity, return ERROR_BIT_FLAGS::INVALID_DATA);
+
+        memcpy(&next, set -> arena + block, sizeof(unsigned));
+
+        CHECK(next == STACK_SET_NONE || next <= set -> arena_used - capacity, return ERROR_BIT_FLAGS::INVALID_DATA);
+
+        set -> free_blocks[index] = next;
+        *offset = block;
+    }
+    else {
+        if (set -> arena_capacity - set -> arena_used < capacity) {
+            unsigned arena_capacity = set -> arena_capacity;
+
+            while (arena_capacity - set -> arena_used < capacity && arena_capacity < ARENA_MAX_CAPACITY)
+                arena_capacity *= 2;
+
+            CHECK(arena_capacity - set -> arena_used >= capacity, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+            Object *arena = buffer_reallocate<Object, DefaultPolicy>(set -> arena, set -> arena_capacity, arena_capacity, (CanaryType)(set),
+                                                                     &set_guard_report);
+            CHECK(arena, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+            set -> arena = arena;
+            set -> arena_capacity = arena_capacity;
+        }
+
+        *offset = set -> arena_used;
+        set -> arena_used += capacity;
+    }
+
+    DefaultPolicy::Poison::fill(set -> arena + *offset, (StackSize) capacity);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+static void block_free(StackSet *set, unsigned offset, unsigned capacity) {
+    unsigned index = block_class(capacity);
+
+    DefaultPolicy::Poison::fill(set -> arena + offset, (StackSize) capacity);
+
+    memcpy(set -> arena + offset, &set -> free_blocks[index], sizeof(unsigned));
+
+    set -> free_blocks[index] = offset;
+}
+
+
+static ErrorBits handles_grow(StackSet *set) {
+    StackHandle old_length = set -> handle_capacity;
+    StackHandle length = (old_length) ? old_length * 2 : HANDLES_MIN_CAPACITY;
+
+    CHECK(length > old_length && length < STACK_SET_NONE, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+    // Arrays that are already longer stay so, length is updated only when all of them are resized
+    CHECK(array_resize(&set -> offsets, old_length, length)
+          && array_resize(&set -> sizes, old_length, length)
+          && array_resize(&set -> capacities, old_length, length), return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+    if (DefaultPolicy::Hash::ENABLED)
+        CHECK(array_resize(&set -> hashes, old_length, length), return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+    set -> handle_capacity = length;
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+template <typename A>
+static bool array_resize(A **array, StackHandle old_length, StackHandle length) {
+    A *resized = (A *)((*array) ? stack_reallocate(*array, (size_t) old_length * sizeof(A), (size_t) length * sizeof(A))
+                                : stack_allocate((size_t) length * sizeof(A)));
+    if (!resized) return false;
+
+    *array = resized;
+
+    return true;
+}
+
+
+static inline unsigned sweep_broken(unsigned offset, unsigned size, unsigned capacity, unsigned used) {
+    unsigned taken = (capacity != 0);
+
+    return (unsigned)(size > capacity) | (unsigned)(capacity > STACK_SET_MAX_CAPACITY) | (unsigned)((capacity & (capacity - 1)) != 0)
+         | (taken & ((unsigned)(capacity < STACK_SET_MIN_CAPACITY) | (unsigned)(capacity > used) | (unsigned)(offset > used - capacity)));
+}
+
+
+static ErrorBits handle_check(StackSet *set, StackHandle handle) {
+    CHECK(handle < set -> handles && set -> capacities[handle], return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    unsigned size = set -> sizes[handle];
+    unsigned capacity = set -> capacities[handle];
+
+    CHECK(size <= capacity && capacity <= set -> arena_used && set -> offsets[handle] <= set -> arena_used - capacity, return ERROR_BIT_FLAGS::INVALID_SIZE);
+
+    ErrorBits error = ERROR_BIT_FLAGS::STACK_OK;
+
+    if (DefaultPolicy::Poison::ENABLED) {
+        const Object *data = set -> arena + set -> offsets[handle];
+
+        // Only slots around the top are checked here, blocks are scanned by stack_set_audit()
+        if (size > 0)
+            CHECK(!is_poison(data + size - 1), error |= ERROR_BIT_FLAGS::UNEXP_POISON_VAL);
+
+        if (size < capacity)
+            CHECK(is_poison(data + size), error |= ERROR_BIT_FLAGS::UNEXP_NORMAL_VAL);
+    }
+
+    return error;
+}
+
+
+static void set_seal(StackSet *set) {
+    DefaultPolicy::Canary::set_struct(set);
+
+    if (DefaultPolicy::Hash::ENABLED) {
+        set -> struct_hash = 0;
+        set -> struct_hash = hash_struct(set);
+    }
+}
+
+
+static ErrorBits check_struct_hash(StackSet *set) {
+    if (!DefaultPolicy::Hash::ENABLED) return ERROR_BIT_FLAGS::STACK_OK;
+
+    // Copy is hashed, so the set isn't written while it is checked
+    StackSet copy = *set;
+
+    copy.struct_hash = 0;
+
+    CHECK(hash_struct(&copy) == set -> struct_hash, return ERROR_BIT_FLAGS::STRUCT_HASH_FAIL);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+static void set_guard_report(void *set) {
+    if (get_log_file()) {
+        stack_set_dump((StackSet *) set, STACK_SET_NONE, ERROR_BIT_FLAGS::BUFFER_CANARY, get_log_file());
+        fflush(get_log_file());
+    }
+}
@@ -0,0 +1,141 @@
+/**
+ * \file
+ * \brief Stack set module header
+ *
+ * Contains many small stacks of #Object addressed by handles. Fields of all stacks are kept in arrays (offset, size and capacity
+ * are hot, hashes are cold) and their objects are kept in one arena, so stack costs a few bytes besides its objects
+*/
+
+#ifndef STACK_SET_HPP
+#define STACK_SET_HPP
+
+#include "stack.hpp"
+
+
+#define STACK_SET_NONE 0xFFFFFFFFu    ///< No handle or block
+#define STACK_SET_MIN_CAPACITY 4      ///< Capacity of new stack
+#define STACK_SET_MAX_CAPACITY 131072 ///< Stack in set never grows beyond this capacity
+#define STACK_SET_CLASSES 16          ///< Number of block capacities (powers of two from minimum to maximum)
+
+
+/// Handle of stack in set
+typedef unsigned StackHandle;
+
+
+/**
+ * \brief Structure for holding set of stacks
+ * \note Stacks have no canaries of their own: arena is framed with canaries and free slots of every block are poisoned,
+ * so overrun of one stack shows up as unexpected value in the next block. Structure hash doesn't cover per-stack arrays,
+ * so push and pop that don't move the block don't rehash it
+*/
+typedef struct {
+    CanaryType canary_begin = 0;
+
+    unsigned *offsets = nullptr;     ///< Offset of block of each stack in arena (free handle keeps the next free handle here)
+    unsigned *sizes = nullptr;       ///< Number of objects in each stack
+    unsigned *capacities = nullptr;  ///< Block capacity of each stack (0 - handle is free)
+
+    HashType *hashes = nullptr;      ///< Buffer hash of each stack (allocated with hash protection only)
+
+    Object *arena = nullptr;         ///< Blocks of all stacks
+    unsigned arena_capacity = 0;     ///< Number of objects arena can hold
+    unsigned arena_used = 0;         ///< Objects given to blocks, the rest of arena is untouched
+
+    unsigned free_blocks[STACK_SET_CLASSES] = {}; ///< First free block of each capacity, free block keeps offset of the next one in its first slot
+
+    StackHandle handles = 0;         ///< Number of handles ever given out
+    StackHandle handle_capacity = 0; ///< Length of per-stack arrays
+    StackHandle free_handle = 0;     ///< First free handle
+    StackHandle count = 0;           ///< Number of live stacks
+
+    HashType struct_hash = 0;
+
+    CanaryType canary_end = 0;
+} StackSet;
+
+
+/**
+ * \brief Constructs empty set
+ * \param set This set will be filled
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits stack_set_constructor(StackSet *set);
+
+
+/**
+ * \brief Creates empty stack in set
+ * \param set Set to add stack to
+ * \param handle Handle of new stack will be written here
+ * \note Handles and blocks of destroyed stacks are reused
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits stack_set_create(StackSet *set, StackHandle *handle);
+
+
+/**
+ * \brief Destroys stack in set
+ * \param set Set owning the stack
+ * \param handle Stack to destroy, handle becomes invalid
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits stack_set_destroy(StackSet *set, StackHandle handle);
+
+
+/**
+ * \brief Adds object to stack in set
+ * \param set Set owning the stack
+ * \param handle Stack to push
+ * \param object This object will be added to the top of stack
+ * \note Full stack moves to a block twice as large, blocks never shrink until stack is destroyed
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits stack_set_push(StackSet *set, StackHandle handle, Object object);
+
+
+/**
+ * \brief Pops top object from stack in set
+ * \param set Set owning the stack
+ * \param handle Stack to pop
+ * \param object Value of popped object will be written to this pointer
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits stack_set_pop(StackSet *set, StackHandle handle, Object *object);
+
+
+/**
+ * \brief Destructs set and all stacks in it
+ * \param set This set will be destructed
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits stack_set_destructor(StackSet *set);
+
+
+/**
+ * \brief Fast set verificator
+ * \param set Set to check
+ * \note Checks the structure and arena canaries only, so it takes O(1) time
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits stack_set_check(StackSet *set);
+
+
+/**
+ * \brief Full set verificator
+ * \param set Set to check
+ * \note Sweeps size, capacity and offset arrays of all stacks at once without branches, so compiler vectorizes it.
+ * If they are fine, hashes and poisoned slots of every stack are checked
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits stack_set_audit(StackSet *set);
+
+
+/**
+ * \brief Prints set and content of one stack
+ * \param set This set will be printed
+ * \param handle Stack to print (#STACK_SET_NONE - set only)
+ * \param error This error code will be printed
+ * \param stream File to dump in
+*/
+void stack_set_dump(StackSet *set, StackHandle handle, ErrorBits error, FILE *stream);
+
+#endif
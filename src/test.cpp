@@ -2,27 +2,144 @@
  * \file
  * \brief Test module source
  * 
- * Contains realisation of run_tests() function
+ * Contains realisation of run_tests() function. Workers take tests by index from shared counter,
+ * every test logs into its own file if log prefix is given.
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
 #include "test.hpp"
+#include "logs.hpp"
+#include "allocator.hpp"
+
+
+/// Result of one test
+typedef struct {
+    ReturnCode return_code = 0; ///< Code returned by test function
+    double seconds = 0;         ///< Wall time
+    long long peak_bytes = 0;   ///< Peak of stack memory allocated by the test thread
+} TestResult;
+
+
+/**
+ * \brief Runs one test and measures it
+ * \param test Test to run
+ * \param number Test number for log file name
+ * \param data Some additional data for test
+ * \param options Runner options
+ * \return Test result
+*/
+static TestResult run_test(const Test *test, unsigned long long number, void *data, const TestOptions *options);
+
+
 
 
 int run_tests(Test tests[], unsigned long long size, void *data) {
-    int count = 0;
+    return run_tests(tests, size, data, NULL);
+}
+
 
-    for(size_t t = 0; t < size; t++) {
-        ReturnCode return_code = (*tests[t].test_func)(data);
+int run_tests(Test tests[], unsigned long long size, void *data, const TestOptions *options) {
+    TestOptions default_options = {};
+    if (!options) options = &default_options;
 
-        if (return_code == tests[t].return_code) {
+    std::vector<TestResult> results(size);
+    std::atomic<unsigned long long> next(0);
+
+    auto worker = [&]() {
+        for(unsigned long long t = next++; t < size; t = next++)
+            results[t] = run_test(tests + t, t + 1, data, options);
+    };
+
+    unsigned threads = (options -> threads) ? options -> threads : std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    if (threads > size) threads = (unsigned) size;
+
+    if (threads <= 1)
+        worker();
+    else {
+        std::vector<std::thread> workers;
+
+        for(unsigned i = 0; i < threads; i++)
+            workers.emplace_back(worker);
+
+        for(std::thread &thread : workers)
+            thread.join();
+    }
+
+    int count = 0;
+
+    for(unsigned long long t = 0; t < size; t++) {
+        if (results[t].return_code == tests[t].return_code) {
             printf("Test %llu: Ok\n", t + 1);
             count++;
         }
         else {
-            printf("Test %llu: Fail, Expected: %llu, Got: %llu\n", t + 1, tests[t].return_code, return_code);
+            printf("Test %llu: Fail, Expected: %llu, Got: %llu\n", t + 1, tests[t].return_code, results[t].return_code);
         }
     }
 
+    if (options -> summary) {
+        std::vector<unsigned long long> order(size);
+
+        for(unsigned long long t = 0; t < size; t++)
+            order[t] = t;
+
+        std::sort(order.begin(), order.end(), [&](unsigned long long a, unsigned long long b) {
+            return results[a].seconds > results[b].seconds;
+        });
+
+        printf("\nTest timings, %u threads:\n", threads);
+
+        for(unsigned long long t : order)
+            printf("Test %llu: %10.3f ms, peak stack memory %10.1f KB\n", t + 1, results[t].seconds * 1000, (double) results[t].peak_bytes / 1024);
+    }
+
     return count;
 }
+
+
+static TestResult run_test(const Test *test, unsigned long long number, void *data, const TestOptions *options) {
+    TestResult result = {};
+
+    FILE *log = nullptr;
+
+    if (options -> log_prefix) {
+        char filename[FILENAME_MAX] = "";
+        snprintf(filename, sizeof(filename), "%s%02llu.txt", options -> log_prefix, number);
+
+        log = fopen(filename, "w");
+
+        if (log) log_redirect(log);
+        else printf("Couldn't open test log file %s!\n", filename);
+    }
+
+    // Test runs on one worker, so counters of this thread belong to it
+    AllocationStats before = {};
+
+    allocation_peak_reset();
+    allocation_stats(&before);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    result.return_code = (*test -> test_func)(data);
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    AllocationStats after = {};
+    allocation_stats(&after);
+
+    result.peak_bytes = after.peak_bytes - before.live_bytes;
+
+    if (log) {
+        log_redirect(nullptr);
+        fclose(log);
+    }
+
+    return result;
+}
@@ -5,6 +5,9 @@
  * Include it to run indepent test function
 */
 
+#ifndef TEST_HPP
+#define TEST_HPP
+
 
 /// Return code type (good for bit flags or integer)
 typedef unsigned long long ReturnCode;
@@ -22,6 +25,14 @@ typedef struct {
 } Test;
 
 
+/// Test runner options
+typedef struct {
+    unsigned threads = 1;              ///< Number of worker threads (0 - one per hardware thread)
+    const char *log_prefix = nullptr;  ///< Test logs are written to files prefix + test number + ".txt" (null - common log)
+    bool summary = false;              ///< Print tests sorted by wall time
+} TestOptions;
+
+
 /**
  * \brief Runs tests from array
  * \param tests Array of tests to run
@@ -30,3 +41,18 @@ typedef struct {
  * \return Number of successfull tests
 */
 int run_tests(Test tests[], unsigned long long size, void *data);
+
+
+/**
+ * \brief Runs tests from array on worker threads
+ * \param tests Array of tests to run
+ * \param size Size of array
+ * \param data Some additional data for test
+ * \param options Threads, logs and summary (null - same as run_tests() without options)
+ * \return Number of successfull tests
+ * \note Results are printed in test order after all tests finish.
+ * Peak memory is counted by stack allocator in the thread that ran the test, so threads started by the test aren't counted
+*/
+int run_tests(Test tests[], unsigned long long size, void *data, const TestOptions *options);
+
+#endif
@@ -0,0 +1,259 @@
+/**
+ * \file
+ * \brief Background verifier module source
+ *
+ * Registry is fixed table like guard page regions. Slot lock holds token of the thread that took it: owner spins on it,
+ * verifier only tries it once per sweep, so long audit delays owner of the audited stack only.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "verifier.hpp"
+
+
+/// Marks slot that is being filled
+#define SLOT_CLAIMED ((void *) 1)
+
+
+/// Token of verifier thread (owners hold slots with their own tokens)
+#define VERIFIER_TOKEN 1u
+
+
+/// Registered stack
+typedef struct {
+    std::atomic<void *> stack;               ///< Registered stack (null - free slot, #SLOT_CLAIMED - being filled)
+    std::atomic<unsigned> busy;              ///< Token of the thread holding the slot (0 - free)
+    std::atomic<unsigned long long> error;   ///< Errors of the first failed audit
+    VerifierAudit audit;                     ///< Audit function
+} VerifiedStack;
+
+
+/// Registry of stacks
+static VerifiedStack slots[VERIFIER_MAX_STACKS] = {};
+
+/// Slots after this index have never been used
+static std::atomic<size_t> slots_used(0);
+
+
+/// Counters of VerifierStats
+static std::atomic<unsigned long long> sweeps(0), audits(0), skipped(0), errors(0);
+
+
+/// Guards verifier thread state
+static std::mutex thread_mutex;
+
+/// Wakes verifier thread when it must stop
+static std::condition_variable thread_wake;
+
+/// Verifier thread
+static std::thread verifier_thread;
+
+/// Verifier thread is asked to stop
+static bool thread_stop = false;
+
+
+/// Next token given to a thread that takes slots
+static std::atomic<unsigned> next_token(VERIFIER_TOKEN + 1);
+
+/// Token of the current thread (0 - not given yet)
+static thread_local unsigned thread_token = 0;
+
+
+/**
+ * \brief Returns token of the current thread
+ * \return Token
+*/
+static unsigned current_token(void);
+
+
+/**
+ * \brief Sweeps registry until verifier_stop() is called
+ * \param period_ms Pause between sweeps in milliseconds
+*/
+static void verifier_loop(unsigned period_ms);
+
+
+
+
+int verifier_register(void *stack, VerifierAudit audit) {
+    for(size_t i = 0; i < VERIFIER_MAX_STACKS; i++) {
+        void *expected = nullptr;
+
+        if (!slots[i].stack.compare_exchange_strong(expected, SLOT_CLAIMED, std::memory_order_acquire)) continue;
+
+        verifier_lock((int) i);
+
+        slots[i].error.store(0, std::memory_order_relaxed);
+        slots[i].audit = audit;
+
+        slots[i].stack.store(stack, std::memory_order_release);
+
+        size_t used = slots_used.load(std::memory_order_relaxed);
+
+        while (used < i + 1 && !slots_used.compare_exchange_weak(used, i + 1, std::memory_order_relaxed)) {}
+
+        return (int) i;
+    }
+
+    return -1;
+}
+
+
+void verifier_unregister(int slot) {
+    if (slot < 0 || slot >= VERIFIER_MAX_STACKS) return;
+
+    verifier_lock(slot);
+
+    slots[slot].stack.store(nullptr, std::memory_order_relaxed);
+
+    verifier_unlock(slot);
+}
+
+
+bool verifier_owns(int slot, const void *stack) {
+    if (slot < 0 || slot >= VERIFIER_MAX_STACKS) return false;
+
+    return slots[slot].stack.load(std::memory_order_relaxed) == stack;
+}
+
+
+unsigned long long verifier_error(int slot) {
+    if (slot < 0 || slot >= VERIFIER_MAX_STACKS) return 0;
+
+    return slots[slot].error.load(std::memory_order_relaxed);
+}
+
+
+void verifier_lock(int slot) {
+    if (slot < 0 || slot >= VERIFIER_MAX_STACKS) return;
+
+    unsigned token = current_token(), expected = 0;
+
+    while (!slots[slot].busy.compare_exchange_weak(expected, token, std::memory_order_acquire)) {
+        while (slots[slot].busy.load(std::memory_order_relaxed))
+            std::this_thread::yield();
+
+        expected = 0;
+    }
+}
+
+
+void verifier_unlock(int slot) {
+    if (slot < 0 || slot >= VERIFIER_MAX_STACKS) return;
+
+    slots[slot].busy.store(0, std::memory_order_release);
+}
+
+
+void verifier_release(void) {
+    if (!thread_token) return;
+
+    size_t used = slots_used.load(std::memory_order_acquire);
+
+    for(size_t i = 0; i < used; i++)
+        if (slots[i].busy.load(std::memory_order_relaxed) == thread_token)
+            slots[i].busy.store(0, std::memory_order_release);
+}
+
+
+size_t verifier_sweep(void) {
+    size_t broken = 0;
+    size_t used = slots_used.load(std::memory_order_acquire);
+
+    for(size_t i = 0; i < used; i++) {
+        void *stack = slots[i].stack.load(std::memory_order_acquire);
+
+        if (stack <= SLOT_CLAIMED || slots[i].error.load(std::memory_order_relaxed)) continue;
+
+        unsigned expected = 0;
+
+        if (!slots[i].busy.compare_exchange_strong(expected, VERIFIER_TOKEN, std::memory_order_acquire)) {
+            skipped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Stack could be unregistered before we took the slot
+        stack = slots[i].stack.load(std::memory_order_relaxed);
+
+        if (stack > SLOT_CLAIMED) {
+            unsigned long long error = slots[i].audit(stack);
+
+            audits.fetch_add(1, std::memory_order_relaxed);
+
+            if (error) {
+                slots[i].error.store(error, std::memory_order_relaxed);
+                errors.fetch_add(1, std::memory_order_relaxed);
+                broken++;
+            }
+        }
+
+        slots[i].busy.store(0, std::memory_order_release);
+    }
+
+    sweeps.fetch_add(1, std::memory_order_relaxed);
+
+    return broken;
+}
+
+
+int verifier_start(unsigned period_ms) {
+    std::lock_guard<std::mutex> lock(thread_mutex);
+
+    if (verifier_thread.joinable()) return 1;
+
+    thread_stop = false;
+    verifier_thread = std::thread(&verifier_loop, period_ms);
+
+    return 0;
+}
+
+
+void verifier_stop(void) {
+    std::thread thread;
+
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex);
+
+        thread_stop = true;
+        thread.swap(verifier_thread);
+    }
+
+    thread_wake.notify_all();
+
+    if (thread.joinable()) thread.join();
+}
+
+
+void verifier_stats(VerifierStats *stats) {
+    if (!stats) return;
+
+    stats -> sweeps = sweeps.load(std::memory_order_relaxed);
+    stats -> audits = audits.load(std::memory_order_relaxed);
+    stats -> skipped = skipped.load(std::memory_order_relaxed);
+    stats -> errors = errors.load(std::memory_order_relaxed);
+}
+
+
+static void verifier_loop(unsigned period_ms) {
+    std::unique_lock<std::mutex> lock(thread_mutex);
+
+    while (!thread_stop) {
+        lock.unlock();
+        verifier_sweep();
+        lock.lock();
+
+        thread_wake.wait_for(lock, std::chrono::milliseconds(period_ms), []() { return thread_stop; });
+    }
+}
+
+
+static unsigned current_token(void) {
+    // Zero and verifier token are skipped when counter wraps around
+    while (thread_token <= VERIFIER_TOKEN)
+        thread_token = next_token.fetch_add(1, std::memory_order_relaxed);
+
+    return thread_token;
+}
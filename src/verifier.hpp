@@ -0,0 +1,137 @@
+/**
+ * \file
+ * \brief Background verifier module header
+ *
+ * Keeps registry of live stacks and audits them from separate thread, so stack functions do only O(1) checks.
+ * Every registered stack has a lock: mutator holds it while it changes the stack, verifier only tries it and skips busy stacks.
+*/
+
+#ifndef VERIFIER_HPP
+#define VERIFIER_HPP
+
+#include <stddef.h>
+
+
+#define VERIFIER_MAX_STACKS 4096 ///< Maximum number of stacks in registry
+
+
+/// Audits stack, reports errors and returns them (see #ERROR_BIT_FLAGS)
+typedef unsigned long long (*VerifierAudit)(void *stack);
+
+
+/// Verifier counters since start of the program
+typedef struct {
+    unsigned long long sweeps = 0;  ///< Passes over the registry
+    unsigned long long audits = 0;  ///< Stacks audited
+    unsigned long long skipped = 0; ///< Stacks skipped because their owner held them
+    unsigned long long errors = 0;  ///< Stacks found broken
+} VerifierStats;
+
+
+/// Holds registered stack for the rest of the scope (negative slot does nothing)
+struct VerifierLock {
+    int slot; ///< Registry slot (see verifier_register())
+
+    explicit VerifierLock(int slot_); ///< Locks slot
+    ~VerifierLock();                  ///< Unlocks slot
+
+    VerifierLock(const VerifierLock &) = delete;
+    VerifierLock &operator=(const VerifierLock &) = delete;
+};
+
+
+/**
+ * \brief Puts stack in registry
+ * \param stack Stack to audit
+ * \param audit Function that audits it
+ * \return Slot or -1 if registry is full
+ * \note Slot is returned locked, unlock it with verifier_unlock() when the stack is ready to be audited
+*/
+int verifier_register(void *stack, VerifierAudit audit);
+
+
+/**
+ * \brief Removes stack from registry
+ * \param slot Slot returned by verifier_register()
+ * \note Waits until verifier finishes audit of this stack, don't call it while holding the slot
+*/
+void verifier_unregister(int slot);
+
+
+/**
+ * \brief Checks that slot belongs to the stack
+ * \param slot Slot to check
+ * \param stack Stack that claims it
+ * \return True if stack is registered in this slot
+*/
+bool verifier_owns(int slot, const void *stack);
+
+
+/**
+ * \brief Returns errors verifier found in the stack
+ * \param slot Slot of the stack
+ * \return Error code of the first failed audit or 0 (see #ERROR_BIT_FLAGS)
+ * \note Broken stack isn't audited again, so it is reported once
+*/
+unsigned long long verifier_error(int slot);
+
+
+/**
+ * \brief Waits until verifier leaves the slot and takes it
+ * \param slot Slot of the stack
+*/
+void verifier_lock(int slot);
+
+
+/**
+ * \brief Releases slot taken by verifier_lock() or verifier_register()
+ * \param slot Slot of the stack
+*/
+void verifier_unlock(int slot);
+
+
+/**
+ * \brief Releases every slot the current thread holds
+ * \note For code that left scope of VerifierLock without its destructor (see guard_recover())
+*/
+void verifier_release(void);
+
+
+/**
+ * \brief Audits every registered stack that isn't held by its owner
+ * \return Number of stacks found broken during this sweep
+*/
+size_t verifier_sweep(void);
+
+
+/**
+ * \brief Starts verifier thread
+ * \param period_ms Pause between sweeps in milliseconds
+ * \return 0 - OK, 1 - FAIL (already started)
+*/
+int verifier_start(unsigned period_ms);
+
+
+/**
+ * \brief Stops verifier thread and waits for it
+*/
+void verifier_stop(void);
+
+
+/**
+ * \brief Returns verifier counters
+ * \param stats Counters will be written here
+*/
+void verifier_stats(VerifierStats *stats);
+
+
+inline VerifierLock::VerifierLock(int slot_) : slot(slot_) {
+    if (slot >= 0) verifier_lock(slot);
+}
+
+
+inline VerifierLock::~VerifierLock() {
+    if (slot >= 0) verifier_unlock(slot);
+}
+
+#endif
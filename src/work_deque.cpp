@@ -0,0 +1,238 @@
+/**
+ * \file
+ * \brief Work-stealing deque module source
+ * 
+ * Chase-Lev algorithm with C11 memory model fences (Le, Pop, Cohen, Zappa Nardelli, 2013).
+ * Owner's push and pop use plain stores and one fence, only the race for the last object needs CAS.
+*/
+
+#include "work_deque.hpp"
+
+
+/**
+ * \brief Allocates ring buffer
+ * \param deque Deque owning the buffer
+ * \param capacity Buffer capacity
+ * \return Buffer or NULL
+*/
+static DequeArray *array_allocate(WorkDeque *deque, StackSize capacity);
+
+
+/**
+ * \brief Doubles ring buffer capacity
+ * \param deque Deque to grow
+ * \param array Current buffer
+ * \param top Index of the first object
+ * \param bottom Index after the last object
+ * \return New buffer or NULL
+*/
+static DequeArray *array_grow(WorkDeque *deque, DequeArray *array, StackSize top, StackSize bottom);
+
+
+/// Reads object from ring buffer (may race with owner's grow, so access is atomic)
+static inline Object array_load(DequeArray *array, StackSize index) {
+    return __atomic_load_n(array -> data + (index & (array -> capacity - 1)), __ATOMIC_RELAXED);
+}
+
+
+/// Writes object to ring buffer
+static inline void array_store(DequeArray *array, StackSize index, Object object) {
+    __atomic_store_n(array -> data + (index & (array -> capacity - 1)), object, __ATOMIC_RELAXED);
+}
+
+
+
+
+ErrorBits work_deque_constructor(WorkDeque *deque, StackSize capacity) {
+    CHECK(right_pointer(deque, sizeof(WorkDeque)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+    CHECK(capacity > 0 && capacity <= MAX_CAPACITY_VALUE, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    StackSize size = 1;
+    while (size < capacity) size *= 2;
+
+    DequeArray *array = array_allocate(deque, size);
+    CHECK(array, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+
+    deque -> top.store(0, std::memory_order_relaxed);
+    deque -> bottom.store(0, std::memory_order_relaxed);
+    deque -> array.store(array, std::memory_order_relaxed);
+
+    deque -> canary_begin = (CanaryType)(deque);
+    deque -> canary_end = (CanaryType)(deque);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits work_deque_push(WorkDeque *deque, Object object) {
+    #ifdef _DEBUG
+        ErrorBits error = work_deque_check(deque);
+        if (error) return error;
+    #endif
+
+    StackSize bottom = deque -> bottom.load(std::memory_order_relaxed);
+    StackSize top = deque -> top.load(std::memory_order_acquire);
+    DequeArray *array = deque -> array.load(std::memory_order_relaxed);
+
+    if (bottom - top > array -> capacity - 1) {
+        array = array_grow(deque, array, top, bottom);
+        CHECK(array, return ERROR_BIT_FLAGS::ALLOCATE_FAIL);
+    }
+
+    array_store(array, bottom, object);
+
+    std::atomic_thread_fence(std::memory_order_release);
+
+    deque -> bottom.store(bottom + 1, std::memory_order_relaxed);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits work_deque_pop(WorkDeque *deque, Object *object) {
+    CHECK(object, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+
+    #ifdef _DEBUG
+        ErrorBits error = work_deque_check(deque);
+        if (error) return error;
+    #endif
+
+    StackSize bottom = deque -> bottom.load(std::memory_order_relaxed) - 1;
+    DequeArray *array = deque -> array.load(std::memory_order_relaxed);
+
+    deque -> bottom.store(bottom, std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    StackSize top = deque -> top.load(std::memory_order_relaxed);
+
+    if (top > bottom) {
+        deque -> bottom.store(bottom + 1, std::memory_order_relaxed);
+        return ERROR_BIT_FLAGS::EMPTY_STACK;
+    }
+
+    // Caller's object is written only when the race is won
+    Object value = array_load(array, bottom);
+
+    if (top == bottom) {
+        // Last object, race against thieves
+        bool won = deque -> top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+
+        deque -> bottom.store(bottom + 1, std::memory_order_relaxed);
+
+        CHECK(won, return ERROR_BIT_FLAGS::EMPTY_STACK);
+    }
+
+    *object = value;
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits work_deque_steal(WorkDeque *deque, Object *object) {
+    CHECK(object, return ERROR_BIT_FLAGS::INVALID_ARGUMENT);
+    CHECK(right_pointer(deque, sizeof(WorkDeque)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    #ifdef _DEBUG
+        CHECK(deque -> canary_begin == (CanaryType)(deque) && deque -> canary_end == (CanaryType)(deque), return ERROR_BIT_FLAGS::STRUCT_CANARY);
+    #endif
+
+    while (true) {
+        StackSize top = deque -> top.load(std::memory_order_acquire);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        StackSize bottom = deque -> bottom.load(std::memory_order_acquire);
+
+        if (top >= bottom) return ERROR_BIT_FLAGS::EMPTY_STACK;
+
+        DequeArray *array = deque -> array.load(std::memory_order_acquire);
+
+        Object value = array_load(array, top);
+
+        if (deque -> top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            *object = value;
+            return ERROR_BIT_FLAGS::STACK_OK;
+        }
+
+        // Lost the race to another thief or to the owner, try again
+    }
+}
+
+
+ErrorBits work_deque_destructor(WorkDeque *deque) {
+    ErrorBits error = work_deque_check(deque);
+    if (error) return error;
+
+    DequeArray *array = deque -> array.load(std::memory_order_relaxed);
+
+    while (array) {
+        DequeArray *retired = array -> retired;
+
+        buffer_free<Object, DefaultPolicy>(array -> data, array -> capacity);
+        free(array);
+
+        array = retired;
+    }
+
+    deque -> array.store(nullptr, std::memory_order_relaxed);
+    deque -> top.store(0, std::memory_order_relaxed);
+    deque -> bottom.store(0, std::memory_order_relaxed);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+ErrorBits work_deque_check(WorkDeque *deque) {
+    CHECK(right_pointer(deque, sizeof(WorkDeque)), return ERROR_BIT_FLAGS::INVALID_POINTER);
+
+    CHECK(deque -> canary_begin == (CanaryType)(deque) && deque -> canary_end == (CanaryType)(deque), return ERROR_BIT_FLAGS::STRUCT_CANARY);
+
+    DequeArray *array = deque -> array.load(std::memory_order_relaxed);
+
+    CHECK(right_pointer(array, sizeof(DequeArray)), return ERROR_BIT_FLAGS::INVALID_DATA);
+    CHECK(right_pointer(array -> data, (size_t) array -> capacity * sizeof(Object)), return ERROR_BIT_FLAGS::INVALID_DATA);
+
+    CHECK(array -> capacity > 0 && (array -> capacity & (array -> capacity - 1)) == 0, return ERROR_BIT_FLAGS::INVALID_CAPACITY);
+
+    ErrorBits error = DefaultPolicy::Canary::check_frame(array -> data, array -> capacity, (CanaryType)(deque));
+    if (error) return error;
+
+    StackSize size = deque -> bottom.load(std::memory_order_relaxed) - deque -> top.load(std::memory_order_relaxed);
+
+    // Size is -1 for a moment while owner pops from empty deque
+    CHECK(size >= -1 && size <= array -> capacity, return ERROR_BIT_FLAGS::INVALID_SIZE);
+
+    return ERROR_BIT_FLAGS::STACK_OK;
+}
+
+
+static DequeArray *array_allocate(WorkDeque *deque, StackSize capacity) {
+    DequeArray *array = (DequeArray *) calloc(1, sizeof(DequeArray));
+    CHECK(array, return NULL);
+
+    // Deque has no dump, so guard page fault is only logged
+    array -> data = buffer_allocate<Object, DefaultPolicy>(capacity, (CanaryType)(deque), NULL);
+    CHECK(array -> data, free(array); return NULL);
+
+    array -> capacity = capacity;
+    array -> retired = NULL;
+
+    return array;
+}
+
+
+static DequeArray *array_grow(WorkDeque *deque, DequeArray *array, StackSize top, StackSize bottom) {
+    DequeArray *grown = array_allocate(deque, array -> capacity * 2);
+    CHECK(grown, return NULL);
+
+    for(StackSize i = top; i < bottom; i++)
+        array_store(grown, i, array_load(array, i));
+
+    // Thieves holding old buffer still read valid objects from it
+    grown -> retired = array;
+
+    deque -> array.store(grown, std::memory_order_release);
+
+    return grown;
+}
@@ -0,0 +1,92 @@
+/**
+ * \file
+ * \brief Work-stealing deque module header
+ *
+ * Contains Chase-Lev deque of #Object: owner pushes and pops at the bottom, thieves steal from the top
+*/
+
+#ifndef WORK_DEQUE_HPP
+#define WORK_DEQUE_HPP
+
+#include <atomic>
+#include "stack.hpp"
+
+
+/// Ring buffer of the deque, old buffers are kept until destructor so thieves can still read them
+typedef struct DequeArray {
+    Object *data = nullptr;             ///< Canary-framed buffer (see buffer_allocate())
+    StackSize capacity = 0;             ///< Power of two
+    struct DequeArray *retired = nullptr; ///< Previous buffer
+} DequeArray;
+
+
+/// Structure for holding work-stealing deque
+typedef struct {
+    CanaryType canary_begin = 0;
+
+    std::atomic<StackSize> top;        ///< Next index to steal (changed by thieves and by owner's last pop)
+    std::atomic<StackSize> bottom;     ///< Next index to push (changed by owner only)
+    std::atomic<DequeArray *> array;   ///< Current ring buffer
+
+    CanaryType canary_end = 0;
+} WorkDeque;
+
+
+/**
+ * \brief Constructs work-stealing deque
+ * \param deque This deque will be filled
+ * \param capacity Initial capacity (will be rounded up to the power of two)
+ * \note Not thread safe, call it before sharing the deque
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits work_deque_constructor(WorkDeque *deque, StackSize capacity);
+
+
+/**
+ * \brief Adds object to the bottom of the deque
+ * \param deque This deque will be pushed
+ * \param object This object will be added
+ * \note Owner thread only, grows buffer without blocking thieves
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits work_deque_push(WorkDeque *deque, Object object);
+
+
+/**
+ * \brief Pops object from the bottom of the deque
+ * \param deque This deque will be popped
+ * \param object Value of popped object will be written to this pointer
+ * \note Owner thread only
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits work_deque_pop(WorkDeque *deque, Object *object);
+
+
+/**
+ * \brief Steals object from the top of the deque
+ * \param deque This deque will be robbed
+ * \param object Value of stolen object will be written to this pointer
+ * \note Can be called from any thread
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits work_deque_steal(WorkDeque *deque, Object *object);
+
+
+/**
+ * \brief Destructs work-stealing deque
+ * \param deque This deque will be destructed
+ * \note No other thread can use the deque at this point
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits work_deque_destructor(WorkDeque *deque);
+
+
+/**
+ * \brief Work-stealing deque verificator
+ * \param deque Deque to check
+ * \note Owner thread only
+ * \return Error code (see #ERROR_BIT_FLAGS)
+*/
+ErrorBits work_deque_check(WorkDeque *deque);
+
+#endif